@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "aot.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+bool aot_enter(AotScript* script, const AotInfo* info, int* global_slots,
+               NativeFn* native_fns)
+{
+    for (int i = 0; i < info->native_count; i++)
+    {
+        const char* name = info->native_names[i];
+        int index = find_native(name, (int)strlen(name));
+        if (index == -1)
+        {
+            fprintf(stderr, "Undefined native '%s'.\n", name);
+            return false;
+        }
+        native_fns[i] = natives[index].function;
+    }
+
+    script->previous = vm.chunk;
+    script->previous_ip = vm.ip;
+
+    // the code and lines are static, so the chunk must never be freed
+    init_chunk(&script->chunk);
+    script->chunk.code = info->code;
+    script->chunk.lines = (int*)info->lines;
+    script->chunk.count = info->length;
+
+    vm.chunk = &script->chunk;
+    vm.ip = script->chunk.code;
+    vm.stack_top = vm.stack;
+    vm.slots = vm.stack;
+    reserve_stack(info->stack_depth);
+
+    // each one is a root as soon as it's added, before the next can collect
+    for (int i = 0; i < info->string_count; i++)
+    {
+        const AotString* string = &info->strings[i];
+        add_constant(&script->chunk,
+                     copy_string(string->chars, string->length));
+    }
+
+    for (int i = 0; i < info->global_count; i++)
+    {
+        const char* name = info->global_names[i];
+        global_slots[i] = global_slot(intern_string(name, (int)strlen(name)));
+    }
+    return true;
+}
+
+void aot_leave(AotScript* script)
+{
+    free_value_array(&script->chunk.constants);
+    vm.chunk = script->previous;
+    vm.ip = script->previous_ip;
+    vm.stack_top = vm.stack;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <math.h>
+#include <stdio.h>
+
+#include "arith.h"
+#include "array.h"
+#include "chunk.h"
+#include "common.h"
+#include "map.h"
+#include "native.h"
+#include "object.h"
+#include "vm.h"
+
+// what the C written by --emit-c (emit.h) is compiled against. The generated
+// function is the script with run() taken out: every stack slot is a local,
+// jumps are gotos, and these macros do what the BODY_OP_* handlers do, with
+// the same checks and error messages
+
+// a string constant, made when the function starts
+typedef struct AotString
+{
+    const char* chars;
+    int length;
+} AotString;
+
+// everything the generated file knows about the script, as static data
+typedef struct AotInfo
+{
+    // the code is never read, it's just there so vm.ip can point into it and
+    // runtime_err finds the line
+    uint8_t* code;
+    const int* lines;
+    int length;
+
+    const AotString* strings;
+    int string_count;
+    // looked up by name, the slots are only known at runtime
+    const char* const* global_names;
+    int global_count;
+    const char* const* native_names;
+    int native_count;
+    // the most values the function keeps in vm.stack at once
+    int stack_depth;
+} AotInfo;
+
+// one call of a generated function
+typedef struct AotScript
+{
+    // stands in for the bytecode while it runs: vm.chunk points at it, so
+    // the gc sees the string constants and errors get their line
+    Chunk chunk;
+    Chunk* previous;
+    uint8_t* previous_ip;
+} AotScript;
+
+// sets up the vm to run the script like interpret() would, and resolves its
+// globals and natives. false (after reporting it) if a native is missing
+bool aot_enter(AotScript* script, const AotInfo* info, int* global_slots,
+               NativeFn* native_fns);
+void aot_leave(AotScript* script);
+
+// these expect the generated function's `script` and an `error:` label
+#define AOT_CONSTANT(index) (script.chunk.constants.values[index])
+#define AOT_GLOBAL(index) (vm.globals.values[global_slots[index]])
+
+// `at` is where vm.ip would be when run() reports the error
+#define AOT_ERROR(at, ...)                                                     \
+    do                                                                         \
+    {                                                                          \
+        vm.ip = script.chunk.code + (at);                                      \
+        runtime_err(__VA_ARGS__);                                              \
+        goto error;                                                            \
+    } while (false)
+
+#define AOT_FALSEY(value)                                                      \
+    (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+
+#define AOT_CHECK_GLOBAL(index, at)                                            \
+    if (IS_UNDEFINED(AOT_GLOBAL(index)))                                       \
+    {                                                                          \
+        AOT_ERROR(at, "Undefined variable '%s'.",                              \
+                  global_name(global_slots[index]));                           \
+    }
+
+#define AOT_ADD_NUM(a, b) ((a) + (b))
+#define AOT_SUB_NUM(a, b) ((a) - (b))
+#define AOT_MULT_NUM(a, b) ((a) * (b))
+#define AOT_DIV_NUM(a, b) ((a) / (b))
+#define AOT_GRTR(a, b) ((a) > (b))
+#define AOT_LESS(a, b) ((a) < (b))
+#define AOT_NOT_LESS(a, b) (!((a) < (b)))
+#define AOT_NOT_GRTR(a, b) (!((a) > (b)))
+
+// a = a op b, see ARITH_OP in vm.c
+#define AOT_ARITH(a, b, int_op, double_op, at)                                 \
+    {                                                                          \
+        int64_t result;                                                        \
+        if (IS_INT(a) && IS_INT(b) && !int_op(AS_INT(a), AS_INT(b), &result))  \
+        {                                                                      \
+            a = INT_VAL(result);                                               \
+        }                                                                      \
+        else if (IS_NUM(a) && IS_NUM(b))                                       \
+        {                                                                      \
+            a = NUM_VAL(double_op(AS_NUM(a), AS_NUM(b)));                      \
+        }                                                                      \
+        else if (IS_NUMERIC(a) && IS_NUMERIC(b))                               \
+        {                                                                      \
+            a = NUM_VAL(double_op(TO_NUM(a), TO_NUM(b)));                      \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            AOT_ERROR(at, "Operands must be numbers");                         \
+        }                                                                      \
+    }
+
+#define AOT_COMPARE(a, b, compare, at)                                         \
+    {                                                                          \
+        if (IS_INT(a) && IS_INT(b))                                            \
+        {                                                                      \
+            a = BOOL_VAL(compare(AS_INT(a), AS_INT(b)));                       \
+        }                                                                      \
+        else if (IS_NUMERIC(a) && IS_NUMERIC(b))                               \
+        {                                                                      \
+            a = BOOL_VAL(compare(TO_NUM(a), TO_NUM(b)));                       \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            AOT_ERROR(at, "Operands must be numbers");                         \
+        }                                                                      \
+    }
+
+// a = a[b], see BODY_OP_INDEX
+#define AOT_INDEX(a, b, at)                                                    \
+    {                                                                          \
+        Value value;                                                           \
+        if (IS_MAP(a))                                                         \
+        {                                                                      \
+            a = map_get(AS_MAP(a), b, &value) ? value : NIL_VAL;               \
+        }                                                                      \
+        else if (!IS_ARRAY(a))                                                 \
+        {                                                                      \
+            AOT_ERROR(at, "Only arrays and maps can be indexed.");             \
+        }                                                                      \
+        else if (!IS_INT(b))                                                   \
+        {                                                                      \
+            AOT_ERROR(at, "Array index must be an integer.");                  \
+        }                                                                      \
+        else if (AS_INT(b) < 0 || AS_INT(b) >= AS_ARRAY(a)->count)             \
+        {                                                                      \
+            AOT_ERROR(at, "Array index out of range.");                        \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            a = array_element(AS_ARRAY(a), (int)AS_INT(b));                    \
+        }                                                                      \
+    }
+
+#define AOT_NEGATE(a, at)                                                      \
+    {                                                                          \
+        if (IS_INT(a) && AS_INT(a) != INT64_MIN)                               \
+        {                                                                      \
+            a = INT_VAL(-AS_INT(a));                                           \
+        }                                                                      \
+        else if (IS_NUMERIC(a))                                                \
+        {                                                                      \
+            a = NUM_VAL(-TO_NUM(a));                                           \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            AOT_ERROR(at, "'-' can only be used on numbers.");                 \
+        }                                                                      \
+    }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common.h"
+
+// shared by run() and the C that --emit-c writes (see aot.h), so both give
+// the same answers
+
+// int arithmetic is checked, whenever the answer doesn't fit these return true
+// and the vm does it in doubles instead
+static inline bool add_overflows(int64_t a, int64_t b, int64_t* result)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_add_overflow(a, b, result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b))
+    {
+        return true;
+    }
+    *result = a + b;
+    return false;
+#endif
+}
+
+static inline bool sub_overflows(int64_t a, int64_t b, int64_t* result)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_sub_overflow(a, b, result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b))
+    {
+        return true;
+    }
+    *result = a - b;
+    return false;
+#endif
+}
+
+static inline bool mul_overflows(int64_t a, int64_t b, int64_t* result)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_mul_overflow(a, b, result);
+#else
+    if (a != 0 && b != 0 &&
+        (a > 0 ? (b > 0 ? a > INT64_MAX / b : b < INT64_MIN / a)
+               : (b > 0 ? a < INT64_MIN / b : b < INT64_MAX / a)))
+    {
+        return true;
+    }
+    *result = a * b;
+    return false;
+#endif
+}
+
+// `/` only stays an int when it divides exactly: 6 / 3 is 2, 7 / 2 is 3.5
+static inline bool div_inexact(int64_t a, int64_t b, int64_t* result)
+{
+    if (b == 0 || (a == INT64_MIN && b == -1) || a % b != 0)
+    {
+        return true;
+    }
+    *result = a / b;
+    return false;
+}
+
+// `^` with an int base and a non-negative int exponent is exact
+static inline bool pow_overflows(int64_t base, int64_t exp, int64_t* result)
+{
+    if (exp < 0)
+    {
+        return true;
+    }
+
+    int64_t acc = 1;
+    while (exp)
+    {
+        if ((exp & 1) && mul_overflows(acc, base, &acc))
+        {
+            return true;
+        }
+        exp >>= 1;
+        if (exp && mul_overflows(base, base, &base))
+        {
+            return true;
+        }
+    }
+    *result = acc;
+    return false;
+}
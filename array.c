@@ -0,0 +1,341 @@
+#include "array.h"
+#include "common.h"
+#include "memory.h"
+#include "native.h"
+#include "vm.h"
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+// the kernels take each operand as a pointer and a step: 1 for an array, 0 for
+// a number that goes with every element (so it's x[0] each time). the loads are
+// unaligned, objects are only 8 byte aligned
+
+#ifdef HAVE_SSE2
+// two elements of x, or the number twice. an array's x[0] is never read
+// outside the loop, it may be empty
+#define LOAD2(x, step, all, i) ((step) ? _mm_loadu_pd((x) + (i)) : (all))
+#endif
+
+// out[i] = a[i] op b[i], two at a time with `simd_op`
+#ifdef HAVE_SSE2
+#define ARITH_KERNEL(name, op, simd_op)                                        \
+    static void name(double* out, const double* a, int a_step,                 \
+                     const double* b, int b_step, int count)                   \
+    {                                                                          \
+        __m128d a_all = _mm_set1_pd(a_step ? 0 : a[0]);                        \
+        __m128d b_all = _mm_set1_pd(b_step ? 0 : b[0]);                        \
+        int i = 0;                                                             \
+        for (; i + 2 <= count; i += 2)                                         \
+        {                                                                      \
+            __m128d x = LOAD2(a, a_step, a_all, i);                            \
+            __m128d y = LOAD2(b, b_step, b_all, i);                            \
+            _mm_storeu_pd(out + i, simd_op(x, y));                             \
+        }                                                                      \
+        for (; i < count; i++)                                                 \
+        {                                                                      \
+            out[i] = a[i * a_step] op b[i * b_step];                           \
+        }                                                                      \
+    }
+#else
+#define ARITH_KERNEL(name, op, simd_op)                                        \
+    static void name(double* out, const double* a, int a_step,                 \
+                     const double* b, int b_step, int count)                   \
+    {                                                                          \
+        for (int i = 0; i < count; i++)                                        \
+        {                                                                      \
+            out[i] = a[i * a_step] op b[i * b_step];                           \
+        }                                                                      \
+    }
+#endif
+
+ARITH_KERNEL(add_kernel, +, _mm_add_pd)
+ARITH_KERNEL(sub_kernel, -, _mm_sub_pd)
+ARITH_KERNEL(mult_kernel, *, _mm_mul_pd)
+ARITH_KERNEL(div_kernel, /, _mm_div_pd)
+
+#undef ARITH_KERNEL
+
+// there's no simd pow, and fast_pow is what `^` does for numbers
+static void pow_kernel(double* out, const double* a, int a_step,
+                       const double* b, int b_step, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = fast_pow(a[i * a_step], b[i * b_step]);
+    }
+}
+
+// out[i] = a[i] < b[i], or !(a[i] < b[i]) if `negate` (`a >= b`). `a > b`
+// and `a <= b` are the same with the operands swapped
+static void less_kernel(Value* out, const double* a, int a_step,
+                        const double* b, int b_step, int count, bool negate)
+{
+    int i = 0;
+#ifdef HAVE_SSE2
+    __m128d a_all = _mm_set1_pd(a_step ? 0 : a[0]);
+    __m128d b_all = _mm_set1_pd(b_step ? 0 : b[0]);
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d x = LOAD2(a, a_step, a_all, i);
+        __m128d y = LOAD2(b, b_step, b_all, i);
+        // one bit per element
+        int less = _mm_movemask_pd(_mm_cmplt_pd(x, y)) ^ (negate ? 3 : 0);
+        out[i] = BOOL_VAL((less & 1) != 0);
+        out[i + 1] = BOOL_VAL((less & 2) != 0);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = BOOL_VAL((a[i * a_step] < b[i * b_step]) != negate);
+    }
+}
+
+// a numeric array, or a number (written to `number`)
+static bool numeric_operand(Value value, double* number, const double** x,
+                            int* step)
+{
+    if (IS_ARRAY(value) && AS_ARRAY(value)->numeric)
+    {
+        *x = ARRAY_NUMBERS(AS_ARRAY(value));
+        *step = 1;
+        return true;
+    }
+    if (IS_NUMERIC(value))
+    {
+        *number = TO_NUM(value);
+        *x = number;
+        *step = 0;
+        return true;
+    }
+    return false;
+}
+
+static int operand_count(Value value)
+{
+    return IS_ARRAY(value) ? AS_ARRAY(value)->count : -1;
+}
+
+void make_array(int count)
+{
+    Value* elements = vm.stack_top - count;
+    bool numeric = true;
+    for (int i = 0; i < count; i++)
+    {
+        numeric &= IS_NUMERIC(elements[i]);
+    }
+
+    // the gc may move the elements, but they stay in the same stack slots
+    ObjArray* array = new_array(count, numeric);
+    for (int i = 0; i < count; i++)
+    {
+        if (numeric)
+        {
+            ARRAY_NUMBERS(array)[i] = TO_NUM(elements[i]);
+        }
+        else
+        {
+            array->values[i] = elements[i];
+            WRITE_BARRIER(&array->obj, elements[i]);
+        }
+    }
+
+    vm.stack_top = elements;
+    *vm.stack_top++ = OBJ_VAL(array);
+}
+
+bool array_binary(OpCode op)
+{
+    Value a = vm.stack_top[-2];
+    Value b = vm.stack_top[-1];
+    if (!IS_ARRAY(a) && !IS_ARRAY(b))
+    {
+        runtime_err(op == OP_ADD
+                        ? "Operands must be two numbers or two strings."
+                        : "Operands must be numbers");
+        return false;
+    }
+
+    double a_number, b_number;
+    const double* x;
+    const double* y;
+    int x_step, y_step;
+    if (!numeric_operand(a, &a_number, &x, &x_step) ||
+        !numeric_operand(b, &b_number, &y, &y_step))
+    {
+        runtime_err("Operands must be numbers");
+        return false;
+    }
+
+    int count = operand_count(a) != -1 ? operand_count(a) : operand_count(b);
+    if (operand_count(b) != -1 && operand_count(b) != count)
+    {
+        runtime_err("Arrays must be the same length.");
+        return false;
+    }
+
+    bool compare = op == OP_GRTR || op == OP_LESS || op == OP_NOT_LESS ||
+                   op == OP_NOT_GRTR;
+    ObjArray* result = new_array(count, !compare);
+
+    // the gc may have moved them
+    numeric_operand(vm.stack_top[-2], &a_number, &x, &x_step);
+    numeric_operand(vm.stack_top[-1], &b_number, &y, &y_step);
+    double* out = ARRAY_NUMBERS(result);
+    switch (op)
+    {
+    case OP_ADD:
+        add_kernel(out, x, x_step, y, y_step, count);
+        break;
+    case OP_SUB:
+        sub_kernel(out, x, x_step, y, y_step, count);
+        break;
+    case OP_MULT:
+        mult_kernel(out, x, x_step, y, y_step, count);
+        break;
+    case OP_DIV:
+        div_kernel(out, x, x_step, y, y_step, count);
+        break;
+    case OP_POW:
+        pow_kernel(out, x, x_step, y, y_step, count);
+        break;
+    case OP_GRTR:
+    case OP_NOT_GRTR:
+        less_kernel(result->values, y, y_step, x, x_step, count,
+                    op == OP_NOT_GRTR);
+        break;
+    case OP_LESS:
+    case OP_NOT_LESS:
+        less_kernel(result->values, x, x_step, y, y_step, count,
+                    op == OP_NOT_LESS);
+        break;
+    default:
+        break; // unreachable
+    }
+
+    vm.stack_top[-2] = OBJ_VAL(result);
+    vm.stack_top--;
+    return true;
+}
+
+bool array_negate()
+{
+    Value value = vm.stack_top[-1];
+    if (!(IS_ARRAY(value) && AS_ARRAY(value)->numeric))
+    {
+        runtime_err("'-' can only be used on numbers.");
+        return false;
+    }
+
+    ObjArray* result = new_array(AS_ARRAY(value)->count, true);
+    ObjArray* array = AS_ARRAY(vm.stack_top[-1]);
+    for (int i = 0; i < array->count; i++)
+    {
+        ARRAY_NUMBERS(result)[i] = -ARRAY_NUMBERS(array)[i];
+    }
+
+    vm.stack_top[-1] = OBJ_VAL(result);
+    return true;
+}
+
+void array_not(Value* slot)
+{
+    ObjArray* result = new_array(AS_ARRAY(*slot)->count, false);
+    ObjArray* array = AS_ARRAY(*slot);
+    for (int i = 0; i < array->count; i++)
+    {
+        Value element = array_element(array, i);
+        result->values[i] = BOOL_VAL(
+            IS_NIL(element) || (IS_BOOL(element) && !AS_BOOL(element)));
+    }
+    *slot = OBJ_VAL(result);
+}
+
+double array_sum(ObjArray* array)
+{
+    const double* x = ARRAY_NUMBERS(array);
+    double sum = 0;
+    int i = 0;
+#ifdef HAVE_SSE2
+    // two accumulators, so each add doesn't have to wait for the one before
+    __m128d sum0 = _mm_setzero_pd();
+    __m128d sum1 = _mm_setzero_pd();
+    for (; i + 4 <= array->count; i += 4)
+    {
+        sum0 = _mm_add_pd(sum0, _mm_loadu_pd(x + i));
+        sum1 = _mm_add_pd(sum1, _mm_loadu_pd(x + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < array->count; i++)
+    {
+        sum += x[i];
+    }
+    return sum;
+}
+
+// min_pd(x, m) is `x < m ? x : m`, the same test the min native does for its
+// arguments: the first of equal elements wins and a NaN is only kept if it's
+// the first element. each lane keeps the first of its own elements, but lane 1
+// can hold an earlier one than lane 0, so when the two are equal (0.0 and
+// -0.0 aren't the same) the first element equal to them is looked up again
+#ifdef HAVE_SSE2
+#define REDUCE_KERNEL(name, op, simd_op)                                       \
+    double name(ObjArray* array)                                               \
+    {                                                                          \
+        const double* x = ARRAY_NUMBERS(array);                                \
+        double result = x[0];                                                  \
+        int i = 1;                                                             \
+        if (array->count >= 3)                                                 \
+        {                                                                      \
+            __m128d m = _mm_set1_pd(x[0]);                                     \
+            for (; i + 2 <= array->count; i += 2)                              \
+            {                                                                  \
+                m = simd_op(_mm_loadu_pd(x + i), m);                           \
+            }                                                                  \
+            double lanes[2];                                                   \
+            _mm_storeu_pd(lanes, m);                                           \
+            result = lanes[1] op lanes[0] ? lanes[1] : lanes[0];               \
+            if (lanes[0] == lanes[1])                                          \
+            {                                                                  \
+                int j = 0;                                                     \
+                while (x[j] != result)                                         \
+                {                                                              \
+                    j++;                                                       \
+                }                                                              \
+                result = x[j];                                                 \
+            }                                                                  \
+        }                                                                      \
+        for (; i < array->count; i++)                                          \
+        {                                                                      \
+            if (x[i] op result)                                                \
+            {                                                                  \
+                result = x[i];                                                 \
+            }                                                                  \
+        }                                                                      \
+        return result;                                                         \
+    }
+#else
+#define REDUCE_KERNEL(name, op, simd_op)                                       \
+    double name(ObjArray* array)                                               \
+    {                                                                          \
+        const double* x = ARRAY_NUMBERS(array);                                \
+        double result = x[0];                                                  \
+        for (int i = 1; i < array->count; i++)                                 \
+        {                                                                      \
+            if (x[i] op result)                                                \
+            {                                                                  \
+                result = x[i];                                                 \
+            }                                                                  \
+        }                                                                      \
+        return result;                                                         \
+    }
+#endif
+
+REDUCE_KERNEL(array_min, <, _mm_min_pd)
+REDUCE_KERNEL(array_max, >, _mm_max_pd)
+
+#undef REDUCE_KERNEL
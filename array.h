@@ -0,0 +1,33 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "object.h"
+
+// the array half of the operators: run() only comes here once the operands
+// turned out not to be plain numbers. they all work on the vm stack, like
+// concatenate(), since the result is allocated while the operands are still
+// on it
+
+// replaces the `count` values on top of the stack with an array of them. it's
+// numeric if they're all numbers
+void make_array(int count);
+
+// replaces a and b (b on top) with `a op b`, one element at a time: either both
+// are arrays of the same length, or one is a number that goes with every
+// element of the other. OP_ADD, OP_SUB, OP_MULT, OP_DIV and OP_POW make a
+// numeric array, the comparisons an array of bools. false (after reporting
+// it) for anything else, with the message run() would give if neither is an
+// array
+bool array_binary(OpCode op);
+
+// OP_NEGATE of the array on top of the stack, which has to be numeric
+bool array_negate();
+// `!` of every element of the array in `slot`, which is on the vm stack (the
+// gc may move the array). `!` itself is always false for an array
+void array_not(Value* slot);
+
+// reductions of a numeric array. min and max need at least one element
+double array_sum(ObjArray* array);
+double array_min(ObjArray* array);
+double array_max(ObjArray* array);
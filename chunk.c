@@ -1,3 +1,6 @@
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "chunk.h"
 #include "memory.h"
 
@@ -10,6 +13,7 @@ void init_chunk(Chunk* chunk)
     chunk->code = NULL;
     chunk->lines = NULL;
     init_value_array(&chunk->constants);
+    chunk->max_depth = 0;
 }
 
 void write_chunk(Chunk* chunk, uint8_t byte, int line)
@@ -38,6 +42,7 @@ void free_chunk(Chunk* chunk)
 {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    free_value_array(&chunk->constants);
     init_chunk(chunk);
 }
 
@@ -45,4 +50,201 @@ int add_constant(Chunk* chunk, Value value)
 {
     write_value_array(&chunk->constants, value);
     return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+#define SUPERINSTR2_INFO(name, a, b) {#name, 2, {a, b}},
+#define SUPERINSTR3_INFO(name, a, b, c) {#name, 3, {a, b, c}},
+// the empty one at the end is there so the array is never empty
+static const Superinstr superinstrs[] = {
+    SUPERINSTRS(SUPERINSTR2_INFO, SUPERINSTR3_INFO){NULL, 0, {0}},
+};
+#undef SUPERINSTR2_INFO
+#undef SUPERINSTR3_INFO
+
+const Superinstr* get_superinstr(OpCode op)
+{
+    int index = (int)op - FIRST_SUPERINSTR;
+    int count = sizeof(superinstrs) / sizeof(superinstrs[0]) - 1;
+    if (index < 0 || index >= count)
+    {
+        return NULL;
+    }
+    return &superinstrs[index];
+}
+
+// the jump a superinstruction ends with, or just `op`
+static OpCode jump_kind(OpCode op)
+{
+    const Superinstr* super = get_superinstr(op);
+    return super == NULL ? op : super->ops[super->op_count - 1];
+}
+
+int instr_length(OpCode op)
+{
+    const Superinstr* super = get_superinstr(op);
+    if (super != NULL)
+    {
+        // one opcode, then everyone's operands
+        int length = 1;
+        for (int i = 0; i < super->op_count; i++)
+        {
+            length += instr_length(super->ops[i]) - 1;
+        }
+        return length;
+    }
+
+    switch (op)
+    {
+    case OP_CONSTANT:
+    case OP_IMPORT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_PICK:
+    case OP_ARRAY:
+    case OP_MAP:
+    case OP_FORMAT:
+    case OP_INC_LOCAL:
+        return 2;
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_ADD_CONST_LOCAL:
+    case OP_INC_GLOBAL:
+    case OP_CALL_NATIVE:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_TRUE:
+    case OP_LOOP:
+        return 3;
+    case OP_ADD_CONST_GLOBAL:
+        return 4;
+    default:
+        return 1;
+    }
+}
+
+bool is_jump(OpCode op)
+{
+    switch (jump_kind(op))
+    {
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_TRUE:
+    case OP_LOOP:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// the offset is always the last operand, and counts from the end
+int jump_target(Chunk* chunk, int offset)
+{
+    OpCode op = chunk->code[offset];
+    int end = offset + instr_length(op);
+    int jump = (chunk->code[end - 2] << 8) | chunk->code[end - 1];
+    if (jump_kind(op) == OP_LOOP)
+    {
+        return end - jump;
+    }
+    return end + jump;
+}
+
+bool jump_fits(Chunk* chunk, int offset, int target)
+{
+    int end = offset + instr_length(chunk->code[offset]);
+    int jump = target > offset ? target - end : end - target;
+    return jump <= UINT16_MAX;
+}
+
+void set_jump_target(Chunk* chunk, int offset, int target)
+{
+    OpCode op = chunk->code[offset];
+    int end = offset + instr_length(op);
+    // OP_LOOP is the only backwards jump
+    int jump = jump_kind(op) == OP_LOOP ? end - target : target - end;
+    if (jump < 0 || jump > UINT16_MAX)
+    {
+        // cutting it down to 16 bits would jump somewhere else entirely
+        fprintf(stderr, "Jump at %04d to %04d doesn't fit.\n", offset, target);
+        abort();
+    }
+    chunk->code[end - 2] = (uint8_t)((jump >> 8) & 0xff);
+    chunk->code[end - 1] = (uint8_t)(jump & 0xff);
+}
+
+int split_instr(Chunk* chunk, int offset, Part* parts)
+{
+    OpCode op = chunk->code[offset];
+    const Superinstr* super = get_superinstr(op);
+    if (super == NULL)
+    {
+        parts[0].op = op;
+        parts[0].operands = offset + 1;
+        parts[0].ip = offset + instr_length(op);
+        return 1;
+    }
+
+    // one opcode, then everyone's operands (see instr_length)
+    int operands = offset + 1;
+    for (int i = 0; i < super->op_count; i++)
+    {
+        parts[i].op = super->ops[i];
+        parts[i].operands = operands;
+        operands += instr_length(super->ops[i]) - 1;
+        parts[i].ip = operands;
+    }
+    return super->op_count;
+}
+
+int stack_effect(Chunk* chunk, Part* part)
+{
+    switch (part->op)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_PICK:
+        return 1;
+    case OP_ARRAY:
+    case OP_FORMAT:
+        return 1 - chunk->code[part->operands];
+    case OP_MAP:
+        return 1 - 2 * chunk->code[part->operands];
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_EQUAL:
+    case OP_GRTR:
+    case OP_LESS:
+    case OP_NOT_LESS:
+    case OP_NOT_GRTR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MULT:
+    case OP_DIV:
+    case OP_POW:
+    case OP_PRINT:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_TRUE:
+    case OP_INDEX:
+        return -1;
+    case OP_SELECT:
+        return -2;
+    case OP_CALL_NATIVE:
+        return 1 - chunk->code[part->operands + 1];
+    default:
+        return 0;
+    }
+}
+
+bool is_update(OpCode op)
+{
+    return op == OP_INC_LOCAL || op == OP_ADD_CONST_LOCAL ||
+           op == OP_INC_GLOBAL || op == OP_ADD_CONST_GLOBAL;
+}
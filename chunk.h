@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "superinstr.h"
 #include "value.h"
 
 typedef enum OpCode
@@ -9,6 +10,24 @@ typedef enum OpCode
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
+    OP_POP,
+    // OP_GET_LOCAL <stack slot>
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    // OP_GET_GLOBAL <u16 index into vm.globals>
+    OP_GET_GLOBAL,
+    OP_DEFINE_GLOBAL,
+    OP_SET_GLOBAL,
+    // `a = a + 1;` and `a = a + k;` (a constant) made into one instruction by
+    // the optimizer. they update the variable in place and push nothing
+    // OP_INC_LOCAL <slot>
+    OP_INC_LOCAL,
+    // OP_ADD_CONST_LOCAL <slot> <constant>
+    OP_ADD_CONST_LOCAL,
+    // OP_INC_GLOBAL <u16 index>
+    OP_INC_GLOBAL,
+    // OP_ADD_CONST_GLOBAL <u16 index> <constant>
+    OP_ADD_CONST_GLOBAL,
     OP_NOT,
     OP_EQUAL,
     OP_GRTR,
@@ -19,9 +38,71 @@ typedef enum OpCode
     OP_DIV,
     OP_POW,
     OP_NEGATE,
-    OP_RETURN
+    // OP_CALL_NATIVE <native idx> <argc>
+    OP_CALL_NATIVE,
+    OP_PRINT,
+    // OP_IMPORT <constant: path>
+    OP_IMPORT,
+    // jumps take a u16 offset, counted from the end of the jump instruction.
+    // all of them go forwards, except OP_LOOP
+    OP_JUMP,
+    // the *_IF_* jumps leave the condition on the stack, for `and`/`or`
+    OP_JUMP_IF_FALSE,
+    OP_JUMP_IF_TRUE,
+    // these pop it, for if/while
+    OP_POP_JUMP_IF_FALSE,
+    OP_POP_JUMP_IF_TRUE,
+    OP_LOOP,
+    // pops cond, a, b and pushes `cond ? a : b`, without branching
+    OP_SELECT,
+    // OP_PICK <n>: pushes a copy of the value n below the top (0 is the top),
+    // for a common subexpression that's still on the stack
+    OP_PICK,
+    // OP_ARRAY <n>: pops n values and pushes an array of them
+    OP_ARRAY,
+    // OP_MAP <n>: pops n key, value pairs and pushes a map of them
+    OP_MAP,
+    // OP_FORMAT <n>: pops n values and pushes them printed into one string,
+    // for a format string (its literal parts are constants)
+    OP_FORMAT,
+    // pops array, index (or map, key) and pushes the element
+    OP_INDEX,
+    // `a >= b` and `a <= b`: `!(a < b)` and `!(a > b)`, so a NaN makes them
+    // true, but element by element on arrays, which `!` isn't
+    OP_NOT_LESS,
+    OP_NOT_GRTR,
+    OP_RETURN,
+
+// superinstructions: one opcode for a common sequence of them, followed by
+// all their operands. picked from a profile by tools/superinstr.c
+#define SUPERINSTR2_OPCODE(name, a, b) name,
+#define SUPERINSTR3_OPCODE(name, a, b, c) name,
+    SUPERINSTRS(SUPERINSTR2_OPCODE, SUPERINSTR3_OPCODE)
+#undef SUPERINSTR2_OPCODE
+#undef SUPERINSTR3_OPCODE
 } OpCode;
 
+#define FIRST_SUPERINSTR (OP_RETURN + 1)
+#define SUPERINSTR_MAX_OPS 3
+
+typedef struct Superinstr
+{
+    const char* name;
+    int op_count;
+    OpCode ops[SUPERINSTR_MAX_OPS];
+} Superinstr;
+
+// one of the plain instructions an instruction is made of (a superinstruction
+// has several)
+typedef struct Part
+{
+    OpCode op;
+    // where its operands start
+    int operands;
+    // where vm.ip is once they've been read, errors are reported from there
+    int ip;
+} Part;
+
 typedef struct Chunk
 {
     int count;
@@ -35,6 +116,10 @@ typedef struct Chunk
     int* lines;
 
     ValueArray constants;
+
+    // the most values it ever has on the stack, above where it started. set
+    // by verify_chunk(), which every chunk goes through before it runs
+    int max_depth;
 } Chunk;
 
 void init_chunk(Chunk* chunk);
@@ -42,4 +127,26 @@ void write_chunk(Chunk* chunk, uint8_t byte, int line);
 void free_chunk(Chunk* chunk);
 
 // add a constant to the constant pool, returning its index
-int add_constant(Chunk* chunk, Value value);
\ No newline at end of file
+int add_constant(Chunk* chunk, Value value);
+
+// what a superinstruction is made of, NULL for any other opcode
+const Superinstr* get_superinstr(OpCode op);
+
+// size of the instruction in bytes, operands included
+int instr_length(OpCode op);
+// superinstructions ending in a jump count too
+bool is_jump(OpCode op);
+// offset the jump at `offset` lands on
+int jump_target(Chunk* chunk, int offset);
+// whether the jump at `offset` can be pointed at `target`: offsets are u16
+bool jump_fits(Chunk* chunk, int offset, int target);
+// rewrites the jump at `offset` so it lands on `target`, which has to fit
+void set_jump_target(Chunk* chunk, int offset, int target);
+
+// the plain instructions of the one at `offset`, into `parts`
+// (SUPERINSTR_MAX_OPS of them at most). returns how many
+int split_instr(Chunk* chunk, int offset, Part* parts);
+// how many values the part leaves on the stack, minus how many it takes off
+int stack_effect(Chunk* chunk, Part* part);
+// OP_INC_* and OP_ADD_CONST_*, which may push two values for a moment
+bool is_update(OpCode op);
\ No newline at end of file
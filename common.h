@@ -4,9 +4,34 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// x86-64 always has SSE2, 32 bit x86 only if it was asked for
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2
+#endif
+
 #define print(format, ...) printf(format "\n", ##__VA_ARGS__);
 
 // disassemble instructions as they are made (compiler)
 #define DEBUG_PRINT_CODE
-// disassemble instructions as they execute (vm)
-#define DEBUG_TRACE_EXECUTION
\ No newline at end of file
+
+// count which instructions run after which, for tools/superinstr.c (this
+// also turns off superinstructions, the profile is of the plain ones)
+// #define PROFILE_OPCODES
+
+// collect garbage on every allocation
+// #define DEBUG_STRESS_GC
+// print a line for every collection
+// #define DEBUG_LOG_GC
+
+// tells the compiler a spot can't be reached, so run()'s switch needs no range
+// check: the bytecode it gets has been verified, or came from the compiler
+#if defined(__GNUC__) || defined(__clang__)
+#define UNREACHABLE() __builtin_unreachable()
+#elif defined(_MSC_VER)
+#define UNREACHABLE() __assume(0)
+#else
+#define UNREACHABLE()
+#endif
\ No newline at end of file
@@ -1,14 +1,24 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "compiler.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "optimize.h"
 #include "scanner.h"
+#include "timer.h"
+#include "verify.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
+typedef struct PendingExpr PendingExpr;
 typedef struct Parser
 {
     Token current;
@@ -16,12 +26,21 @@ typedef struct Parser
 
     bool had_error;
     bool panic_mode;
+
+    // sub-expressions being parsed, innermost last (see parse_precedence)
+    PendingExpr* pending;
+    int pending_count;
+    int pending_capacity;
+
+    // time spent in scan_token(), see compile_tokens()
+    uint64_t scan_ticks;
 } Parser;
 
 typedef enum Precedence
 {
     PREC_NONE,
     PREC_ASSIGNMENT, // =
+    PREC_TERNARY,    // ?:
     PREC_OR,         // or
     PREC_AND,        // and
     PREC_EQUALITY,   // == !=
@@ -30,11 +49,13 @@ typedef enum Precedence
     PREC_FACTOR,     // * /
     PREC_POWER,      // ^
     PREC_UNARY,      // ! -
-    PREC_CALL,       // . ()
+    PREC_CALL,       // . () []
     PREC_PRIMARY
 } Precedence;
 
-typedef void (*ParseFn)();
+// can_assign is false when the expression is an operand of a tighter operator
+// so `a * b = c` is an error rather than `a * (b = c)`
+typedef void (*ParseFn)(bool can_assign);
 
 // Kind of a union here, for example '-' has both a prefix and an infix
 typedef struct ParseRule
@@ -46,10 +67,48 @@ typedef struct ParseRule
     Precedence precedence;
 } ParseRule;
 
+// called once the sub-expression it waited for is on the stack
+typedef void (*FinishFn)(PendingExpr* pending);
+
+// a rule that needs a sub-expression pushes one of these instead of recursing,
+// so nesting is only limited by memory
+struct PendingExpr
+{
+    // the sub-expression is parsed at this precedence or higher
+    Precedence precedence;
+    // NULL for the expression parse_precedence() itself was asked for
+    FinishFn finish;
+
+    // whatever finish needs: an operator token or opcode, jumps to patch...
+    int op;
+    int arg;
+    int count;
+    int jumps[2];
+};
+
+typedef struct Local
+{
+    // a string Value, so comparing names is cheap
+    Value name;
+    // -1 while the initializer is being compiled
+    int depth;
+} Local;
+
+// locals live on the vm stack, in the order they are declared, so a local's
+// index here *is* its stack slot
+typedef struct Compiler
+{
+    Local locals[UINT8_COUNT];
+    int local_count;
+    // 0 is global scope
+    int scope_depth;
+} Compiler;
+
 Parser parser;
+Compiler* current = NULL;
 
 /*** chunks ***/
-Chunk* compiling_chunk;
+Chunk* compiling_chunk = NULL;
 
 static Chunk* curr_chunk()
 {
@@ -100,7 +159,10 @@ static void advance()
     parser.prev = parser.current;
     while (true)
     {
+        uint64_t start = now_ticks();
         parser.current = scan_token();
+        parser.scan_ticks += now_ticks() - start;
+        vm.stats.tokens++;
 
         if (parser.current.type != TOKEN_ERROR)
         {
@@ -123,9 +185,27 @@ static void consume(TType type, const char* message)
     error_at_current(message);
 }
 
+static bool check(TType type)
+{
+    return parser.current.type == type;
+}
+
+// consume the token only if it is of the given type
+static bool match(TType type)
+{
+    if (!check(type))
+    {
+        return false;
+    }
+
+    advance();
+    return true;
+}
+
 /*** bytes ***/
 static void emit_byte(uint8_t byte)
 {
+    vm.stats.bytes_emitted++;
     write_chunk(curr_chunk(), byte, parser.prev.line);
 }
 
@@ -135,9 +215,40 @@ static void emit_bytes(uint8_t byte1, uint8_t byte2)
     emit_byte(byte2);
 }
 
+// exactly the same literal: 1 isn't 1.0, and 0.0 isn't -0.0
+static bool same_constant(Value a, Value b)
+{
+    if (a.type != b.type)
+    {
+        return false;
+    }
+
+    switch (a.type)
+    {
+    case VAL_NUMBER:
+        return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    case VAL_SHORT_STR:
+        return memcmp(a.as.short_str, b.as.short_str, SHORT_STR_MAX + 1) == 0;
+    default:
+        // strings are interned, so equal ones are the same object
+        return values_equal(a, b);
+    }
+}
+
 static int make_constant(Value val)
 {
+    // a long script shouldn't run out of constants by repeating `1`
+    ValueArray* constants = &curr_chunk()->constants;
+    for (int i = 0; i < constants->count && i <= UINT8_MAX; i++)
+    {
+        if (same_constant(constants->values[i], val))
+        {
+            return i;
+        }
+    }
+
     int constant = add_constant(curr_chunk(), val);
+    vm.stats.constants_added++;
     if (constant > UINT8_MAX)
     {
         error("Too many constants in one chunk.");
@@ -152,13 +263,83 @@ static void emit_constant(Value val)
     emit_bytes(OP_CONSTANT, make_constant(val));
 }
 
+static void emit_short(uint16_t value)
+{
+    emit_bytes((uint8_t)(value >> 8), (uint8_t)(value & 0xff));
+}
+
+// emits a jump with a placeholder offset, returns where the offset is so it
+// can be patched once we know where to go
+static int emit_jump(uint8_t instr)
+{
+    emit_byte(instr);
+    emit_bytes(0xff, 0xff);
+    return curr_chunk()->count - 2;
+}
+
+// points the jump at `offset` to the next instruction emitted
+static void patch_jump(int offset)
+{
+    // -2 for the offset itself
+    int jump = curr_chunk()->count - offset - 2;
+    if (jump > UINT16_MAX)
+    {
+        error("Too much code to jump over.");
+    }
+
+    curr_chunk()->code[offset] = (jump >> 8) & 0xff;
+    curr_chunk()->code[offset + 1] = jump & 0xff;
+}
+
+static void emit_loop(int loop_start)
+{
+    emit_byte(OP_LOOP);
+
+    // +2 for OP_LOOP's own offset
+    int offset = curr_chunk()->count - loop_start + 2;
+    if (offset > UINT16_MAX)
+    {
+        error("Loop body too large.");
+    }
+    emit_short((uint16_t)offset);
+}
+
+static void init_compiler(Compiler* compiler)
+{
+    compiler->local_count = 0;
+    compiler->scope_depth = 0;
+    current = compiler;
+}
+
 static void end_compiler()
 {
     emit_byte(OP_RETURN);
+    current = NULL;
+}
+
+static void begin_scope()
+{
+    current->scope_depth++;
+}
+
+static void end_scope()
+{
+    current->scope_depth--;
+
+    // the locals of the scope are the top of the stack
+    while (current->local_count > 0 &&
+           current->locals[current->local_count - 1].depth >
+               current->scope_depth)
+    {
+        emit_byte(OP_POP);
+        current->local_count--;
+    }
 }
 
 static ParseRule* get_rule(TType type);
 static void parse_precedence(Precedence precedence);
+static void statement();
+static void declaration();
 
 /*** tree ***/
 static void expr()
@@ -167,27 +348,30 @@ static void expr()
     parse_precedence(PREC_ASSIGNMENT);
 }
 
-static void binary()
+// asks for a sub-expression, which parse_precedence() parses next. the result
+// is only valid until the next call
+static PendingExpr* expect_expr(Precedence precedence, FinishFn finish)
 {
-    TType op_type = parser.prev.type;
-    ParseRule* rule = get_rule(op_type);
-
-    if (op_type == TOKEN_POW)
+    if (parser.pending_capacity < parser.pending_count + 1)
     {
-        parse_precedence((Precedence)(rule->precedence));
-    }
-    else
-    {
-        // the expr to the right will always have a higher precedence
-        // (left-associative)
-        parse_precedence((Precedence)(rule->precedence + 1));
+        int old_capacity = parser.pending_capacity;
+        parser.pending_capacity = GROW_CAPACITY(old_capacity);
+        parser.pending = GROW_ARRAY(PendingExpr, parser.pending, old_capacity,
+                                    parser.pending_capacity);
     }
 
-    switch (op_type)
+    PendingExpr* pending = &parser.pending[parser.pending_count++];
+    pending->precedence = precedence;
+    pending->finish = finish;
+    return pending;
+}
+
+static void finish_binary(PendingExpr* pending)
+{
+    switch (pending->op)
     {
     // `!=` <=> `!(==)`
-    // `>=` <=> `!(<)`
-    // `<=` <=> `!(>)`
+    // `>=` and `<=` get their own, see OP_NOT_LESS
     case TOKEN_EQUAL_EQUAL:
         emit_byte(OP_EQUAL);
         break;
@@ -198,13 +382,13 @@ static void binary()
         emit_byte(OP_GRTR);
         break;
     case TOKEN_GREATER_EQUAL:
-        emit_bytes(OP_LESS, OP_NOT);
+        emit_byte(OP_NOT_LESS);
         break;
     case TOKEN_LESS:
         emit_byte(OP_LESS);
         break;
     case TOKEN_LESS_EQUAL:
-        emit_bytes(OP_GRTR, OP_NOT);
+        emit_byte(OP_NOT_GRTR);
         break;
 
     case TOKEN_PLUS:
@@ -228,15 +412,134 @@ static void binary()
     }
 }
 
-static void unary()
+static void binary(bool can_assign)
 {
     TType op_type = parser.prev.type;
+    ParseRule* rule = get_rule(op_type);
+
+    // the expr to the right will always have a higher precedence
+    // (left-associative), except for `^`
+    Precedence right = op_type == TOKEN_POW
+                           ? rule->precedence
+                           : (Precedence)(rule->precedence + 1);
+    expect_expr(right, finish_binary)->op = op_type;
+}
+
+static void finish_jump(PendingExpr* pending)
+{
+    patch_jump(pending->jumps[0]);
+}
+
+// the left side is already on the stack. if it decides the result, it *is*
+// the result, otherwise it's popped and the right side is the result
+static void and_(bool can_assign)
+{
+    int end_jump = emit_jump(OP_JUMP_IF_FALSE);
+
+    emit_byte(OP_POP);
+    expect_expr(PREC_AND, finish_jump)->jumps[0] = end_jump;
+}
+
+static void or_(bool can_assign)
+{
+    int end_jump = emit_jump(OP_JUMP_IF_TRUE);
+
+    emit_byte(OP_POP);
+    expect_expr(PREC_OR, finish_jump)->jumps[0] = end_jump;
+}
+
+// arms of a ternary up to this many bytes can be turned into OP_SELECT
+#define SELECT_MAX_ARM 6
+
+// true if the code can run even when its value isn't needed: nothing in it
+// can fail, jump or change state
+static bool is_cheap_and_pure(int start, int end)
+{
+    if (end - start > SELECT_MAX_ARM)
+    {
+        return false;
+    }
+
+    uint8_t* code = curr_chunk()->code;
+    for (int offset = start; offset < end; offset += instr_length(code[offset]))
+    {
+        switch (code[offset])
+        {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_NOT:
+        case OP_EQUAL:
+        case OP_SELECT:
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+static void ternary_else(PendingExpr* pending)
+{
+    int then_jump = pending->jumps[0];
+    int else_jump = pending->jumps[1];
+    int then_start = then_jump + 2;
+    int then_end = else_jump - 1;
+    int else_start = else_jump + 2;
+    patch_jump(else_jump);
+
+    Chunk* chunk = curr_chunk();
+    if (!is_cheap_and_pure(then_start, then_end) ||
+        !is_cheap_and_pure(else_start, chunk->count))
+    {
+        return;
+    }
+
+    // slide both arms down over the jumps
+    int dest = then_jump - 1;
+    int then_len = then_end - then_start;
+    int else_len = chunk->count - else_start;
+    memmove(&chunk->code[dest], &chunk->code[then_start], then_len);
+    memmove(&chunk->lines[dest], &chunk->lines[then_start],
+            then_len * sizeof(int));
+    memmove(&chunk->code[dest + then_len], &chunk->code[else_start], else_len);
+    memmove(&chunk->lines[dest + then_len], &chunk->lines[else_start],
+            else_len * sizeof(int));
+    chunk->count = dest + then_len + else_len;
+
+    emit_byte(OP_SELECT);
+}
 
-    // push expr to stack
-    parse_precedence(PREC_UNARY);
+static void ternary_then(PendingExpr* pending)
+{
+    int then_jump = pending->jumps[0];
+    int else_jump = emit_jump(OP_JUMP);
+    patch_jump(then_jump);
+
+    consume(TOKEN_COLON, "Expected ':' after then branch of '?'.");
+    // right associative: a ? b : c ? d : e
+    PendingExpr* else_arm = expect_expr(PREC_TERNARY, ternary_else);
+    else_arm->jumps[0] = then_jump;
+    else_arm->jumps[1] = else_jump;
+}
 
+// `cond ? a : b` is compiled with jumps first:
+//     cond, OP_POP_JUMP_IF_FALSE, a, OP_JUMP, b
+// if both arms are cheap, the jumps are cut out and it becomes
+//     cond, a, b, OP_SELECT
+// which never mispredicts
+static void ternary(bool can_assign)
+{
+    int then_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
+    expect_expr(PREC_TERNARY, ternary_then)->jumps[0] = then_jump;
+}
+
+static void finish_unary(PendingExpr* pending)
+{
     // push operator to stack (pops previous value, and then pushes it back on)
-    switch (op_type)
+    switch (pending->op)
     {
     case TOKEN_MINUS:
         emit_byte(OP_NEGATE);
@@ -250,20 +553,425 @@ static void unary()
     }
 }
 
-static void grouping()
+static void unary(bool can_assign)
+{
+    // push expr to stack first
+    expect_expr(PREC_UNARY, finish_unary)->op = parser.prev.type;
+}
+
+static void finish_grouping(PendingExpr* pending)
 {
-    expr();
     consume(TOKEN_RIGHT_PAREN, "Expected ')' after expression.");
 }
 
-static void number()
+static void grouping(bool can_assign)
+{
+    expect_expr(PREC_ASSIGNMENT, finish_grouping);
+}
+
+static void emit_native_call(int native, int argc)
+{
+    const Native* fn = &natives[native];
+    if (argc < fn->min_arity || (fn->max_arity != -1 && argc > fn->max_arity))
+    {
+        error("Wrong number of arguments to builtin.");
+        return;
+    }
+
+    emit_bytes(OP_CALL_NATIVE, (uint8_t)native);
+    emit_byte((uint8_t)argc);
+}
+
+// each argument ends up on the stack, in order
+static void finish_argument(PendingExpr* pending)
+{
+    if (pending->count == UINT8_MAX)
+    {
+        error("Can't have more than 255 arguments.");
+    }
+    int argc = pending->count + 1;
+
+    if (match(TOKEN_COMMA))
+    {
+        PendingExpr* next = expect_expr(PREC_ASSIGNMENT, finish_argument);
+        next->arg = pending->arg;
+        next->count = argc;
+        return;
+    }
+
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
+    emit_native_call(pending->arg, argc);
+}
+
+// builtins are looked up at compile time, so the vm only ever sees an index
+static void native_call(int native)
+{
+    consume(TOKEN_LEFT_PAREN, "Expected '(' after builtin name.");
+
+    if (match(TOKEN_RIGHT_PAREN))
+    {
+        emit_native_call(native, 0);
+        return;
+    }
+
+    PendingExpr* arg = expect_expr(PREC_ASSIGNMENT, finish_argument);
+    arg->arg = native;
+    arg->count = 0;
+}
+
+// like arguments, each element ends up on the stack in order
+static void finish_element(PendingExpr* pending)
+{
+    if (pending->count == UINT8_MAX)
+    {
+        error("Can't have more than 255 elements in an array literal.");
+    }
+    int count = pending->count + 1;
+
+    if (match(TOKEN_COMMA))
+    {
+        expect_expr(PREC_ASSIGNMENT, finish_element)->count = count;
+        return;
+    }
+
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after array elements.");
+    emit_bytes(OP_ARRAY, (uint8_t)count);
+}
+
+static void array(bool can_assign)
+{
+    if (match(TOKEN_RIGHT_BRACKET))
+    {
+        emit_bytes(OP_ARRAY, 0);
+        return;
+    }
+
+    expect_expr(PREC_ASSIGNMENT, finish_element)->count = 0;
+}
+
+static void finish_entry(PendingExpr* pending);
+
+static void finish_key(PendingExpr* pending)
+{
+    consume(TOKEN_COLON, "Expected ':' after map key.");
+    expect_expr(PREC_ASSIGNMENT, finish_entry)->count = pending->count;
+}
+
+// the keys and values go on the stack in turn
+static void finish_entry(PendingExpr* pending)
+{
+    if (pending->count == UINT8_MAX)
+    {
+        error("Can't have more than 255 entries in a map literal.");
+    }
+    int count = pending->count + 1;
+
+    if (match(TOKEN_COMMA))
+    {
+        // the key stops before a `:`, so it can't be a ternary
+        expect_expr(PREC_OR, finish_key)->count = count;
+        return;
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expected '}' after map entries.");
+    emit_bytes(OP_MAP, (uint8_t)count);
+}
+
+// `{` only starts a map where an expression is expected, a statement that
+// starts with one is a block
+static void map(bool can_assign)
+{
+    if (match(TOKEN_RIGHT_BRACE))
+    {
+        emit_bytes(OP_MAP, 0);
+        return;
+    }
+
+    expect_expr(PREC_OR, finish_key)->count = 0;
+}
+
+static void finish_index(PendingExpr* pending)
+{
+    consume(TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
+    emit_byte(OP_INDEX);
+}
+
+// arrays and maps never change, so an index is never assigned to
+static void index_(bool can_assign)
+{
+    expect_expr(PREC_ASSIGNMENT, finish_index);
+}
+
+/*** variables ***/
+static Value identifier_name(Token* name)
+{
+    return copy_string(name->start, name->length);
+}
+
+// returns the stack slot of the local, or -1 if it's not a local
+static int resolve_local(Compiler* compiler, Value name)
+{
+    // backwards, so inner scopes shadow outer ones
+    for (int i = compiler->local_count - 1; i >= 0; i--)
+    {
+        Local* local = &compiler->locals[i];
+        if (values_equal(name, local->name))
+        {
+            if (local->depth == -1)
+            {
+                error("Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// index into vm.globals, added if this is the first time we see the name
+static uint16_t resolve_global(Token* name)
+{
+    int slot = global_slot(intern_string(name->start, name->length));
+    if (slot > UINT16_MAX)
+    {
+        error("Too many global variables.");
+        return 0;
+    }
+    return (uint16_t)slot;
+}
+
+static void add_local(Value name)
+{
+    if (current->local_count == UINT8_COUNT)
+    {
+        error("Too many local variables in one scope.");
+        return;
+    }
+
+    Local* local = &current->locals[current->local_count++];
+    local->name = name;
+    local->depth = -1;
+}
+
+static void declare_local()
+{
+    Value name = identifier_name(&parser.prev);
+    for (int i = current->local_count - 1; i >= 0; i--)
+    {
+        Local* local = &current->locals[i];
+        if (local->depth != -1 && local->depth < current->scope_depth)
+        {
+            break;
+        }
+
+        if (values_equal(name, local->name))
+        {
+            error("Already a variable with this name in this scope.");
+        }
+    }
+
+    add_local(name);
+}
+
+static void emit_variable(uint8_t op, int arg)
+{
+    emit_byte(op);
+    if (op == OP_GET_LOCAL || op == OP_SET_LOCAL)
+    {
+        emit_byte((uint8_t)arg);
+    }
+    else
+    {
+        emit_short((uint16_t)arg);
+    }
+}
+
+static void finish_assignment(PendingExpr* pending)
+{
+    emit_variable((uint8_t)pending->op, pending->arg);
+}
+
+// `a op= b` is `a = a op b`, the value is already on the stack
+static void finish_compound_assignment(PendingExpr* pending)
+{
+    emit_byte((uint8_t)pending->count);
+    emit_variable((uint8_t)pending->op, pending->arg);
+}
+
+// the arithmetic opcode of `+=`, `-=` etc, or -1 if the next token isn't one
+static int match_compound_assignment()
+{
+    switch (parser.current.type)
+    {
+    case TOKEN_PLUS_EQUAL:
+        advance();
+        return OP_ADD;
+    case TOKEN_MINUS_EQUAL:
+        advance();
+        return OP_SUB;
+    case TOKEN_STAR_EQUAL:
+        advance();
+        return OP_MULT;
+    case TOKEN_SLASH_EQUAL:
+        advance();
+        return OP_DIV;
+    default:
+        return -1;
+    }
+}
+
+static void named_variable(Token name, bool can_assign)
+{
+    uint8_t get_op, set_op;
+    int arg = resolve_local(current, identifier_name(&name));
+    if (arg != -1)
+    {
+        get_op = OP_GET_LOCAL;
+        set_op = OP_SET_LOCAL;
+    }
+    else
+    {
+        arg = resolve_global(&name);
+        get_op = OP_GET_GLOBAL;
+        set_op = OP_SET_GLOBAL;
+    }
+
+    if (can_assign && match(TOKEN_EQUAL))
+    {
+        // the value first, then the set
+        PendingExpr* value = expect_expr(PREC_ASSIGNMENT, finish_assignment);
+        value->op = set_op;
+        value->arg = arg;
+        return;
+    }
+
+    // its value is the old one: a copy stays under the sum, which is stored
+    // and popped. as a statement the optimizer turns it into one instruction
+    // (see fuse_updates)
+    if (can_assign && match(TOKEN_PLUS_PLUS))
+    {
+        emit_variable(get_op, arg);
+        emit_bytes(OP_PICK, 0);
+        emit_constant(INT_VAL(1));
+        emit_byte(OP_ADD);
+        emit_variable(set_op, arg);
+        emit_byte(OP_POP);
+        return;
+    }
+
+    int op = can_assign ? match_compound_assignment() : -1;
+    if (op != -1)
+    {
+        emit_variable(get_op, arg);
+        PendingExpr* value = expect_expr(PREC_ASSIGNMENT,
+                                         finish_compound_assignment);
+        value->op = set_op;
+        value->arg = arg;
+        // the arithmetic
+        value->count = op;
+        return;
+    }
+
+    emit_variable(get_op, arg);
+}
+
+static void variable(bool can_assign)
+{
+    // there are no user functions, so `name(` can only be a builtin
+    if (check(TOKEN_LEFT_PAREN))
+    {
+        int native = find_native(parser.prev.start, parser.prev.length);
+        if (native != -1)
+        {
+            native_call(native);
+            return;
+        }
+    }
+
+    named_variable(parser.prev, can_assign);
+}
+
+static void number(bool can_assign)
 {
     // TODO: why not atof?
     double value = strtod(parser.prev.start, NULL);
     emit_constant(NUM_VAL(value));
 }
 
-static void literal()
+static void integer(bool can_assign)
+{
+    errno = 0;
+    long long value = strtoll(parser.prev.start, NULL, 10);
+    if (errno == ERANGE)
+    {
+        // too big for an int, it still makes a fine double
+        number(can_assign);
+        return;
+    }
+    emit_constant(INT_VAL(value));
+}
+
+static void string(bool can_assign)
+{
+    // trim the quotes
+    emit_constant(copy_string(parser.prev.start + 1, parser.prev.length - 2));
+}
+
+// the text of a format string between its expressions, from the '"' or ')'
+// before it to the '"' or "%(" after it. 1 if it's pushed, empty ones aren't
+static int format_literal(int end_length)
+{
+    int length = parser.prev.length - 1 - end_length;
+    if (length == 0)
+    {
+        return 0;
+    }
+    emit_constant(copy_string(parser.prev.start + 1, length));
+    return 1;
+}
+
+// each literal and expression of a format string is left on the stack in
+// order, then OP_FORMAT turns them into one string
+static void finish_format(PendingExpr* pending)
+{
+    int count = pending->count + 1;
+
+    bool more = match(TOKEN_INTERPOLATION);
+    if (more)
+    {
+        count += format_literal(2);
+    }
+    else if (match(TOKEN_STRING))
+    {
+        count += format_literal(1);
+    }
+    else
+    {
+        error_at_current("Expected ')' after format string expression.");
+        return;
+    }
+
+    if (count > UINT8_MAX)
+    {
+        error("Can't have more than 255 parts in a format string.");
+        count = UINT8_MAX;
+    }
+
+    if (more)
+    {
+        expect_expr(PREC_ASSIGNMENT, finish_format)->count = count;
+        return;
+    }
+    emit_bytes(OP_FORMAT, (uint8_t)count);
+}
+
+static void format_string(bool can_assign)
+{
+    int count = format_literal(2);
+    expect_expr(PREC_ASSIGNMENT, finish_format)->count = count;
+}
+
+static void literal(bool can_assign)
 {
     switch (parser.prev.type)
     {
@@ -282,47 +990,331 @@ static void literal()
     }
 }
 
+// the innermost sub-expression is done, so whoever asked for it gets to emit
+// the rest. returns true if they asked for another one right away
+static bool finish_expr()
+{
+    int depth = --parser.pending_count;
+    PendingExpr done = parser.pending[depth];
+    if (done.finish != NULL)
+    {
+        done.finish(&done);
+    }
+    return parser.pending_count > depth;
+}
+
 // starts at current token, and parses any expression at given precedence level
-// or higher
+// or higher. instead of recursing, rules push a PendingExpr for each
+// sub-expression they need, and this loop carries on with the innermost one
 static void parse_precedence(Precedence precedence)
 {
-    advance(); // consume the token
+    int base = parser.pending_count;
+    expect_expr(precedence, NULL);
+
+    // true when the innermost sub-expression hasn't had its prefix yet
+    bool starting = true;
+    while (parser.pending_count > base)
+    {
+        int depth = parser.pending_count;
+        Precedence level = parser.pending[depth - 1].precedence;
+        bool can_assign = level <= PREC_ASSIGNMENT;
+
+        if (starting)
+        {
+            advance(); // consume the token
+
+            // first token must always be a prefix (-, or a number etc.)
+            ParseFn prefix_rule = get_rule(parser.prev.type)->prefix;
+            if (prefix_rule == NULL)
+            {
+                // Invalid prefix expression
+                error("Expected expression.");
+                starting = finish_expr();
+                continue;
+            }
+
+            prefix_rule(can_assign);
+            starting = parser.pending_count > depth;
+            if (starting)
+            {
+                continue;
+            }
+        }
+
+        // the token is always changing, so...
+        // keep consuming until the token is of lower precedence, (e.g. 5*3+2)
+        if (level <= get_rule(parser.current.type)->precedence)
+        {
+            advance();
+            ParseFn infix_rule = get_rule(parser.prev.type)->infix;
+            infix_rule(can_assign);
+            starting = parser.pending_count > depth;
+            continue;
+        }
+
+        // nothing consumed the `=`, so the left side wasn't something
+        // assignable
+        if (can_assign && (match(TOKEN_EQUAL) || match(TOKEN_PLUS_PLUS) ||
+                           match_compound_assignment() != -1))
+        {
+            error("Invalid assignment target.");
+        }
+        starting = finish_expr();
+    }
+}
+
+/*** statements ***/
+static void block()
+{
+    while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+    {
+        declaration();
+    }
+
+    consume(TOKEN_RIGHT_BRACE, "Expected '}' after block.");
+}
+
+static void var_declaration()
+{
+    consume(TOKEN_IDENTIFIER, "Expected variable name.");
+
+    // resolved now, the name's token doesn't outlive the initializer
+    uint16_t global = 0;
+    if (current->scope_depth > 0)
+    {
+        declare_local();
+    }
+    else
+    {
+        global = resolve_global(&parser.prev);
+    }
+
+    if (match(TOKEN_EQUAL))
+    {
+        expr();
+    }
+    else
+    {
+        emit_byte(OP_NIL);
+    }
+    consume(TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
+
+    if (current->scope_depth > 0)
+    {
+        // the value is already sitting in the local's slot
+        current->locals[current->local_count - 1].depth = current->scope_depth;
+        return;
+    }
+
+    emit_byte(OP_DEFINE_GLOBAL);
+    emit_short(global);
+}
+
+static void if_statement()
+{
+    consume(TOKEN_LEFT_PAREN, "Expected '(' after 'if'.");
+    expr();
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
+
+    int then_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
+    statement();
+
+    if (match(TOKEN_ELSE))
+    {
+        int else_jump = emit_jump(OP_JUMP);
+        patch_jump(then_jump);
+        statement();
+        patch_jump(else_jump);
+    }
+    else
+    {
+        patch_jump(then_jump);
+    }
+}
+
+static void while_statement()
+{
+    int loop_start = curr_chunk()->count;
+    consume(TOKEN_LEFT_PAREN, "Expected '(' after 'while'.");
+    expr();
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after condition.");
+
+    int exit_jump = emit_jump(OP_POP_JUMP_IF_FALSE);
+    statement();
+    emit_loop(loop_start);
+
+    patch_jump(exit_jump);
+}
+
+// import "path/to/file.lox";
+// import name;   -> a builtin module, or name.lox
+static void import_statement()
+{
+    Value path;
+    if (match(TOKEN_STRING))
+    {
+        path = copy_string(parser.prev.start + 1, parser.prev.length - 2);
+    }
+    else
+    {
+        consume(TOKEN_IDENTIFIER,
+                "Expected module name or path after 'import'.");
+        Token name = parser.prev;
+        if (is_native_module(name.start, name.length))
+        {
+            // builtins are always there
+            consume(TOKEN_SEMICOLON, "Expected ';' after import.");
+            return;
+        }
+
+        char file[256];
+        int length = snprintf(file, sizeof(file), "%.*s.lox", name.length,
+                              name.start);
+        if (length >= (int)sizeof(file))
+        {
+            error("Module name too long.");
+            return;
+        }
+        path = copy_string(file, length);
+    }
+    consume(TOKEN_SEMICOLON, "Expected ';' after import.");
+
+    emit_bytes(OP_IMPORT, make_constant(path));
+}
+
+static void print_statement()
+{
+    expr();
+    consume(TOKEN_SEMICOLON, "Expected ';' after value.");
+    emit_byte(OP_PRINT);
+}
 
-    // first token must always be a prefix (-, or a number etc.)
-    ParseFn prefix_rule = get_rule(parser.prev.type)->prefix;
+static void expression_statement()
+{
+    expr();
 
-    if (prefix_rule == NULL)
+    // a trailing expression without a `;` is the result of the program, which
+    // gets printed (so `1 + 2` still works in the repl)
+    if (check(TOKEN_EOF))
     {
-        // Invalid prefix expression
-        error("Expected expression.");
+        emit_byte(OP_PRINT);
         return;
     }
 
-    prefix_rule();
+    consume(TOKEN_SEMICOLON, "Expected ';' after expression.");
+    emit_byte(OP_POP);
+}
+
+// skip to the start of the next statement, so one error doesn't cascade
+static void synchronize()
+{
+    parser.panic_mode = false;
 
-    // the token is always changing, so...
-    // keep consuming until the token is of lower precedence, (e.g. 5*3+2)
-    while (precedence <= get_rule(parser.current.type)->precedence)
+    while (parser.current.type != TOKEN_EOF)
     {
+        if (parser.prev.type == TOKEN_SEMICOLON)
+        {
+            return;
+        }
+
+        switch (parser.current.type)
+        {
+        case TOKEN_CLASS:
+        case TOKEN_FUN:
+        case TOKEN_VAR:
+        case TOKEN_FOR:
+        case TOKEN_IF:
+        case TOKEN_WHILE:
+        case TOKEN_PRINT:
+        case TOKEN_RETURN:
+        case TOKEN_IMPORT:
+            return;
+        default:
+            break;
+        }
+
         advance();
-        ParseFn infix_rule = get_rule(parser.prev.type)->infix;
-        infix_rule();
     }
 }
 
-bool compile(const char* source, Chunk* chunk)
+static void statement()
 {
-    init_scanner(source);
+    if (match(TOKEN_PRINT))
+    {
+        print_statement();
+    }
+    else if (match(TOKEN_IF))
+    {
+        if_statement();
+    }
+    else if (match(TOKEN_IMPORT))
+    {
+        import_statement();
+    }
+    else if (match(TOKEN_WHILE))
+    {
+        while_statement();
+    }
+    else if (match(TOKEN_LEFT_BRACE))
+    {
+        begin_scope();
+        block();
+        end_scope();
+    }
+    else
+    {
+        expression_statement();
+    }
+}
+
+static void declaration()
+{
+    if (match(TOKEN_VAR))
+    {
+        var_declaration();
+    }
+    else
+    {
+        statement();
+    }
+
+    if (parser.panic_mode)
+    {
+        synchronize();
+    }
+}
+
+// the scanner is ready to go
+static bool compile_tokens(Chunk* chunk)
+{
+    // the ticks are cheap enough to take for every token, and timing the whole
+    // compile in both says how long one is
+    uint64_t start_ns = now_ns();
+    uint64_t start_ticks = now_ticks();
+    parser.scan_ticks = 0;
+
+    Compiler compiler;
+    init_compiler(&compiler);
     compiling_chunk = chunk;
 
     parser.had_error = false;
     parser.panic_mode = false;
 
     advance();
-    expr();
-    consume(TOKEN_EOF, "Expected EOF.");
+    while (!match(TOKEN_EOF))
+    {
+        declaration();
+    }
 
     end_compiler();
+    FREE_ARRAY(PendingExpr, parser.pending, parser.pending_capacity);
+    parser.pending = NULL;
+    parser.pending_count = parser.pending_capacity = 0;
+
+    if (!parser.had_error)
+    {
+        optimize_chunk(chunk);
+    }
 
 #ifdef DEBUG_PRINT_CODE
     if (!parser.had_error)
@@ -330,17 +1322,75 @@ bool compile(const char* source, Chunk* chunk)
         disassemble_chunk(curr_chunk(), "code");
     }
 #endif
+    // this also works out how much stack it needs (see enter_chunk)
+    if (!parser.had_error)
+    {
+        int at;
+        const char* error = verify_chunk(chunk, &at);
+        if (error != NULL)
+        {
+            fprintf(stderr, "Compiled code at %04d is invalid: %s\n", at,
+                    error);
+            abort();
+        }
+    }
+
+    uint64_t elapsed_ns = now_ns() - start_ns;
+    uint64_t elapsed_ticks = now_ticks() - start_ticks;
+    double ns_per_tick =
+        elapsed_ticks == 0 ? 0 : (double)elapsed_ns / (double)elapsed_ticks;
+    uint64_t scan_ns = (uint64_t)((double)parser.scan_ticks * ns_per_tick);
+    vm.stats.scan_ns += scan_ns;
+    vm.stats.compile_ns += elapsed_ns - scan_ns;
 
+    compiling_chunk = NULL;
     return !parser.had_error;
 }
 
+bool compile(const char* source, Chunk* chunk)
+{
+    init_scanner(source);
+    return compile_tokens(chunk);
+}
+
+bool compile_file(FILE* file, Chunk* chunk)
+{
+    init_scanner_file(file);
+    bool ok = compile_tokens(chunk);
+    free_scanner();
+    return ok;
+}
+
+void mark_compiler_roots()
+{
+    if (current != NULL)
+    {
+        for (int i = 0; i < current->local_count; i++)
+        {
+            gc_visit_value(&current->locals[i].name);
+        }
+    }
+
+    if (compiling_chunk == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < compiling_chunk->constants.count; i++)
+    {
+        gc_visit_value(&compiling_chunk->constants.values[i]);
+    }
+}
+
 /*** parsing and compiling ***/
 // prefix (-5), infix (5 - 5), precedence
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {grouping, NULL, PREC_NONE},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {map, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET] = {array, index_, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
@@ -349,6 +1399,8 @@ ParseRule rules[] = {
     [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
     [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
     [TOKEN_POW] = {NULL, binary, PREC_POWER},
+    [TOKEN_QUESTION] = {NULL, ternary, PREC_TERNARY},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_BANG] = {unary, NULL, PREC_NONE},
     [TOKEN_BANG_EQUAL] = {NULL, binary, PREC_EQUALITY},
     [TOKEN_EQUAL] = {NULL, NULL, PREC_NONE},
@@ -357,18 +1409,21 @@ ParseRule rules[] = {
     [TOKEN_GREATER_EQUAL] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
-    [TOKEN_IDENTIFIER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_STRING] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},
+    [TOKEN_INTERPOLATION] = {format_string, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
-    [TOKEN_AND] = {NULL, NULL, PREC_NONE},
+    [TOKEN_INT] = {integer, NULL, PREC_NONE},
+    [TOKEN_AND] = {NULL, and_, PREC_AND},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
     [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
     [TOKEN_IF] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IMPORT] = {NULL, NULL, PREC_NONE},
     [TOKEN_NIL] = {literal, NULL, PREC_NONE},
-    [TOKEN_OR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
     [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
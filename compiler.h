@@ -1,6 +1,13 @@
 #pragma once
 
+#include <stdio.h>
+
 #include "vm.h"
 
 // returns TRUE if compiler had an error
-bool compile(const char* source, Chunk* chunk);
\ No newline at end of file
+bool compile(const char* source, Chunk* chunk);
+// same, but the source is read a block at a time as it's scanned
+bool compile_file(FILE* file, Chunk* chunk);
+
+// the constants of the chunk being compiled are gc roots
+void mark_compiler_roots();
\ No newline at end of file
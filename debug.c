@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "debug.h"
+#include "native.h"
 #include "value.h"
 
 static int constant_instr(const char* name, Chunk* chunk, int offset)
@@ -14,6 +15,55 @@ static int constant_instr(const char* name, Chunk* chunk, int offset)
     return offset + 2;
 }
 
+static int native_instr(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t native = chunk->code[offset + 1];
+    uint8_t argc = chunk->code[offset + 2];
+    printf("%-16s %4d '%s' (%d args)\n", name, native, natives[native].name,
+           argc);
+
+    // OP_CALL_NATIVE (native) (argc)
+    return offset + 3;
+}
+
+static int byte_instr(const char* name, Chunk* chunk, int offset)
+{
+    uint8_t slot = chunk->code[offset + 1];
+    printf("%-16s %4d\n", name, slot);
+    return offset + 2;
+}
+
+static int global_instr(const char* name, Chunk* chunk, int offset)
+{
+    uint16_t slot =
+        (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+    printf("%-16s %4d\n", name, slot);
+    return offset + 3;
+}
+
+// the variable (a stack slot, or a global's u16 index), then the constant
+static int add_const_instr(const char* name, Chunk* chunk, int offset,
+                           bool global)
+{
+    int slot = chunk->code[offset + 1];
+    int at = offset + 2;
+    if (global)
+    {
+        slot = (slot << 8) | chunk->code[at++];
+    }
+    uint8_t const_idx = chunk->code[at];
+    printf("%-16s %4d '+", name, slot);
+    print_value(chunk->constants.values[const_idx]);
+    printf("'\n");
+    return at + 1;
+}
+
+static int jump_instr(const char* name, Chunk* chunk, int offset)
+{
+    printf("%-16s %4d -> %d\n", name, offset, jump_target(chunk, offset));
+    return offset + 3;
+}
+
 static int simple_instr(const char* name, int offset)
 {
     printf("%s\n", name);
@@ -21,6 +71,9 @@ static int simple_instr(const char* name, int offset)
     return offset + 1;
 }
 
+static int op_instr(OpCode op, Chunk* chunk, int offset);
+static int super_instr(const Superinstr* super, Chunk* chunk, int offset);
+
 void disassemble_chunk(Chunk* chunk, const char* name)
 {
     printf("== %s ==\n", name);
@@ -44,8 +97,18 @@ int disassemble_instr(Chunk* chunk, int offset)
     }
 
     uint8_t instr = chunk->code[offset];
+    const Superinstr* super = get_superinstr(instr);
+    if (super != NULL)
+    {
+        return super_instr(super, chunk, offset);
+    }
+    return op_instr(instr, chunk, offset);
+}
 
-    switch (instr)
+// prints `op` with the operands that follow `offset`
+static int op_instr(OpCode op, Chunk* chunk, int offset)
+{
+    switch (op)
     {
     case OP_CONSTANT:
         return constant_instr("OP_CONSTANT", chunk, offset);
@@ -57,6 +120,27 @@ int disassemble_instr(Chunk* chunk, int offset)
     case OP_FALSE:
         return simple_instr("OP_FALSE", offset);
 
+    case OP_POP:
+        return simple_instr("OP_POP", offset);
+    case OP_GET_LOCAL:
+        return byte_instr("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL:
+        return byte_instr("OP_SET_LOCAL", chunk, offset);
+    case OP_GET_GLOBAL:
+        return global_instr("OP_GET_GLOBAL", chunk, offset);
+    case OP_INC_LOCAL:
+        return byte_instr("OP_INC_LOCAL", chunk, offset);
+    case OP_ADD_CONST_LOCAL:
+        return add_const_instr("OP_ADD_CONST_LOCAL", chunk, offset, false);
+    case OP_INC_GLOBAL:
+        return global_instr("OP_INC_GLOBAL", chunk, offset);
+    case OP_ADD_CONST_GLOBAL:
+        return add_const_instr("OP_ADD_CONST_GLOBAL", chunk, offset, true);
+    case OP_DEFINE_GLOBAL:
+        return global_instr("OP_DEFINE_GLOBAL", chunk, offset);
+    case OP_SET_GLOBAL:
+        return global_instr("OP_SET_GLOBAL", chunk, offset);
+
     case OP_NOT:
         return simple_instr("OP_NOT", offset);
 
@@ -66,6 +150,10 @@ int disassemble_instr(Chunk* chunk, int offset)
         return simple_instr("OP_GRTR", offset);
     case OP_LESS:
         return simple_instr("OP_LESS", offset);
+    case OP_NOT_LESS:
+        return simple_instr("OP_NOT_LESS", offset);
+    case OP_NOT_GRTR:
+        return simple_instr("OP_NOT_GRTR", offset);
 
     case OP_ADD:
         return simple_instr("OP_ADD", offset);
@@ -82,11 +170,64 @@ int disassemble_instr(Chunk* chunk, int offset)
     case OP_NEGATE:
         return simple_instr("OP_NEGATE", offset);
 
+    case OP_CALL_NATIVE:
+        return native_instr("OP_CALL_NATIVE", chunk, offset);
+
+    case OP_PRINT:
+        return simple_instr("OP_PRINT", offset);
+    case OP_IMPORT:
+        return constant_instr("OP_IMPORT", chunk, offset);
+    case OP_JUMP:
+        return jump_instr("OP_JUMP", chunk, offset);
+    case OP_JUMP_IF_FALSE:
+        return jump_instr("OP_JUMP_IF_FALSE", chunk, offset);
+    case OP_JUMP_IF_TRUE:
+        return jump_instr("OP_JUMP_IF_TRUE", chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+        return jump_instr("OP_POP_JUMP_IF_FALSE", chunk, offset);
+    case OP_POP_JUMP_IF_TRUE:
+        return jump_instr("OP_POP_JUMP_IF_TRUE", chunk, offset);
+    case OP_LOOP:
+        return jump_instr("OP_LOOP", chunk, offset);
+
+    case OP_SELECT:
+        return simple_instr("OP_SELECT", offset);
+    case OP_PICK:
+        return byte_instr("OP_PICK", chunk, offset);
+    case OP_ARRAY:
+        return byte_instr("OP_ARRAY", chunk, offset);
+    case OP_MAP:
+        return byte_instr("OP_MAP", chunk, offset);
+    case OP_FORMAT:
+        return byte_instr("OP_FORMAT", chunk, offset);
+    case OP_INDEX:
+        return simple_instr("OP_INDEX", offset);
+
     case OP_RETURN:
         return simple_instr("OP_RETURN", offset);
 
     default:
-        printf("Unknown opcode %d\n", instr);
+        printf("Unknown opcode %d\n", op);
         return offset + 1;
     }
 }
+
+// the superinstruction's name, then one line per part with its operands
+static int super_instr(const Superinstr* super, Chunk* chunk, int offset)
+{
+    printf("%s\n", super->name);
+
+    // each part's operands come right after the previous part's, so the byte
+    // before them can stand in for the part's opcode
+    int at = offset;
+    for (int i = 0; i < super->op_count; i++)
+    {
+        OpCode op = super->ops[i];
+        printf("%10s\\ ", "");
+        // a jump is always the last part, and it's the whole superinstruction
+        // that jumps
+        op_instr(op, chunk, is_jump(op) ? offset : at);
+        at += instr_length(op) - 1;
+    }
+    return offset + instr_length(chunk->code[offset]);
+}
@@ -0,0 +1,795 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "emit.h"
+#include "memory.h"
+#include "native.h"
+#include "object.h"
+#include "vm.h"
+
+typedef struct Emitter
+{
+    Chunk* chunk;
+    FILE* out;
+
+    // the stack depth before each instruction, -1 if it's never reached.
+    // slot n of the stack is the local `sn` in the C
+    int* depths;
+    int max_depth;
+    // jumped to from somewhere reachable, so it gets a label
+    bool* targets;
+
+    // constant index -> index into the `strings` of the generated file
+    int* strings;
+    int string_count;
+    // global slot -> index into `global_names`
+    int* globals;
+    int global_count;
+    // native index -> index into `native_names`
+    int natives[UINT8_COUNT];
+    int native_count;
+
+    // an error label is only written if something jumps to it
+    bool can_fail;
+} Emitter;
+
+static uint16_t read_short(Chunk* chunk, int offset)
+{
+    return (uint16_t)((chunk->code[offset] << 8) | chunk->code[offset + 1]);
+}
+
+static bool set_depth(Emitter* emitter, int* work, int* work_count,
+                      int offset, int depth)
+{
+    if (emitter->depths[offset] == -1)
+    {
+        emitter->depths[offset] = depth;
+        work[(*work_count)++] = offset;
+        return true;
+    }
+    // the compiler never makes code like this, but it would be miscompiled
+    return emitter->depths[offset] == depth;
+}
+
+// every instruction always runs with the same number of values on the stack,
+// so each slot can be a local of its own
+static bool find_depths(Emitter* emitter)
+{
+    Chunk* chunk = emitter->chunk;
+    int* work = ALLOCATE(int, chunk->count);
+    int work_count = 0;
+    bool ok = set_depth(emitter, work, &work_count, 0, 0);
+
+    while (ok && work_count > 0)
+    {
+        int offset = work[--work_count];
+        int depth = emitter->depths[offset];
+
+        Part instr_parts[SUPERINSTR_MAX_OPS];
+        int count = split_instr(chunk, offset, instr_parts);
+        OpCode last = instr_parts[count - 1].op;
+        for (int i = 0; i < count; i++)
+        {
+            depth += stack_effect(chunk, &instr_parts[i]);
+            // and the fused updates add on the two slots above (emit_update)
+            int peak = depth + (is_update(instr_parts[i].op) ? 2 : 0);
+            if (peak > emitter->max_depth)
+            {
+                emitter->max_depth = peak;
+            }
+        }
+
+        if (is_jump(chunk->code[offset]))
+        {
+            int target = jump_target(chunk, offset);
+            emitter->targets[target] = true;
+            ok = set_depth(emitter, work, &work_count, target, depth);
+        }
+        if (ok && last != OP_JUMP && last != OP_LOOP && last != OP_RETURN)
+        {
+            int next = offset + instr_length(chunk->code[offset]);
+            ok = set_depth(emitter, work, &work_count, next, depth);
+        }
+    }
+
+    FREE_ARRAY(int, work, chunk->count);
+    return ok;
+}
+
+// the constant at `index`, if it's a string
+static void number_string(Emitter* emitter, int index)
+{
+    if (IS_STRING(emitter->chunk->constants.values[index]) &&
+        emitter->strings[index] == -1)
+    {
+        emitter->strings[index] = emitter->string_count++;
+    }
+}
+
+static void number_global(Emitter* emitter, int slot)
+{
+    if (emitter->globals[slot] == -1)
+    {
+        emitter->globals[slot] = emitter->global_count++;
+    }
+}
+
+// numbers each string, global and native the script uses, in the order
+// they're first seen
+static bool collect_names(Emitter* emitter)
+{
+    Chunk* chunk = emitter->chunk;
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        Part instr_parts[SUPERINSTR_MAX_OPS];
+        int count = split_instr(chunk, offset, instr_parts);
+        for (int i = 0; i < count; i++)
+        {
+            int operands = instr_parts[i].operands;
+            switch (instr_parts[i].op)
+            {
+            case OP_CONSTANT:
+                number_string(emitter, chunk->code[operands]);
+                break;
+            case OP_ADD_CONST_LOCAL:
+                number_string(emitter, chunk->code[operands + 1]);
+                break;
+            case OP_ADD_CONST_GLOBAL:
+                number_string(emitter, chunk->code[operands + 2]);
+                number_global(emitter, read_short(chunk, operands));
+                break;
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_INC_GLOBAL:
+                number_global(emitter, read_short(chunk, operands));
+                break;
+            case OP_CALL_NATIVE:
+            {
+                int native = chunk->code[operands];
+                if (emitter->natives[native] == -1)
+                {
+                    emitter->natives[native] = emitter->native_count++;
+                }
+                break;
+            }
+            case OP_IMPORT:
+            {
+                Value path = chunk->constants.values[chunk->code[operands]];
+                fprintf(stderr,
+                        "Can't emit C for a script that imports \"%.*s\".\n",
+                        STRING_LENGTH(path), STRING_CHARS(path));
+                return false;
+            }
+            default:
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+// always 3 digit octal escapes, so a digit after one isn't swallowed by it
+static void emit_string(FILE* out, const char* chars, int length)
+{
+    fputc('"', out);
+    for (int i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)chars[i];
+        if (c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?')
+        {
+            fputc(c, out);
+        }
+        else
+        {
+            fprintf(out, "\\%03o", c);
+        }
+    }
+    fputc('"', out);
+}
+
+// %.17g gives back the same double, it just needs to look like one
+static void emit_number(FILE* out, double number)
+{
+    if (isnan(number))
+    {
+        // the sign of a nan still shows when it's printed
+        fprintf(out, "NUM_VAL(%sNAN)", signbit(number) ? "-" : "");
+    }
+    else if (isinf(number))
+    {
+        fprintf(out, "NUM_VAL(%sHUGE_VAL)", number < 0 ? "-" : "");
+    }
+    else
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", number);
+        fprintf(out, "NUM_VAL(%s%s)", buf, strpbrk(buf, ".e") ? "" : ".0");
+    }
+}
+
+static void emit_constant(Emitter* emitter, int index, int to)
+{
+    FILE* out = emitter->out;
+    Value value = emitter->chunk->constants.values[index];
+    fprintf(out, "    s%d = ", to);
+    if (IS_STRING(value))
+    {
+        fprintf(out, "AOT_CONSTANT(%d)", emitter->strings[index]);
+    }
+    else if (IS_NUM(value))
+    {
+        emit_number(out, AS_NUM(value));
+    }
+    else if (IS_INT(value))
+    {
+        if (AS_INT(value) == INT64_MIN)
+        {
+            fprintf(out, "INT_VAL(INT64_MIN)");
+        }
+        else
+        {
+            fprintf(out, "INT_VAL(INT64_C(%lld))", (long long)AS_INT(value));
+        }
+    }
+    else if (IS_BOOL(value))
+    {
+        fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+    }
+    else
+    {
+        fprintf(out, "NIL_VAL");
+    }
+    fprintf(out, ";\n");
+}
+
+// the gc can only see (and move) what's on the vm stack, so the locals go
+// there around anything that allocates
+static void emit_spill(Emitter* emitter, int depth)
+{
+    for (int i = 0; i < depth; i++)
+    {
+        fprintf(emitter->out, "        vm.stack[%d] = s%d;\n", i, i);
+    }
+    fprintf(emitter->out, "        vm.stack_top = vm.stack + %d;\n", depth);
+}
+
+static void emit_reload(Emitter* emitter, int depth)
+{
+    for (int i = 0; i < depth; i++)
+    {
+        fprintf(emitter->out, "        s%d = vm.stack[%d];\n", i, i);
+    }
+}
+
+// the array.h (or map.h) function that does an op when the operands aren't
+// plain numbers, or another one like it: it works on the vm stack, can fail,
+// and leaves `kept` values there
+static void emit_array_call(Emitter* emitter, const char* call, int depth,
+                            int kept, int ip)
+{
+    FILE* out = emitter->out;
+    emit_spill(emitter, depth);
+    fprintf(out, "        vm.ip = script.chunk.code + %d;\n", ip);
+    emitter->can_fail = true;
+    fprintf(out, "        if (!%s)\n", call);
+    fprintf(out, "        {\n");
+    fprintf(out, "            goto error;\n");
+    fprintf(out, "        }\n");
+    emit_reload(emitter, kept);
+}
+
+static void emit_add(Emitter* emitter, int depth, int ip)
+{
+    FILE* out = emitter->out;
+    int a = depth - 2;
+    int b = depth - 1;
+    fprintf(out, "    if (IS_NUMERIC(s%d) && IS_NUMERIC(s%d))\n", a, b);
+    fprintf(out, "    {\n");
+    fprintf(out,
+            "        AOT_ARITH(s%d, s%d, add_overflows, AOT_ADD_NUM, %d);\n", a,
+            b, ip);
+    fprintf(out, "    }\n");
+    fprintf(out, "    else if (IS_STRING(s%d) && IS_STRING(s%d))\n", a, b);
+    fprintf(out, "    {\n");
+    emit_spill(emitter, depth);
+    fprintf(out, "        concatenate();\n");
+    emit_reload(emitter, depth - 1);
+    fprintf(out, "    }\n");
+    fprintf(out, "    else\n");
+    fprintf(out, "    {\n");
+    emit_array_call(emitter, "array_binary(OP_ADD)", depth, depth - 1, ip);
+    fprintf(out, "    }\n");
+}
+
+// OP_INC_* and OP_ADD_CONST_*: the variable and the constant go in the two
+// slots above the stack, where the unfused code had them, and get added the
+// same way. the sum is left in s<depth>
+static void emit_update(Emitter* emitter, const char* variable, int constant,
+                        int depth, int ip)
+{
+    FILE* out = emitter->out;
+    fprintf(out, "    s%d = %s;\n", depth, variable);
+    if (constant == -1)
+    {
+        fprintf(out, "    s%d = INT_VAL(1);\n", depth + 1);
+    }
+    else
+    {
+        emit_constant(emitter, constant, depth + 1);
+    }
+    emit_add(emitter, depth + 2, ip);
+    emitter->can_fail = true;
+}
+
+// the args are spilled to where run() would have them, so the native can't
+// tell the difference
+static void emit_native_call(Emitter* emitter, int operands, int depth, int ip)
+{
+    FILE* out = emitter->out;
+    int native = emitter->natives[emitter->chunk->code[operands]];
+    int argc = emitter->chunk->code[operands + 1];
+    int args = depth - argc;
+
+    fprintf(out, "    {\n");
+    emit_spill(emitter, depth);
+    fprintf(out, "        vm.ip = script.chunk.code + %d;\n", ip);
+    fprintf(out,
+            "        if (!native_fns[%d](%d, vm.stack + %d, vm.stack + %d))\n",
+            native, argc, args, args);
+    fprintf(out, "        {\n");
+    fprintf(out, "            goto error;\n");
+    fprintf(out, "        }\n");
+    emit_reload(emitter, args + 1);
+    fprintf(out, "    }\n");
+}
+
+// `binary` is AOT_ARITH or AOT_COMPARE with its operands, for numbers.
+// anything else goes to array_binary(), like in run()
+static void emit_binary(Emitter* emitter, const char* op, const char* binary,
+                        int depth, int ip)
+{
+    FILE* out = emitter->out;
+    char call[32];
+    snprintf(call, sizeof(call), "array_binary(%s)", op);
+
+    fprintf(out, "    if (IS_NUMERIC(s%d) && IS_NUMERIC(s%d))\n", depth - 2,
+            depth - 1);
+    fprintf(out, "    {\n");
+    fprintf(out, "        %s;\n", binary);
+    fprintf(out, "    }\n");
+    fprintf(out, "    else\n");
+    fprintf(out, "    {\n");
+    emit_array_call(emitter, call, depth, depth - 1, ip);
+    fprintf(out, "    }\n");
+}
+
+static void emit_arith(Emitter* emitter, const char* op, const char* int_op,
+                       const char* double_op, int depth, int ip)
+{
+    char arith[96];
+    snprintf(arith, sizeof(arith), "AOT_ARITH(s%d, s%d, %s, %s, %d)",
+             depth - 2, depth - 1, int_op, double_op, ip);
+    emit_binary(emitter, op, arith, depth, ip);
+}
+
+// one plain instruction, with `depth` values on the stack before it
+static void emit_part(Emitter* emitter, Part* part, int depth, int target)
+{
+    Chunk* chunk = emitter->chunk;
+    FILE* out = emitter->out;
+    int top = depth - 1;
+    int ip = part->ip;
+
+    switch (part->op)
+    {
+    case OP_CONSTANT:
+        emit_constant(emitter, chunk->code[part->operands], depth);
+        break;
+    case OP_NIL:
+        fprintf(out, "    s%d = NIL_VAL;\n", depth);
+        break;
+    case OP_TRUE:
+        fprintf(out, "    s%d = BOOL_VAL(true);\n", depth);
+        break;
+    case OP_FALSE:
+        fprintf(out, "    s%d = BOOL_VAL(false);\n", depth);
+        break;
+    case OP_POP:
+        break;
+    case OP_GET_LOCAL:
+        fprintf(out, "    s%d = s%d;\n", depth, chunk->code[part->operands]);
+        break;
+    case OP_SET_LOCAL:
+        fprintf(out, "    s%d = s%d;\n", chunk->code[part->operands], top);
+        break;
+    case OP_GET_GLOBAL:
+    {
+        int global = emitter->globals[read_short(chunk, part->operands)];
+        fprintf(out, "    AOT_CHECK_GLOBAL(%d, %d)\n", global, ip);
+        fprintf(out, "    s%d = AOT_GLOBAL(%d);\n", depth, global);
+        emitter->can_fail = true;
+        break;
+    }
+    case OP_DEFINE_GLOBAL:
+        fprintf(out, "    AOT_GLOBAL(%d) = s%d;\n",
+                emitter->globals[read_short(chunk, part->operands)], top);
+        break;
+    case OP_SET_GLOBAL:
+    {
+        int global = emitter->globals[read_short(chunk, part->operands)];
+        fprintf(out, "    AOT_CHECK_GLOBAL(%d, %d)\n", global, ip);
+        fprintf(out, "    AOT_GLOBAL(%d) = s%d;\n", global, top);
+        emitter->can_fail = true;
+        break;
+    }
+    case OP_INC_LOCAL:
+    case OP_ADD_CONST_LOCAL:
+    {
+        int slot = chunk->code[part->operands];
+        char variable[16];
+        snprintf(variable, sizeof(variable), "s%d", slot);
+        emit_update(emitter, variable,
+                    part->op == OP_INC_LOCAL
+                        ? -1
+                        : chunk->code[part->operands + 1],
+                    depth, ip);
+        fprintf(out, "    s%d = s%d;\n", slot, depth);
+        break;
+    }
+    case OP_INC_GLOBAL:
+    case OP_ADD_CONST_GLOBAL:
+    {
+        int global = emitter->globals[read_short(chunk, part->operands)];
+        char variable[32];
+        snprintf(variable, sizeof(variable), "AOT_GLOBAL(%d)", global);
+        fprintf(out, "    AOT_CHECK_GLOBAL(%d, %d)\n", global, ip);
+        emit_update(emitter, variable,
+                    part->op == OP_INC_GLOBAL
+                        ? -1
+                        : chunk->code[part->operands + 2],
+                    depth, ip);
+        fprintf(out, "    AOT_GLOBAL(%d) = s%d;\n", global, depth);
+        break;
+    }
+    case OP_NOT:
+        fprintf(out, "    s%d = BOOL_VAL(AOT_FALSEY(s%d));\n", top, top);
+        break;
+    case OP_EQUAL:
+        fprintf(out, "    s%d = BOOL_VAL(values_equal(s%d, s%d));\n",
+                depth - 2, depth - 2, top);
+        break;
+    case OP_GRTR:
+    case OP_LESS:
+    case OP_NOT_LESS:
+    case OP_NOT_GRTR:
+    {
+        // the opcodes and the aot.h macros have the same names
+        const char* name = part->op == OP_GRTR       ? "GRTR"
+                           : part->op == OP_LESS     ? "LESS"
+                           : part->op == OP_NOT_LESS ? "NOT_LESS"
+                                                     : "NOT_GRTR";
+        char compare[80];
+        snprintf(compare, sizeof(compare), "AOT_COMPARE(s%d, s%d, AOT_%s, %d)",
+                 depth - 2, top, name, ip);
+        char op[32];
+        snprintf(op, sizeof(op), "OP_%s", name);
+        emit_binary(emitter, op, compare, depth, ip);
+        emitter->can_fail = true;
+        break;
+    }
+    case OP_ADD:
+        emit_add(emitter, depth, ip);
+        emitter->can_fail = true;
+        break;
+    case OP_SUB:
+        emit_arith(emitter, "OP_SUB", "sub_overflows", "AOT_SUB_NUM", depth,
+                   ip);
+        emitter->can_fail = true;
+        break;
+    case OP_MULT:
+        emit_arith(emitter, "OP_MULT", "mul_overflows", "AOT_MULT_NUM", depth,
+                   ip);
+        emitter->can_fail = true;
+        break;
+    case OP_DIV:
+        emit_arith(emitter, "OP_DIV", "div_inexact", "AOT_DIV_NUM", depth,
+                   ip);
+        emitter->can_fail = true;
+        break;
+    case OP_POW:
+        emit_arith(emitter, "OP_POW", "pow_overflows", "fast_pow", depth,
+                   ip);
+        emitter->can_fail = true;
+        break;
+    case OP_NEGATE:
+        fprintf(out, "    if (IS_NUMERIC(s%d))\n", top);
+        fprintf(out, "    {\n");
+        fprintf(out, "        AOT_NEGATE(s%d, %d);\n", top, ip);
+        fprintf(out, "    }\n");
+        fprintf(out, "    else\n");
+        fprintf(out, "    {\n");
+        emit_array_call(emitter, "array_negate()", depth, depth, ip);
+        fprintf(out, "    }\n");
+        emitter->can_fail = true;
+        break;
+    case OP_CALL_NATIVE:
+        emit_native_call(emitter, part->operands, depth, ip);
+        emitter->can_fail = true;
+        break;
+    case OP_PRINT:
+        fprintf(out, "    print_value(s%d);\n", top);
+        fprintf(out, "    printf(\"\\n\");\n");
+        break;
+    // there's no budget, the function always runs to the end
+    case OP_JUMP:
+    case OP_LOOP:
+        fprintf(out, "    goto L%d;\n", target);
+        break;
+    case OP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_FALSE:
+        fprintf(out, "    if (AOT_FALSEY(s%d))\n", top);
+        fprintf(out, "    {\n");
+        fprintf(out, "        goto L%d;\n", target);
+        fprintf(out, "    }\n");
+        break;
+    case OP_JUMP_IF_TRUE:
+    case OP_POP_JUMP_IF_TRUE:
+        fprintf(out, "    if (!AOT_FALSEY(s%d))\n", top);
+        fprintf(out, "    {\n");
+        fprintf(out, "        goto L%d;\n", target);
+        fprintf(out, "    }\n");
+        break;
+    // cond, a, b
+    case OP_SELECT:
+        fprintf(out, "    s%d = AOT_FALSEY(s%d) ? s%d : s%d;\n", depth - 3,
+                depth - 3, top, depth - 2);
+        break;
+    case OP_PICK:
+        fprintf(out, "    s%d = s%d;\n", depth,
+                top - chunk->code[part->operands]);
+        break;
+    case OP_ARRAY:
+    {
+        int count = chunk->code[part->operands];
+        fprintf(out, "    {\n");
+        emit_spill(emitter, depth);
+        fprintf(out, "        make_array(%d);\n", count);
+        emit_reload(emitter, depth - count + 1);
+        fprintf(out, "    }\n");
+        break;
+    }
+    case OP_MAP:
+    {
+        int count = chunk->code[part->operands];
+        char call[32];
+        snprintf(call, sizeof(call), "make_map(%d)", count);
+        fprintf(out, "    {\n");
+        emit_array_call(emitter, call, depth, depth - 2 * count + 1, ip);
+        fprintf(out, "    }\n");
+        break;
+    }
+    case OP_FORMAT:
+    {
+        int count = chunk->code[part->operands];
+        char call[32];
+        snprintf(call, sizeof(call), "format_parts(%d)", count);
+        fprintf(out, "    {\n");
+        emit_array_call(emitter, call, depth, depth - count + 1, ip);
+        fprintf(out, "    }\n");
+        break;
+    }
+    case OP_INDEX:
+        fprintf(out, "    AOT_INDEX(s%d, s%d, %d);\n", depth - 2, top, ip);
+        emitter->can_fail = true;
+        break;
+    case OP_RETURN:
+        fprintf(out, "    goto done;\n");
+        break;
+    default:
+        // imports were turned away by collect_names
+        break;
+    }
+}
+
+// `map` goes from the chunk's numbering to ours, `name` gives the name of
+// each of the chunk's
+static void emit_names(FILE* out, const char* array, int* map, int map_count,
+                       int count, const char* (*name)(int index))
+{
+    fprintf(out, "static const char* const %s[] = {\n", array);
+    for (int i = 0; i < count; i++)
+    {
+        for (int j = 0; j < map_count; j++)
+        {
+            if (map[j] == i)
+            {
+                fprintf(out, "    ");
+                emit_string(out, name(j), (int)strlen(name(j)));
+                fprintf(out, ",\n");
+                break;
+            }
+        }
+    }
+    if (count == 0)
+    {
+        fprintf(out, "    NULL,\n");
+    }
+    fprintf(out, "};\n\n");
+}
+
+static const char* native_name(int index)
+{
+    return natives[index].name;
+}
+
+static void emit_data(Emitter* emitter)
+{
+    Chunk* chunk = emitter->chunk;
+    FILE* out = emitter->out;
+
+    fprintf(out, "static uint8_t code[%d];\n", chunk->count);
+    fprintf(out, "static const int lines[%d] = {", chunk->count);
+    for (int i = 0; i < chunk->count; i++)
+    {
+        fprintf(out, "%s%d,", i % 16 == 0 ? "\n    " : " ", chunk->lines[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const AotString strings[] = {\n");
+    for (int i = 0; i < emitter->string_count; i++)
+    {
+        for (int j = 0; j < chunk->constants.count; j++)
+        {
+            if (emitter->strings[j] == i)
+            {
+                Value value = chunk->constants.values[j];
+                fprintf(out, "    {");
+                emit_string(out, STRING_CHARS(value), STRING_LENGTH(value));
+                fprintf(out, ", %d},\n", STRING_LENGTH(value));
+                break;
+            }
+        }
+    }
+    if (emitter->string_count == 0)
+    {
+        fprintf(out, "    {NULL, 0},\n");
+    }
+    fprintf(out, "};\n\n");
+
+    emit_names(out, "global_names", emitter->globals, vm.globals.count,
+               emitter->global_count, global_name);
+    emit_names(out, "native_names", emitter->natives, native_count,
+               emitter->native_count, native_name);
+
+    fprintf(out,
+            "static const AotInfo info = {code, lines, %d, strings, %d,\n"
+            "                             global_names, %d, native_names, "
+            "%d, %d};\n\n",
+            chunk->count, emitter->string_count, emitter->global_count,
+            emitter->native_count, emitter->max_depth);
+}
+
+static void emit_function(Emitter* emitter, const char* name)
+{
+    Chunk* chunk = emitter->chunk;
+    FILE* out = emitter->out;
+
+    fprintf(out, "InterpretResult %s()\n", name);
+    fprintf(out, "{\n");
+    fprintf(out, "    AotScript script;\n");
+    fprintf(out, "    int global_slots[%d];\n",
+            emitter->global_count > 0 ? emitter->global_count : 1);
+    fprintf(out, "    NativeFn native_fns[%d];\n",
+            emitter->native_count > 0 ? emitter->native_count : 1);
+    fprintf(out, "    if (!aot_enter(&script, &info, global_slots, "
+                 "native_fns))\n");
+    fprintf(out, "    {\n");
+    fprintf(out, "        return INTERPRET_RUNTIME_ERR;\n");
+    fprintf(out, "    }\n");
+
+    for (int i = 0; i < emitter->max_depth; i++)
+    {
+        fprintf(out, "%s s%d%s", i % 8 == 0 ? "\n    Value" : "", i,
+                i % 8 == 7 || i == emitter->max_depth - 1 ? ";" : ",");
+    }
+    fprintf(out, "\n\n");
+
+    int line = -1;
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        int depth = emitter->depths[offset];
+        if (depth == -1)
+        {
+            continue;
+        }
+        if (emitter->targets[offset])
+        {
+            fprintf(out, "L%d:\n", offset);
+        }
+        if (chunk->lines[offset] != line)
+        {
+            line = chunk->lines[offset];
+            fprintf(out, "    // line %d\n", line);
+        }
+
+        int target = is_jump(chunk->code[offset]) ? jump_target(chunk, offset)
+                                                  : -1;
+        Part instr_parts[SUPERINSTR_MAX_OPS];
+        int count = split_instr(chunk, offset, instr_parts);
+        for (int i = 0; i < count; i++)
+        {
+            emit_part(emitter, &instr_parts[i], depth, target);
+            depth += stack_effect(chunk, &instr_parts[i]);
+        }
+    }
+
+    fprintf(out, "done:\n");
+    fprintf(out, "    aot_leave(&script);\n");
+    fprintf(out, "    return INTERPRET_OK;\n");
+    if (emitter->can_fail)
+    {
+        fprintf(out, "error:\n");
+        fprintf(out, "    aot_leave(&script);\n");
+        fprintf(out, "    return INTERPRET_RUNTIME_ERR;\n");
+    }
+    fprintf(out, "}\n");
+}
+
+bool emit_c(Chunk* chunk, const char* name, FILE* out)
+{
+    Emitter emitter;
+    emitter.chunk = chunk;
+    emitter.out = out;
+    emitter.depths = ALLOCATE(int, chunk->count);
+    emitter.targets = ALLOCATE(bool, chunk->count);
+    emitter.max_depth = 0;
+    emitter.strings = ALLOCATE(int, chunk->constants.count);
+    emitter.string_count = 0;
+    emitter.globals = ALLOCATE(int, vm.globals.count);
+    emitter.global_count = 0;
+    emitter.native_count = 0;
+    emitter.can_fail = false;
+
+    for (int i = 0; i < chunk->count; i++)
+    {
+        emitter.depths[i] = -1;
+        emitter.targets[i] = false;
+    }
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        emitter.strings[i] = -1;
+    }
+    for (int i = 0; i < vm.globals.count; i++)
+    {
+        emitter.globals[i] = -1;
+    }
+    for (int i = 0; i < UINT8_COUNT; i++)
+    {
+        emitter.natives[i] = -1;
+    }
+
+    bool ok = collect_names(&emitter);
+    if (ok && !find_depths(&emitter))
+    {
+        fprintf(stderr, "Can't emit C: the stack depth isn't fixed.\n");
+        ok = false;
+    }
+
+    if (ok)
+    {
+        fprintf(out, "// generated by clox --emit-c, don't edit\n");
+        fprintf(out, "#include \"aot.h\"\n\n");
+        emit_data(&emitter);
+        emit_function(&emitter, name);
+    }
+
+    FREE_ARRAY(int, emitter.depths, chunk->count);
+    FREE_ARRAY(bool, emitter.targets, chunk->count);
+    FREE_ARRAY(int, emitter.strings, chunk->constants.count);
+    FREE_ARRAY(int, emitter.globals, vm.globals.count);
+    return ok;
+}
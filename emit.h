@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+// writes `chunk` (a compiled script) out as a C function called `name`, which
+// runs it without the interpreter:
+//
+//     InterpretResult name();
+//
+// it's compiled against aot.h and linked with everything but main.c, then
+// called like interpret() is. false if the script can't be translated (it
+// imports other scripts), after saying why
+bool emit_c(Chunk* chunk, const char* name, FILE* out);
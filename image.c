@@ -0,0 +1,560 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "image.h"
+#include "memory.h"
+#include "serialize.h"
+#include "vm.h"
+
+#define IMAGE_MAGIC 0x49584c43 // "CLXI"
+// the image is only any good to a build that lays things out the same way
+#define IMAGE_LAYOUT                                                           \
+    ((uint32_t)(sizeof(void*) | sizeof(Value) << 8 | sizeof(Chunk) << 16 |     \
+                sizeof(Module) << 24))
+
+// everything else is found through this. "offsets" are from the start of the
+// file, pointers are stored as offsets too until they're fixed up
+typedef struct ImageHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layout;
+    uint32_t string_count;
+    uint64_t size;
+
+    // where every pointer in the image is: each one gets the base added
+    uint64_t relocs;
+    uint64_t reloc_count;
+
+    // ObjString*[string_count], everything that was interned
+    uint64_t strings;
+    // Value[global_count] and ObjString*[global_count]
+    uint64_t globals;
+    uint64_t global_names;
+    uint32_t global_count;
+    uint32_t module_count;
+    // Module[module_count]
+    uint64_t modules;
+} ImageHeader;
+
+// an array or map that's been written, and where to
+typedef struct WrittenObj
+{
+    Obj* obj;
+    size_t offset;
+} WrittenObj;
+
+typedef struct ImageWriter
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+
+    uint64_t* relocs;
+    size_t reloc_count;
+    size_t reloc_capacity;
+
+    // string -> its offset
+    Table strings;
+    // array or map -> its offset. open addressing on the address, the
+    // capacity is a power of 2 and it's never more than half full
+    WrittenObj* objects;
+    size_t object_count;
+    size_t object_capacity;
+} ImageWriter;
+
+// room for `size` zeroed bytes, 8 aligned. returns its offset: `data` may
+// move, so don't hold pointers into it across this
+static size_t reserve(ImageWriter* writer, size_t size)
+{
+    size_t offset = (writer->size + 7) & ~(size_t)7;
+    size_t end = offset + size;
+    if (end > writer->capacity)
+    {
+        size_t old_capacity = writer->capacity;
+        while (writer->capacity < end)
+        {
+            writer->capacity = GROW_CAPACITY(writer->capacity);
+        }
+        writer->data = GROW_ARRAY(uint8_t, writer->data, old_capacity,
+                                  writer->capacity);
+    }
+
+    memset(writer->data + writer->size, 0, end - writer->size);
+    writer->size = end;
+    return offset;
+}
+
+// the pointer at `at` points to `target`, 0 is NULL
+static void write_pointer(ImageWriter* writer, size_t at, size_t target)
+{
+    uintptr_t value = (uintptr_t)target;
+    memcpy(writer->data + at, &value, sizeof(value));
+    if (target == 0)
+    {
+        return;
+    }
+
+    if (writer->reloc_capacity < writer->reloc_count + 1)
+    {
+        size_t old_capacity = writer->reloc_capacity;
+        writer->reloc_capacity = GROW_CAPACITY(old_capacity);
+        writer->relocs = GROW_ARRAY(uint64_t, writer->relocs, old_capacity,
+                                    writer->reloc_capacity);
+    }
+    writer->relocs[writer->reloc_count++] = at;
+}
+
+static size_t string_offset(ImageWriter* writer, ObjString* string)
+{
+    int offset = 0;
+    table_get(&writer->strings, string, &offset);
+    return offset;
+}
+
+static size_t write_string(ImageWriter* writer, ObjString* string)
+{
+    size_t size = sizeof(ObjString) + string->length + 1;
+    size_t offset = reserve(writer, size);
+
+    ObjString* copy = (ObjString*)(writer->data + offset);
+    memcpy(copy, string, size);
+    copy->obj.gen = GEN_IMAGE;
+    copy->obj.marked = false;
+    copy->obj.remembered = false;
+    copy->obj.next = NULL;
+
+    table_set(&writer->strings, string, (int)offset);
+    return offset;
+}
+
+// where `obj` is in writer->objects, or the empty slot it'd go in
+static size_t object_slot(ImageWriter* writer, Obj* obj)
+{
+    size_t mask = writer->object_capacity - 1;
+    size_t index = ((uintptr_t)obj >> 4) & mask;
+    while (writer->objects[index].obj != NULL &&
+           writer->objects[index].obj != obj)
+    {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+// 0 if it hasn't been written yet
+static size_t object_offset(ImageWriter* writer, Obj* obj)
+{
+    if (writer->object_count == 0)
+    {
+        return 0;
+    }
+    WrittenObj* written = &writer->objects[object_slot(writer, obj)];
+    return written->obj == obj ? written->offset : 0;
+}
+
+static void add_object(ImageWriter* writer, Obj* obj, size_t offset)
+{
+    if ((writer->object_count + 1) * 2 > writer->object_capacity)
+    {
+        WrittenObj* old = writer->objects;
+        size_t old_capacity = writer->object_capacity;
+        writer->object_capacity = GROW_CAPACITY(old_capacity);
+        writer->objects = ALLOCATE(WrittenObj, writer->object_capacity);
+        memset(writer->objects, 0,
+               sizeof(WrittenObj) * writer->object_capacity);
+        for (size_t i = 0; i < old_capacity; i++)
+        {
+            if (old[i].obj != NULL)
+            {
+                writer->objects[object_slot(writer, old[i].obj)] = old[i];
+            }
+        }
+        FREE_ARRAY(WrittenObj, old, old_capacity);
+    }
+
+    WrittenObj* written = &writer->objects[object_slot(writer, obj)];
+    written->obj = obj;
+    written->offset = offset;
+    writer->object_count++;
+}
+
+static void write_value(ImageWriter* writer, size_t at, Value value);
+
+// each array and map is written once, however many values point to it (see
+// write_value), so an image is no bigger than the heap it came from
+static size_t write_array(ImageWriter* writer, ObjArray* array)
+{
+    size_t size = object_size(&array->obj);
+    size_t offset = reserve(writer, size);
+
+    ObjArray* copy = (ObjArray*)(writer->data + offset);
+    memcpy(copy, array, size);
+    copy->obj.gen = GEN_IMAGE;
+    copy->obj.marked = false;
+    copy->obj.remembered = false;
+    copy->obj.next = NULL;
+
+    if (!array->numeric)
+    {
+        for (int i = 0; i < array->count; i++)
+        {
+            write_value(writer,
+                        offset + offsetof(ObjArray, values) + sizeof(Value) * i,
+                        array->values[i]);
+        }
+    }
+    return offset;
+}
+
+static size_t write_map(ImageWriter* writer, ObjMap* map)
+{
+    size_t size = object_size(&map->obj);
+    size_t offset = reserve(writer, size);
+
+    ObjMap* copy = (ObjMap*)(writer->data + offset);
+    memcpy(copy, map, size);
+    copy->obj.gen = GEN_IMAGE;
+    copy->obj.marked = false;
+    copy->obj.remembered = false;
+    copy->obj.next = NULL;
+
+    size_t entries = offset + offsetof(ObjMap, entries);
+    for (int i = 0; i < map->capacity; i++)
+    {
+        size_t entry = entries + sizeof(MapEntry) * i;
+        if (MAP_CTRL(map)[i] == MAP_EMPTY)
+        {
+            // never written to, so it'd be whatever was in memory
+            memset(writer->data + entry, 0, sizeof(MapEntry));
+            continue;
+        }
+        write_value(writer, entry + offsetof(MapEntry, key),
+                    map->entries[i].key);
+        write_value(writer, entry + offsetof(MapEntry, value),
+                    map->entries[i].value);
+    }
+    return offset;
+}
+
+static void write_value(ImageWriter* writer, size_t at, Value value)
+{
+    Value copy = value;
+    if (IS_OBJ(value))
+    {
+        copy.as.obj = NULL;
+    }
+    memcpy(writer->data + at, &copy, sizeof(Value));
+
+    if (IS_ARRAY(value) || IS_MAP(value))
+    {
+        size_t offset = object_offset(writer, AS_OBJ(value));
+        if (offset == 0)
+        {
+            offset = IS_ARRAY(value) ? write_array(writer, AS_ARRAY(value))
+                                     : write_map(writer, AS_MAP(value));
+            add_object(writer, AS_OBJ(value), offset);
+        }
+        write_pointer(writer, at + offsetof(Value, as), offset);
+    }
+    else if (IS_OBJ(value))
+    {
+        // strings are all in vm.strings, so they're written already
+        write_pointer(writer, at + offsetof(Value, as),
+                      string_offset(writer, AS_STRING(value)));
+    }
+}
+
+static void write_chunk_copy(ImageWriter* writer, size_t at, Chunk* chunk)
+{
+    size_t code = reserve(writer, chunk->count);
+    memcpy(writer->data + code, chunk->code, chunk->count);
+    size_t lines = reserve(writer, sizeof(int) * chunk->count);
+    memcpy(writer->data + lines, chunk->lines, sizeof(int) * chunk->count);
+    size_t constants = reserve(writer, sizeof(Value) * chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        write_value(writer, constants + sizeof(Value) * i,
+                    chunk->constants.values[i]);
+    }
+
+    // nothing is ever added to it, so capacity == count
+    Chunk copy;
+    init_chunk(&copy);
+    copy.count = copy.capacity = chunk->count;
+    copy.constants.count = copy.constants.capacity = chunk->constants.count;
+    copy.max_depth = chunk->max_depth;
+    memcpy(writer->data + at, &copy, sizeof(Chunk));
+
+    write_pointer(writer, at + offsetof(Chunk, code), chunk->count ? code : 0);
+    write_pointer(writer, at + offsetof(Chunk, lines),
+                  chunk->count ? lines : 0);
+    write_pointer(writer, at + offsetof(Chunk, constants.values),
+                  chunk->constants.count ? constants : 0);
+}
+
+bool save_image(const char* path)
+{
+    ImageWriter writer = {0};
+    init_table(&writer.strings);
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    reserve(&writer, sizeof(ImageHeader));
+
+    header.string_count = 0;
+    for (int i = 0; i < vm.strings.capacity; i++)
+    {
+        if (vm.strings.entries[i].key != NULL)
+        {
+            write_string(&writer, vm.strings.entries[i].key);
+            header.string_count++;
+        }
+    }
+    header.strings = reserve(&writer, sizeof(ObjString*) * header.string_count);
+    for (int i = 0, n = 0; i < vm.strings.capacity; i++)
+    {
+        ObjString* key = vm.strings.entries[i].key;
+        if (key != NULL)
+        {
+            write_pointer(&writer, header.strings + sizeof(ObjString*) * n++,
+                          string_offset(&writer, key));
+        }
+    }
+
+    header.global_count = vm.globals.count;
+    header.globals = reserve(&writer, sizeof(Value) * vm.globals.count);
+    header.global_names =
+        reserve(&writer, sizeof(ObjString*) * vm.globals.count);
+    for (int i = 0; i < vm.globals.count; i++)
+    {
+        write_value(&writer, header.globals + sizeof(Value) * i,
+                    vm.globals.values[i]);
+    }
+    for (int i = 0; i < vm.global_names.capacity; i++)
+    {
+        Entry* entry = &vm.global_names.entries[i];
+        if (entry->key != NULL)
+        {
+            write_pointer(&writer,
+                          header.global_names +
+                              sizeof(ObjString*) * entry->value,
+                          string_offset(&writer, entry->key));
+        }
+    }
+
+    header.module_count = vm.module_count;
+    header.modules = reserve(&writer, sizeof(Module) * vm.module_count);
+    for (int i = 0; i < vm.module_count; i++)
+    {
+        size_t at = header.modules + sizeof(Module) * i;
+        Module copy = {NULL};
+        copy.in_image = true;
+        memcpy(writer.data + at, &copy, sizeof(Module));
+        write_pointer(&writer, at + offsetof(Module, path),
+                      string_offset(&writer, vm.modules[i]->path));
+        write_chunk_copy(&writer, at + offsetof(Module, chunk),
+                         &vm.modules[i]->chunk);
+    }
+
+    header.reloc_count = writer.reloc_count;
+    header.relocs = reserve(&writer, sizeof(uint64_t) * writer.reloc_count);
+    memcpy(writer.data + header.relocs, writer.relocs,
+           sizeof(uint64_t) * writer.reloc_count);
+
+    header.magic = IMAGE_MAGIC;
+    header.version = BYTECODE_VERSION;
+    header.layout = IMAGE_LAYOUT;
+    header.size = writer.size;
+    memcpy(writer.data, &header, sizeof(header));
+
+    FILE* file = fopen(path, "wb");
+    bool ok = file != NULL &&
+              fwrite(writer.data, 1, writer.size, file) == writer.size;
+    if (file != NULL)
+    {
+        ok &= fclose(file) == 0;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Could not write image \"%s\".\n", path);
+    }
+
+    free_table(&writer.strings);
+    FREE_ARRAY(WrittenObj, writer.objects, writer.object_capacity);
+    FREE_ARRAY(uint64_t, writer.relocs, writer.reloc_capacity);
+    FREE_ARRAY(uint8_t, writer.data, writer.capacity);
+    return ok;
+}
+
+// a private (copy on write) mapping: the fixups write to it, the file stays
+// as it is
+static void* map_file(const char* path, size_t* size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return NULL;
+    }
+
+    LARGE_INTEGER file_size;
+    HANDLE mapping = NULL;
+    void* base = NULL;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+    {
+        mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    }
+    if (mapping != NULL)
+    {
+        base = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+
+    *size = (size_t)file_size.QuadPart;
+    return base;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    void* base = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    0);
+        base = base == MAP_FAILED ? NULL : base;
+    }
+    close(fd);
+
+    *size = (size_t)st.st_size;
+    return base;
+#endif
+}
+
+static void unmap_file(void* base, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+static bool in_image(ImageHeader* header, uint64_t offset, uint64_t count,
+                     size_t size)
+{
+    return offset <= header->size &&
+           count <= (header->size - offset) / (size ? size : 1);
+}
+
+// adds the base to every pointer, checking they're inside the image first
+static bool fix_pointers(uint8_t* base, ImageHeader* header)
+{
+    if (!in_image(header, header->relocs, header->reloc_count,
+                  sizeof(uint64_t)))
+    {
+        return false;
+    }
+
+    uint64_t* relocs = (uint64_t*)(base + header->relocs);
+    for (uint64_t i = 0; i < header->reloc_count; i++)
+    {
+        uintptr_t* field = (uintptr_t*)(base + relocs[i]);
+        if (relocs[i] > header->size - sizeof(uintptr_t) ||
+            *field >= header->size)
+        {
+            return false;
+        }
+        *field += (uintptr_t)base;
+    }
+    return true;
+}
+
+bool load_image(const char* path)
+{
+    if (vm.strings.count != 0 || vm.globals.count != 0 ||
+        vm.module_count != 0 || vm.image != NULL)
+    {
+        fprintf(stderr, "An image can only be loaded into a fresh vm.\n");
+        return false;
+    }
+
+    size_t size;
+    uint8_t* base = map_file(path, &size);
+    if (base == NULL)
+    {
+        fprintf(stderr, "Could not open image \"%s\".\n", path);
+        return false;
+    }
+
+    ImageHeader* header = (ImageHeader*)base;
+    if (size < sizeof(ImageHeader) || header->magic != IMAGE_MAGIC ||
+        header->version != BYTECODE_VERSION || header->layout != IMAGE_LAYOUT ||
+        header->size != size ||
+        !in_image(header, header->strings, header->string_count,
+                  sizeof(ObjString*)) ||
+        !in_image(header, header->globals, header->global_count,
+                  sizeof(Value)) ||
+        !in_image(header, header->global_names, header->global_count,
+                  sizeof(ObjString*)) ||
+        !in_image(header, header->modules, header->module_count,
+                  sizeof(Module)) ||
+        !fix_pointers(base, header))
+    {
+        fprintf(stderr, "\"%s\" is not an image from this build.\n", path);
+        unmap_file(base, size);
+        return false;
+    }
+
+    vm.image = base;
+    vm.image_size = size;
+
+    // the tables and the globals array grow later, so they can't live in
+    // the image. the strings and chunks themselves stay where they are
+    ObjString** strings = (ObjString**)(base + header->strings);
+    for (uint32_t i = 0; i < header->string_count; i++)
+    {
+        table_set(&vm.strings, strings[i], 0);
+    }
+
+    Value* globals = (Value*)(base + header->globals);
+    ObjString** names = (ObjString**)(base + header->global_names);
+    for (uint32_t i = 0; i < header->global_count; i++)
+    {
+        write_value_array(&vm.globals, globals[i]);
+        table_set(&vm.global_names, names[i], i);
+    }
+
+    Module* modules = (Module*)(base + header->modules);
+    for (uint32_t i = 0; i < header->module_count; i++)
+    {
+        add_module(&modules[i]);
+    }
+    return true;
+}
+
+void unmap_image()
+{
+    if (vm.image != NULL)
+    {
+        unmap_file(vm.image, vm.image_size);
+        vm.image = NULL;
+        vm.image_size = 0;
+    }
+}
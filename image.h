@@ -0,0 +1,14 @@
+#pragma once
+
+#include "common.h"
+
+// an image is a snapshot of a vm after it ran some prelude: its interned
+// strings, globals and modules. Loading one is a single mmap and a pass over
+// the pointers in it, instead of compiling and running the prelude again
+
+// after running a script, writes the whole vm out
+bool save_image(const char* path);
+// only into a fresh vm, before anything has run. errors are reported
+bool load_image(const char* path);
+// called by free_vm, after everything pointing into the image is gone
+void unmap_image();
@@ -5,9 +5,40 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "compiler.h"
 #include "debug.h"
+#include "emit.h"
+#include "image.h"
+#include "memory.h"
+#include "optimize.h"
+#include "profile.h"
+#include "sched.h"
+#include "trace.h"
 #include "vm.h"
 
+// --stats=json: a line for every interpret(), on stderr
+static bool show_stats = false;
+
+static void print_stats()
+{
+    if (!show_stats)
+    {
+        return;
+    }
+
+    InterpretStats stats = interpret_stats();
+    fprintf(stderr,
+            "{\"scan_ns\": %llu, \"compile_ns\": %llu, \"run_ns\": %llu, "
+            "\"tokens\": %llu, \"bytes_emitted\": %llu, "
+            "\"constants_added\": %llu, \"instructions\": %llu}\n",
+            (unsigned long long)stats.scan_ns,
+            (unsigned long long)stats.compile_ns,
+            (unsigned long long)stats.run_ns, (unsigned long long)stats.tokens,
+            (unsigned long long)stats.bytes_emitted,
+            (unsigned long long)stats.constants_added,
+            (unsigned long long)stats.instructions);
+}
+
 static void repl()
 {
     char line[1024];
@@ -21,6 +52,7 @@ static void repl()
         }
 
         interpret(line);
+        print_stats();
     }
 }
 
@@ -59,11 +91,24 @@ static char* read_file(const char* path)
     return buffer;
 }
 
+// the file is compiled as it's read, so it can be as big as it likes. "-" is
+// stdin
 static void run_file(const char* path)
 {
-    char* source = read_file(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror("Could not open file\n");
+        exit(74);
+    }
+
+    InterpretResult result = interpret_file(file);
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+    print_stats();
+    profile_dump();
 
     if (result == INTERPRET_COMPILE_ERR)
     {
@@ -75,24 +120,266 @@ static void run_file(const char* path)
     }
 }
 
+// rules.lox becomes lox_rules()
+static void function_name(const char* path, char* name, size_t size)
+{
+    const char* start = strrchr(path, '/');
+    start = start == NULL ? path : start + 1;
+    const char* end = strchr(start, '.');
+    size_t length = end == NULL ? strlen(start) : (size_t)(end - start);
+    if (strcmp(path, "-") == 0 || length == 0)
+    {
+        start = "main";
+        length = 4;
+    }
+    if (length > size - 5)
+    {
+        length = size - 5;
+    }
+
+    memcpy(name, "lox_", 4);
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = start[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9');
+        name[4 + i] = ok ? c : '_';
+    }
+    name[4 + length] = '\0';
+}
+
+// compiles the script and writes it out as C (see emit.h) instead of running
+// it, to stdout unless there's an `out_path`
+static void emit_file(const char* path, const char* out_path)
+{
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror("Could not open file\n");
+        exit(74);
+    }
+
+    Chunk chunk;
+    init_chunk(&chunk);
+    bool compiled = compile_file(file, &chunk);
+    if (file != stdin)
+    {
+        fclose(file);
+    }
+    if (!compiled)
+    {
+        free_chunk(&chunk);
+        exit(65);
+    }
+
+    FILE* out = out_path == NULL ? stdout : fopen(out_path, "w");
+    if (out == NULL)
+    {
+        perror("Could not open output file\n");
+        exit(74);
+    }
+
+    char name[64];
+    function_name(path, name, sizeof(name));
+    bool ok = emit_c(&chunk, name, out);
+    free_chunk(&chunk);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    if (!ok)
+    {
+        exit(65);
+    }
+}
+
+// every script gets a vm of its own, and they take turns on this thread
+static void run_scheduled(const char** paths, int count, int64_t slice,
+                          uint64_t timeout_ns)
+{
+    Scheduler sched;
+    init_scheduler(&sched, slice, timeout_ns);
+
+    for (int i = 0; i < count; i++)
+    {
+        char* source = read_file(paths[i]);
+        bool ok = spawn(&sched, paths[i], source);
+        free(source);
+        if (!ok)
+        {
+            free_scheduler(&sched);
+            exit(65);
+        }
+    }
+
+    int failed = run_scheduler(&sched);
+    free_scheduler(&sched);
+    if (failed > 0)
+    {
+        exit(70);
+    }
+}
+
+static void print_gc_stats()
+{
+    GCStats stats = gc_stats();
+    fprintf(stderr, "gc: %d minor, %d major collections\n",
+            stats.minor_collections, stats.major_collections);
+    fprintf(stderr, "gc: %zu bytes promoted, %zu bytes collected\n",
+            stats.bytes_promoted, stats.bytes_collected);
+    fprintf(stderr, "gc: %.3f ms total pause, %.3f ms max pause\n",
+            stats.total_pause_ns / 1e6, stats.max_pause_ns / 1e6);
+}
+
 int main(int argc, const char* argv[])
 {
     init_vm();
 
-    if (argc == 1)
+    const char** paths = malloc(sizeof(const char*) * argc);
+    int path_count = 0;
+    bool show_gc_stats = false;
+    bool scheduled = false;
+    int64_t slice = DEFAULT_SLICE;
+    uint64_t timeout_ns = 0;
+    const char* image = NULL;
+    const char* save_to = NULL;
+    bool emit = false;
+    const char* emit_to = NULL;
+    bool profile = false;
+    const char* profile_to = NULL;
+    for (int i = 1; i < argc; i++)
     {
-        repl();
+        if (strcmp(argv[i], "--gc-stats") == 0)
+        {
+            show_gc_stats = true;
+        }
+        else if (strcmp(argv[i], "--stats=json") == 0)
+        {
+            show_stats = true;
+        }
+        else if (strcmp(argv[i], "--no-cse") == 0)
+        {
+            cse_enabled = false;
+        }
+        else if (strcmp(argv[i], "--sched") == 0)
+        {
+            scheduled = true;
+        }
+        else if (strncmp(argv[i], "--slice=", 8) == 0)
+        {
+            slice = strtoll(argv[i] + 8, NULL, 10);
+        }
+        else if (strncmp(argv[i], "--timeout=", 10) == 0)
+        {
+            // in milliseconds
+            timeout_ns = strtoull(argv[i] + 10, NULL, 10) * 1000000;
+        }
+        else if (strncmp(argv[i], "--image=", 8) == 0)
+        {
+            image = argv[i] + 8;
+        }
+        else if (strncmp(argv[i], "--save-image=", 13) == 0)
+        {
+            save_to = argv[i] + 13;
+        }
+        else if (strcmp(argv[i], "--emit-c") == 0)
+        {
+            emit = true;
+        }
+        else if (strncmp(argv[i], "--emit-c=", 9) == 0)
+        {
+            emit = true;
+            emit_to = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            profile = true;
+        }
+        else if (strncmp(argv[i], "--profile=", 10) == 0)
+        {
+            profile = true;
+            profile_to = argv[i] + 10;
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            trace_enable(&vm.tracer, NULL);
+        }
+        else if (strncmp(argv[i], "--trace=", 8) == 0)
+        {
+            trace_enable(&vm.tracer, argv[i] + 8);
+        }
+        else if (strcmp(argv[i], "--decode-trace") == 0 && i + 1 < argc)
+        {
+            // nothing runs, the trace is just printed
+            bool ok = trace_decode(argv[i + 1]);
+            free_vm();
+            return ok ? 0 : 74;
+        }
+        else if (path_count == 0 || scheduled)
+        {
+            paths[path_count++] = argv[i];
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Usage: clox [--gc-stats] [--stats=json] [--no-cse]\n"
+                    "            [--trace[=file]] [--profile[=file]]\n"
+                    "            [--image=file] [--save-image=file] [path | -]\n"
+                    "       clox --sched [--slice=n] [--timeout=ms] paths...\n"
+                    "       clox --emit-c[=file.c] path\n"
+                    "       clox --decode-trace file\n");
+            exit(64);
+        }
     }
-    else if (argc == 2)
+
+    // the scheduled scripts each get a fresh vm, the image is for this one
+    if (image != NULL && !scheduled && !load_image(image))
     {
-        run_file(argv[1]);
+        free_vm();
+        exit(74);
     }
-    else
+
+    // scheduled scripts all run as vm.script, so they can't be told apart
+    const char* script =
+        scheduled ? "script" : path_count > 0 ? paths[0] : "repl";
+    if (profile && !emit && !profile_enable(profile_to, script))
     {
-        fprintf(stderr, "Usage: clox [path]\n");
+        free_vm();
         exit(64);
     }
 
+    if (emit && path_count > 0)
+    {
+        emit_file(paths[0], emit_to);
+    }
+    else if (scheduled)
+    {
+        run_scheduled(paths, path_count, slice, timeout_ns);
+        profile_dump();
+    }
+    else if (path_count == 0)
+    {
+        repl();
+        profile_dump();
+    }
+    else
+    {
+        run_file(paths[0]);
+    }
+    free(paths);
+
+    if (save_to != NULL && !save_image(save_to))
+    {
+        free_vm();
+        exit(74);
+    }
+
+    if (show_gc_stats)
+    {
+        print_gc_stats();
+    }
+
+    free_profiler();
     free_vm();
     return 0;
 }
\ No newline at end of file
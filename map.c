@@ -0,0 +1,236 @@
+#include <math.h>
+#include <string.h>
+
+#include "common.h"
+#include "map.h"
+#include "memory.h"
+#include "vm.h"
+
+#ifdef HAVE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// murmur3's finalizer: ints next to each other end up in different groups
+static uint32_t hash_bits(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+// keys that are equal (see values_equal) have to hash the same, so a whole
+// double hashes as the int
+static uint32_t hash_key(Value key)
+{
+    switch (key.type)
+    {
+    case VAL_BOOL:
+        return hash_bits(AS_BOOL(key) ? 0x101 : 0x100);
+    case VAL_NIL:
+        return hash_bits(0x102);
+    case VAL_INT:
+        return hash_bits((uint64_t)AS_INT(key));
+    case VAL_NUMBER:
+    {
+        double number = AS_NUM(key);
+        if (number >= -9223372036854775808.0 &&
+            number < 9223372036854775808.0 &&
+            number == (double)(int64_t)number)
+        {
+            return hash_bits((uint64_t)(int64_t)number);
+        }
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return hash_bits(bits);
+    }
+    case VAL_SHORT_STR:
+        return hash_string(key.as.short_str, SHORT_STR_LENGTH(key));
+    default:
+        // a heap string, it was hashed when it was made
+        return AS_STRING(key)->hash;
+    }
+}
+
+// anything hash_key() can do. a NaN is never equal to itself, so it could
+// never be found again
+static bool is_key(Value key)
+{
+    if (IS_NUM(key))
+    {
+        return !isnan(AS_NUM(key));
+    }
+    return IS_INT(key) || IS_STRING(key) || IS_BOOL(key) || IS_NIL(key);
+}
+
+// the top 7 bits, the low ones pick the group
+static uint8_t hash_tag(uint32_t hash)
+{
+    return (uint8_t)(hash >> 25);
+}
+
+// a bit for each slot in the group whose control byte is `tag`
+static uint32_t match_tag(const uint8_t* group, uint8_t tag)
+{
+#ifdef HAVE_SSE2
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    __m128i tags = _mm_set1_epi8((char)tag);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, tags));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < MAP_GROUP; i++)
+    {
+        bits |= (uint32_t)(group[i] == tag) << i;
+    }
+    return bits;
+#endif
+}
+
+// MAP_EMPTY is the only control byte with the high bit set
+static uint32_t match_empty(const uint8_t* group)
+{
+#ifdef HAVE_SSE2
+    return (uint32_t)_mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i*)group));
+#else
+    return match_tag(group, MAP_EMPTY);
+#endif
+}
+
+// `bits` isn't 0
+static int lowest_bit(uint32_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(bits);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    int index = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+// the slot `key` is in, or -1 and the first empty slot it would go in
+static int find_slot(ObjMap* map, Value key, uint32_t hash, int* empty)
+{
+    uint8_t tag = hash_tag(hash);
+    uint32_t group_mask = (uint32_t)(map->capacity / MAP_GROUP) - 1;
+    uint32_t group = hash & group_mask;
+
+    // +1, +2, +3...: with a power of 2 groups, that gets to every one
+    for (uint32_t step = 1;; step++)
+    {
+        int first = (int)group * MAP_GROUP;
+        const uint8_t* ctrl = MAP_CTRL(map) + first;
+        for (uint32_t matches = match_tag(ctrl, tag); matches != 0;
+             matches &= matches - 1)
+        {
+            int slot = first + lowest_bit(matches);
+            if (values_equal(map->entries[slot].key, key))
+            {
+                return slot;
+            }
+        }
+
+        // nothing gets deleted, so a key would have gone here
+        uint32_t empties = match_empty(ctrl);
+        if (empties != 0)
+        {
+            *empty = first + lowest_bit(empties);
+            return -1;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+ObjMap* allocate_map(int count)
+{
+    int capacity = MAP_GROUP;
+    while (capacity - capacity / 8 < count)
+    {
+        capacity *= 2;
+    }
+    return new_map(capacity);
+}
+
+bool check_map_key(Value key)
+{
+    if (!is_key(key))
+    {
+        runtime_err(IS_NUM(key)
+                        ? "A map key can't be NaN."
+                        : "Map keys must be numbers, strings, bools or nil.");
+        return false;
+    }
+    return true;
+}
+
+void map_insert(ObjMap* map, Value key, Value value)
+{
+    uint32_t hash = hash_key(key);
+    int empty;
+    int slot = find_slot(map, key, hash, &empty);
+    if (slot == -1)
+    {
+        slot = empty;
+        MAP_CTRL(map)[slot] = hash_tag(hash);
+        map->entries[slot].key = key;
+        WRITE_BARRIER(&map->obj, key);
+        map->count++;
+    }
+
+    map->entries[slot].value = value;
+    WRITE_BARRIER(&map->obj, value);
+}
+
+bool make_map(int count)
+{
+    Value* pairs = vm.stack_top - 2 * count;
+    for (int i = 0; i < count; i++)
+    {
+        if (!check_map_key(pairs[2 * i]))
+        {
+            return false;
+        }
+    }
+
+    // the gc may move the keys and values, but they stay in the same slots
+    ObjMap* map = allocate_map(count);
+    for (int i = 0; i < count; i++)
+    {
+        map_insert(map, pairs[2 * i], pairs[2 * i + 1]);
+    }
+
+    vm.stack_top = pairs;
+    *vm.stack_top++ = OBJ_VAL(map);
+    return true;
+}
+
+bool map_get(ObjMap* map, Value key, Value* value)
+{
+    if (!is_key(key))
+    {
+        return false;
+    }
+
+    int empty;
+    int slot = find_slot(map, key, hash_key(key), &empty);
+    if (slot == -1)
+    {
+        return false;
+    }
+    *value = map->entries[slot].value;
+    return true;
+}
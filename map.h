@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+// maps are swiss tables: open addressing, with a control byte per slot that
+// holds 7 bits of the key's hash. a lookup compares the bytes of a whole group
+// (MAP_GROUP slots) at once, with SSE2, and only looks at the keys whose byte
+// matched. the groups are probed in triangular order, and a map is at most 7/8
+// full, so there's always an empty slot to stop at.
+//
+// keys are numbers (1 and 1.0 are the same key), strings, bools and nil. a heap
+// string keeps its hash, so only short strings and numbers get hashed
+
+// replaces the `count` key, value pairs on top of the stack with a map of
+// them, a later key wins. false (after reporting it) if a key can't be one
+bool make_map(int count);
+
+// an empty map with room for `count` keys, filled in with map_insert()
+ObjMap* allocate_map(int count);
+// false (after reporting it) if `key` can't be a map key
+bool check_map_key(Value key);
+// only while the map is being made. the key must be valid, and there has to be
+// room for it
+void map_insert(ObjMap* map, Value key, Value value);
+
+// false if it isn't there
+bool map_get(ObjMap* map, Value key, Value* value);
@@ -1,6 +1,22 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "compiler.h"
 #include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "timer.h"
+#include "vm.h"
+
+#ifdef DEBUG_LOG_GC
+#include <stdio.h>
+#endif
+
+// every nursery object starts on an 8 byte boundary
+#define ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// minor collections move objects, major ones mark and sweep
+static bool collecting_major = false;
 
 void* reallocate(void* pointer, size_t old_size, size_t new_size)
 {
@@ -18,3 +34,440 @@ void* reallocate(void* pointer, size_t old_size, size_t new_size)
 
     return result;
 }
+
+void init_heap(Heap* heap)
+{
+    heap->nursery = ALLOCATE(uint8_t, NURSERY_SIZE);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_end = heap->nursery + NURSERY_SIZE;
+
+    heap->old_bytes = 0;
+    heap->next_major = FIRST_MAJOR_GC;
+    heap->paused = false;
+
+    heap->remembered = NULL;
+    heap->remembered_count = 0;
+    heap->remembered_capacity = 0;
+
+    heap->gray = NULL;
+    heap->gray_count = 0;
+    heap->gray_capacity = 0;
+
+    memset(&heap->stats, 0, sizeof(GCStats));
+}
+
+void free_heap(Heap* heap)
+{
+    FREE_ARRAY(uint8_t, heap->nursery, NURSERY_SIZE);
+    FREE_ARRAY(Obj*, heap->remembered, heap->remembered_capacity);
+    FREE_ARRAY(Obj*, heap->gray, heap->gray_capacity);
+    heap->nursery = heap->nursery_top = heap->nursery_end = NULL;
+    heap->remembered = heap->gray = NULL;
+    heap->remembered_capacity = heap->gray_capacity = 0;
+}
+
+size_t object_size(Obj* object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+        return sizeof(ObjString) + ((ObjString*)object)->length + 1;
+    case OBJ_ARRAY:
+    {
+        ObjArray* array = (ObjArray*)object;
+        size_t element = array->numeric ? sizeof(double) : sizeof(Value);
+        return sizeof(ObjArray) + element * array->count;
+    }
+    case OBJ_MAP:
+        return sizeof(ObjMap) +
+               (sizeof(MapEntry) + 1) * (size_t)((ObjMap*)object)->capacity;
+    }
+
+    return 0; // unreachable
+}
+
+static Obj* allocate_old(size_t size)
+{
+    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    object->gen = GEN_OLD;
+
+    object->next = vm.objects;
+    vm.objects = object;
+    vm.heap.old_bytes += size;
+    return object;
+}
+
+Obj* allocate_object(size_t size, ObjType type)
+{
+#ifdef DEBUG_STRESS_GC
+    collect_garbage(true);
+#endif
+
+    Obj* object;
+    if (size > NURSERY_MAX_OBJECT)
+    {
+        if (vm.heap.old_bytes + size > vm.heap.next_major)
+        {
+            collect_garbage(true);
+        }
+        object = allocate_old(size);
+    }
+    else
+    {
+        size_t aligned = ALIGN(size);
+        if (vm.heap.nursery_top + aligned > vm.heap.nursery_end)
+        {
+            collect_garbage(false);
+        }
+
+        if (vm.heap.nursery_top + aligned > vm.heap.nursery_end)
+        {
+            // still full, the collector is paused
+            object = allocate_old(size);
+        }
+        else
+        {
+            // the fast path: bump a pointer
+            object = (Obj*)vm.heap.nursery_top;
+            vm.heap.nursery_top += aligned;
+            object->gen = GEN_NURSERY;
+            object->next = NULL;
+        }
+    }
+
+    object->type = type;
+    object->marked = false;
+    object->remembered = false;
+    return object;
+}
+
+static void push_gray(Obj* object)
+{
+    Heap* heap = &vm.heap;
+    if (heap->gray_capacity < heap->gray_count + 1)
+    {
+        int old_capacity = heap->gray_capacity;
+        heap->gray_capacity = GROW_CAPACITY(old_capacity);
+        heap->gray =
+            GROW_ARRAY(Obj*, heap->gray, old_capacity, heap->gray_capacity);
+    }
+
+    heap->gray[heap->gray_count++] = object;
+}
+
+void gc_remember(Obj* object)
+{
+    Heap* heap = &vm.heap;
+    if (heap->remembered_capacity < heap->remembered_count + 1)
+    {
+        int old_capacity = heap->remembered_capacity;
+        heap->remembered_capacity = GROW_CAPACITY(old_capacity);
+        heap->remembered = GROW_ARRAY(Obj*, heap->remembered, old_capacity,
+                                      heap->remembered_capacity);
+    }
+
+    object->remembered = true;
+    heap->remembered[heap->remembered_count++] = object;
+}
+
+// copies a nursery object into the old space, leaving a forwarding pointer
+// behind so every other reference to it ends up at the same copy
+static Obj* evacuate(Obj* object)
+{
+    if (object->gen == GEN_FORWARDED)
+    {
+        return object->next;
+    }
+
+    size_t size = object_size(object);
+    Obj* copy = allocate_old(size);
+    Obj* next = copy->next;
+    memcpy(copy, object, size);
+    copy->next = next;
+    copy->gen = GEN_OLD;
+
+    object->gen = GEN_FORWARDED;
+    object->next = copy;
+
+    vm.heap.stats.bytes_promoted += size;
+    // its children still point into the nursery
+    push_gray(copy);
+    return copy;
+}
+
+void gc_visit_obj(Obj** slot)
+{
+    Obj* object = *slot;
+    if (object == NULL)
+    {
+        return;
+    }
+
+    if (!collecting_major)
+    {
+        // old objects stay where they are during a minor collection
+        if (object->gen == GEN_NURSERY || object->gen == GEN_FORWARDED)
+        {
+            *slot = evacuate(object);
+        }
+        return;
+    }
+
+    // image objects aren't in vm.objects, so they're never swept
+    if (object->marked || object->gen == GEN_IMAGE)
+    {
+        return;
+    }
+
+    object->marked = true;
+    push_gray(object);
+}
+
+void gc_visit_value(Value* slot)
+{
+    if (IS_OBJ(*slot))
+    {
+        gc_visit_obj(&slot->as.obj);
+    }
+}
+
+bool gc_is_alive(Obj** slot)
+{
+    Obj* object = *slot;
+    if (object->gen == GEN_FORWARDED)
+    {
+        *slot = object->next;
+        return true;
+    }
+
+    // anything still in the nursery after evacuating is garbage
+    if (object->gen == GEN_NURSERY)
+    {
+        return false;
+    }
+    if (object->gen == GEN_IMAGE)
+    {
+        return true;
+    }
+
+    return !collecting_major || object->marked;
+}
+
+static void blacken_object(Obj* object)
+{
+    switch (object->type)
+    {
+    case OBJ_STRING:
+        // no references
+        break;
+    case OBJ_ARRAY:
+    {
+        ObjArray* array = (ObjArray*)object;
+        if (!array->numeric)
+        {
+            for (int i = 0; i < array->count; i++)
+            {
+                gc_visit_value(&array->values[i]);
+            }
+        }
+        break;
+    }
+    case OBJ_MAP:
+    {
+        ObjMap* map = (ObjMap*)object;
+        for (int i = 0; i < map->capacity; i++)
+        {
+            if (MAP_CTRL(map)[i] != MAP_EMPTY)
+            {
+                gc_visit_value(&map->entries[i].key);
+                gc_visit_value(&map->entries[i].value);
+            }
+        }
+        break;
+    }
+    }
+}
+
+static void trace_references()
+{
+    while (vm.heap.gray_count > 0)
+    {
+        blacken_object(vm.heap.gray[--vm.heap.gray_count]);
+    }
+}
+
+static void visit_chunk(Chunk* chunk)
+{
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        gc_visit_value(&chunk->constants.values[i]);
+    }
+}
+
+static void visit_roots()
+{
+    for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
+    {
+        gc_visit_value(slot);
+    }
+
+    if (vm.chunk != NULL)
+    {
+        visit_chunk(vm.chunk);
+    }
+    // the importers of the running module
+    for (int i = 0; i < vm.frame_count; i++)
+    {
+        visit_chunk(vm.frames[i].chunk);
+    }
+
+    for (int i = 0; i < vm.module_count; i++)
+    {
+        gc_visit_obj((Obj**)&vm.modules[i]->path);
+        visit_chunk(&vm.modules[i]->chunk);
+    }
+    mark_table(&vm.module_names);
+
+    for (int i = 0; i < vm.globals.count; i++)
+    {
+        gc_visit_value(&vm.globals.values[i]);
+    }
+    mark_table(&vm.global_names);
+
+    mark_compiler_roots();
+}
+
+static void minor_collection()
+{
+    Heap* heap = &vm.heap;
+    size_t used = heap->nursery_top - heap->nursery;
+    size_t promoted = heap->stats.bytes_promoted;
+
+    visit_roots();
+
+    // old objects that were written to since the last collection
+    for (int i = 0; i < heap->remembered_count; i++)
+    {
+        heap->remembered[i]->remembered = false;
+        blacken_object(heap->remembered[i]);
+    }
+    heap->remembered_count = 0;
+
+    trace_references();
+
+    // interned strings are weak, they don't keep strings alive
+    table_remove_dead(&vm.strings);
+
+    // everything left behind in the nursery is dead
+    promoted = heap->stats.bytes_promoted - promoted;
+    heap->stats.bytes_collected += used > promoted ? used - promoted : 0;
+    heap->nursery_top = heap->nursery;
+    heap->stats.minor_collections++;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc minor: %zu bytes in nursery, %zu promoted\n", used,
+           promoted);
+#endif
+}
+
+static void sweep()
+{
+    Obj* prev = NULL;
+    Obj* object = vm.objects;
+    while (object != NULL)
+    {
+        if (object->marked)
+        {
+            object->marked = false;
+            prev = object;
+            object = object->next;
+            continue;
+        }
+
+        Obj* unreached = object;
+        object = object->next;
+        if (prev != NULL)
+        {
+            prev->next = object;
+        }
+        else
+        {
+            vm.objects = object;
+        }
+
+        size_t size = object_size(unreached);
+        vm.heap.old_bytes -= size;
+        vm.heap.stats.bytes_collected += size;
+        reallocate(unreached, size, 0);
+    }
+}
+
+static void major_collection()
+{
+    Heap* heap = &vm.heap;
+#ifdef DEBUG_LOG_GC
+    size_t before = heap->old_bytes;
+#endif
+
+    collecting_major = true;
+    visit_roots();
+    trace_references();
+    table_remove_dead(&vm.strings);
+    sweep();
+    collecting_major = false;
+
+    heap->next_major = heap->old_bytes * HEAP_GROW_FACTOR;
+    if (heap->next_major < FIRST_MAJOR_GC)
+    {
+        heap->next_major = FIRST_MAJOR_GC;
+    }
+    heap->stats.major_collections++;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc major: %zu -> %zu bytes, next at %zu\n", before,
+           heap->old_bytes, heap->next_major);
+#endif
+}
+
+// a major collection always starts with a minor one, so it only ever has to
+// deal with the old space
+void collect_garbage(bool major)
+{
+    if (vm.heap.paused)
+    {
+        return;
+    }
+
+    uint64_t start = now_ns();
+
+    minor_collection();
+    if (major || vm.heap.old_bytes > vm.heap.next_major)
+    {
+        major_collection();
+    }
+
+    uint64_t pause = now_ns() - start;
+    vm.heap.stats.total_pause_ns += pause;
+    if (pause > vm.heap.stats.max_pause_ns)
+    {
+        vm.heap.stats.max_pause_ns = pause;
+    }
+}
+
+GCStats gc_stats()
+{
+    return vm.heap.stats;
+}
+
+void free_objects()
+{
+    Obj* object = vm.objects;
+    while (object != NULL)
+    {
+        Obj* next = object->next;
+        reallocate(object, object_size(object), 0);
+        object = next;
+    }
+    vm.objects = NULL;
+    vm.heap.old_bytes = 0;
+}
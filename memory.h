@@ -1,10 +1,17 @@
 #pragma once
 
 #include "common.h"
+#include "object.h"
+#include "value.h"
 
 // 4 comes from rust's vector number
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
+#define ALLOCATE(type, count)                                                  \
+    (type*)reallocate(NULL, 0, sizeof(type) * (count))
+
+#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+
 #define GROW_ARRAY(type, pointer, old_count, new_count)                        \
     (type*)reallocate(pointer, sizeof(type) * (old_count),                     \
                       sizeof(type) * (new_count))
@@ -12,4 +19,88 @@
 #define FREE_ARRAY(type, pointer, old_count)                                   \
     (type*)reallocate(pointer, sizeof(type) * (old_count), 0)
 
-void* reallocate(void* pointer, size_t old_size, size_t new_size);
\ No newline at end of file
+// must be used whenever a reference is stored *into a heap object* (not the
+// stack or globals, those are scanned every collection): an old object that
+// points into the nursery has to be found by the next minor collection
+#define WRITE_BARRIER(owner, value)                                            \
+    do                                                                         \
+    {                                                                          \
+        if (IS_OBJ(value) && (owner)->gen == GEN_OLD &&                        \
+            AS_OBJ(value)->gen == GEN_NURSERY && !(owner)->remembered)         \
+        {                                                                      \
+            gc_remember(owner);                                                \
+        }                                                                      \
+    } while (false)
+
+// new objects are bump allocated here, it's emptied by every minor collection
+#define NURSERY_SIZE (256 * 1024)
+// anything bigger goes straight to the old space
+#define NURSERY_MAX_OBJECT (NURSERY_SIZE / 8)
+// first major collection once the old space is this big
+#define FIRST_MAJOR_GC (1024 * 1024)
+#define HEAP_GROW_FACTOR 2
+
+typedef struct GCStats
+{
+    int minor_collections;
+    int major_collections;
+    // nursery survivors copied to the old space
+    size_t bytes_promoted;
+    // dead nursery objects + old objects swept
+    size_t bytes_collected;
+
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+} GCStats;
+
+typedef struct Heap
+{
+    uint8_t* nursery;
+    uint8_t* nursery_top;
+    uint8_t* nursery_end;
+
+    // bytes in the old space (vm.objects)
+    size_t old_bytes;
+    size_t next_major;
+
+    // old objects that may point into the nursery (see WRITE_BARRIER)
+    Obj** remembered;
+    int remembered_count;
+    int remembered_capacity;
+
+    // objects whose children haven't been visited yet
+    Obj** gray;
+    int gray_count;
+    int gray_capacity;
+
+    GCStats stats;
+
+    // set while something holds references the collector can't see
+    bool paused;
+} Heap;
+
+void* reallocate(void* pointer, size_t old_size, size_t new_size);
+
+void init_heap(Heap* heap);
+void free_heap(Heap* heap);
+
+// allocates a new object of `size` bytes, may collect first
+Obj* allocate_object(size_t size, ObjType type);
+// how many bytes the object takes up, header included
+size_t object_size(Obj* object);
+
+void collect_garbage(bool major);
+void gc_remember(Obj* object);
+
+// used when enumerating roots: every reference the collector is told about
+// may be updated, since minor collections move objects
+void gc_visit_value(Value* slot);
+void gc_visit_obj(Obj** slot);
+// for weak references: false if the object is dead, otherwise the slot
+// is updated in case the object was moved
+bool gc_is_alive(Obj** slot);
+
+GCStats gc_stats();
+
+// frees the old space, the nursery is freed with the heap
+void free_objects();
@@ -0,0 +1,227 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#define _CRT_NONSTDC_NO_DEPRECATE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "compiler.h"
+#include "memory.h"
+#include "module.h"
+#include "serialize.h"
+#include "verify.h"
+
+#define CACHE_MAGIC 0x43584c43 // "CLXC"
+
+// written at the start of every cache file
+typedef struct CacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    // the cache is trusted without reading the source if these match
+    int64_t source_mtime;
+    int64_t source_size;
+    // otherwise the source is read, and the cache is still used if it hashes
+    // to the same thing (e.g. the file was only touched)
+    uint64_t source_hash;
+} CacheHeader;
+
+// FNV-1a, 64 bit
+static uint64_t hash_source(const char* source, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)source[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static char* read_source(const char* path, size_t* length)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = ALLOCATE(char, file_size + 1);
+    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    buffer[bytes_read] = '\0';
+    fclose(file);
+
+    *length = bytes_read;
+    return buffer;
+}
+
+static char* cache_path(const char* path)
+{
+    size_t length = strlen(path);
+    char* cache = ALLOCATE(char, length + sizeof(MODULE_CACHE_SUFFIX));
+    memcpy(cache, path, length);
+    memcpy(cache + length, MODULE_CACHE_SUFFIX, sizeof(MODULE_CACHE_SUFFIX));
+    return cache;
+}
+
+// without check_hash only the size and mtime are compared, so the source
+// doesn't have to be read
+static bool read_cache(FILE* file, Module* module, CacheHeader* expected,
+                       bool check_hash)
+{
+    CacheHeader header;
+    rewind(file);
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CACHE_MAGIC || header.version != BYTECODE_VERSION ||
+        header.source_size != expected->source_size)
+    {
+        return false;
+    }
+
+    bool fresh = check_hash ? header.source_hash == expected->source_hash
+                            : header.source_mtime == expected->source_mtime;
+    if (!fresh)
+    {
+        return false;
+    }
+
+    if (!load_chunk(file, &module->chunk))
+    {
+        // might have been half loaded
+        free_chunk(&module->chunk);
+        return false;
+    }
+
+    // run() trusts what it's given, and a cache is just a file
+    int at;
+    if (verify_chunk(&module->chunk, &at) != NULL)
+    {
+        free_chunk(&module->chunk);
+        return false;
+    }
+    return true;
+}
+
+// rename() over a file that's there fails on windows, MoveFileEx doesn't
+static bool replace_file(const char* from, const char* to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// written next to the cache and renamed over it, so another process loading
+// the same module (or this one dying halfway) never sees half a cache. the
+// pid keeps two writers out of each other's temp file
+static void write_cache(const char* path, Module* module, CacheHeader* header)
+{
+#ifdef _WIN32
+    unsigned long pid = (unsigned long)GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    size_t length = strlen(path) + 32;
+    char* temp = ALLOCATE(char, length);
+    snprintf(temp, length, "%s.%lu.tmp", path, pid);
+
+    FILE* file = fopen(temp, "wb");
+    if (file == NULL)
+    {
+        // not being able to cache isn't an error
+        FREE_ARRAY(char, temp, length);
+        return;
+    }
+
+    bool ok = fwrite(header, sizeof(*header), 1, file) == 1 &&
+              save_chunk(file, &module->chunk);
+    // a full disk can show up as late as the flush
+    ok = fclose(file) == 0 && ok;
+
+    if (!ok || !replace_file(temp, path))
+    {
+        remove(temp);
+    }
+    FREE_ARRAY(char, temp, length);
+}
+
+bool load_module(Module* module)
+{
+    const char* path = module->path->chars;
+
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        fprintf(stderr, "Could not open module \"%s\".\n", path);
+        return false;
+    }
+
+    CacheHeader header;
+    header.magic = CACHE_MAGIC;
+    header.version = BYTECODE_VERSION;
+    header.source_mtime = (int64_t)st.st_mtime;
+    header.source_size = (int64_t)st.st_size;
+    header.source_hash = 0;
+
+    char* cache = cache_path(path);
+    FILE* cache_file = fopen(cache, "rb");
+
+    // fast path: the source hasn't been modified, don't even read it
+    if (cache_file != NULL && read_cache(cache_file, module, &header, false))
+    {
+        fclose(cache_file);
+        FREE_ARRAY(char, cache, strlen(cache) + 1);
+        return true;
+    }
+
+    size_t length;
+    char* source = read_source(path, &length);
+    if (source == NULL)
+    {
+        if (cache_file != NULL)
+        {
+            fclose(cache_file);
+        }
+        FREE_ARRAY(char, cache, strlen(cache) + 1);
+        fprintf(stderr, "Could not read module \"%s\".\n", path);
+        return false;
+    }
+    header.source_hash = hash_source(source, length);
+
+    bool ok;
+    if (cache_file != NULL && read_cache(cache_file, module, &header, true))
+    {
+        fclose(cache_file);
+        // only the mtime changed, so record the new one
+        write_cache(cache, module, &header);
+        ok = true;
+    }
+    else
+    {
+        if (cache_file != NULL)
+        {
+            fclose(cache_file);
+        }
+
+        ok = compile(source, &module->chunk);
+        if (ok)
+        {
+            write_cache(cache, module, &header);
+        }
+    }
+
+    FREE_ARRAY(char, source, length + 1);
+    FREE_ARRAY(char, cache, strlen(cache) + 1);
+    return ok;
+}
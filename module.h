@@ -0,0 +1,21 @@
+#pragma once
+
+#include "chunk.h"
+#include "object.h"
+
+// the extension added to a module's path for its compiled cache file
+#define MODULE_CACHE_SUFFIX "c"
+
+// a module is compiled once per vm, and its bytecode is cached on disk
+typedef struct Module
+{
+    ObjString* path;
+    Chunk chunk;
+    // the module (and its chunk) is part of a mapped image, see image.h
+    bool in_image;
+} Module;
+
+// fills module->chunk, from the cache next to the source if it is still
+// valid, otherwise by compiling (and then writing the cache). errors are
+// reported, and false is returned
+bool load_module(Module* module);
@@ -0,0 +1,420 @@
+#include <math.h>
+#include <string.h>
+
+#include "array.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "trace.h"
+#include "vm.h"
+
+// integer exponents up to this size use repeated squaring instead of pow()
+#define POW_FAST_MAX 64
+
+static double powi(double base, unsigned int exp)
+{
+    double result = 1;
+    while (exp)
+    {
+        if (exp & 1)
+        {
+            result *= base;
+        }
+        base *= base;
+        exp >>= 1;
+    }
+    return result;
+}
+
+double fast_pow(double base, double exp)
+{
+    // most exponents in real code are small integers
+    if (exp == 2)
+    {
+        return base * base;
+    }
+
+    // not negative ones: 1 / powi(base, -n) overflows to inf and comes out 0
+    // where pow() still has a (tiny) answer
+    if (exp >= 0 && exp <= POW_FAST_MAX && exp == (int)exp)
+    {
+        return powi(base, (unsigned int)exp);
+    }
+
+    return pow(base, exp);
+}
+
+static bool check_nums(const char* name, int argc, Value* args)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        if (!IS_NUMERIC(args[i]))
+        {
+            runtime_err("Argument to '%s' must be a number.", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+// every unary math native is the same loop around a libm function, so the
+// function pointer is all that differs
+#define UNARY_MATH_NATIVE(name, fn)                                            \
+    static bool name##_native(int argc, Value* args, Value* result)            \
+    {                                                                          \
+        if (!check_nums(#name, argc, args))                                    \
+        {                                                                      \
+            return false;                                                      \
+        }                                                                      \
+        *result = NUM_VAL(fn(TO_NUM(args[0])));                                \
+        return true;                                                           \
+    }
+
+UNARY_MATH_NATIVE(sqrt, sqrt)
+UNARY_MATH_NATIVE(exp, exp)
+UNARY_MATH_NATIVE(log, log)
+UNARY_MATH_NATIVE(sin, sin)
+
+#undef UNARY_MATH_NATIVE
+
+// an int is already whole
+static bool floor_native(int argc, Value* args, Value* result)
+{
+    if (!check_nums("floor", argc, args))
+    {
+        return false;
+    }
+
+    *result = IS_INT(args[0]) ? args[0] : NUM_VAL(floor(AS_NUM(args[0])));
+    return true;
+}
+
+static bool abs_native(int argc, Value* args, Value* result)
+{
+    if (!check_nums("abs", argc, args))
+    {
+        return false;
+    }
+
+    Value n = args[0];
+    if (IS_INT(n) && AS_INT(n) != INT64_MIN)
+    {
+        *result = INT_VAL(AS_INT(n) < 0 ? -AS_INT(n) : AS_INT(n));
+    }
+    else
+    {
+        *result = NUM_VAL(fabs(TO_NUM(n)));
+    }
+    return true;
+}
+
+// min/max of a single array reduce it instead
+static bool reduce_array(const char* name, Value array, Value* result,
+                         double (*reduce)(ObjArray* array))
+{
+    if (!AS_ARRAY(array)->numeric)
+    {
+        runtime_err("Argument to '%s' must be a number.", name);
+        return false;
+    }
+    if (AS_ARRAY(array)->count == 0)
+    {
+        runtime_err("Can't take the %s of an empty array.", name);
+        return false;
+    }
+
+    *result = NUM_VAL(reduce(AS_ARRAY(array)));
+    return true;
+}
+
+static bool min_native(int argc, Value* args, Value* result)
+{
+    if (argc == 1 && IS_ARRAY(args[0]))
+    {
+        return reduce_array("min", args[0], result, array_min);
+    }
+    if (!check_nums("min", argc, args))
+    {
+        return false;
+    }
+
+    // the smallest argument itself, so ints stay ints
+    *result = args[0];
+    for (int i = 1; i < argc; i++)
+    {
+        if (TO_NUM(args[i]) < TO_NUM(*result))
+        {
+            *result = args[i];
+        }
+    }
+    return true;
+}
+
+static bool max_native(int argc, Value* args, Value* result)
+{
+    if (argc == 1 && IS_ARRAY(args[0]))
+    {
+        return reduce_array("max", args[0], result, array_max);
+    }
+    if (!check_nums("max", argc, args))
+    {
+        return false;
+    }
+
+    *result = args[0];
+    for (int i = 1; i < argc; i++)
+    {
+        if (TO_NUM(args[i]) > TO_NUM(*result))
+        {
+            *result = args[i];
+        }
+    }
+    return true;
+}
+
+static bool sum_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    if (!IS_ARRAY(args[0]) || !AS_ARRAY(args[0])->numeric)
+    {
+        runtime_err("Argument to 'sum' must be an array of numbers.");
+        return false;
+    }
+
+    *result = NUM_VAL(array_sum(AS_ARRAY(args[0])));
+    return true;
+}
+
+// `!` element by element, for an array of bools from a comparison
+static bool not_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    if (!IS_ARRAY(args[0]))
+    {
+        runtime_err("Argument to 'not' must be an array.");
+        return false;
+    }
+
+    array_not(&args[0]);
+    *result = args[0];
+    return true;
+}
+
+static bool len_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    if (IS_ARRAY(args[0]))
+    {
+        *result = INT_VAL(AS_ARRAY(args[0])->count);
+    }
+    else if (IS_MAP(args[0]))
+    {
+        *result = INT_VAL(AS_MAP(args[0])->count);
+    }
+    else if (IS_STRING(args[0]))
+    {
+        *result = INT_VAL(STRING_LENGTH(args[0]));
+    }
+    else
+    {
+        runtime_err("Argument to 'len' must be an array, a map or a string.");
+        return false;
+    }
+    return true;
+}
+
+// range(end) or range(start, end): the ints start .. end - 1, as a numeric
+// array. literals only go up to 255 elements, this is how to get a big one
+static bool range_native(int argc, Value* args, Value* result)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        if (!IS_INT(args[i]))
+        {
+            runtime_err("Arguments to 'range' must be integers.");
+            return false;
+        }
+    }
+
+    int64_t start = argc == 2 ? AS_INT(args[0]) : 0;
+    int64_t end = AS_INT(args[argc - 1]);
+    // unsigned, since end - start itself may not fit in an int64_t
+    if (end > start && (uint64_t)end - (uint64_t)start > ARRAY_MAX)
+    {
+        runtime_err("Array too large.");
+        return false;
+    }
+
+    int count = end > start ? (int)(end - start) : 0;
+    ObjArray* array = new_array(count, true);
+    for (int i = 0; i < count; i++)
+    {
+        ARRAY_NUMBERS(array)[i] = (double)(start + i);
+    }
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+// map(keys, values): literals only go up to 255 entries, this makes a big one
+// from two arrays. a later key wins, like in a literal
+static bool map_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    if (!IS_ARRAY(args[0]) || !IS_ARRAY(args[1]))
+    {
+        runtime_err("Arguments to 'map' must be arrays.");
+        return false;
+    }
+    ObjArray* keys = AS_ARRAY(args[0]);
+    if (keys->count != AS_ARRAY(args[1])->count)
+    {
+        runtime_err("Arrays must be the same length.");
+        return false;
+    }
+    for (int i = 0; i < keys->count; i++)
+    {
+        if (!check_map_key(array_element(keys, i)))
+        {
+            return false;
+        }
+    }
+
+    // the gc may move the arrays, args[] is kept up to date
+    ObjMap* map = allocate_map(keys->count);
+    keys = AS_ARRAY(args[0]);
+    ObjArray* values = AS_ARRAY(args[1]);
+    for (int i = 0; i < keys->count; i++)
+    {
+        map_insert(map, array_element(keys, i), array_element(values, i));
+    }
+    *result = OBJ_VAL(map);
+    return true;
+}
+
+// keys(map) / values(map) are how a map is iterated: an array of them, in the
+// order they sit in the table
+static bool map_part(const char* name, Value* args, Value* result, bool keys)
+{
+    if (!IS_MAP(args[0]))
+    {
+        runtime_err("Argument to '%s' must be a map.", name);
+        return false;
+    }
+
+    ObjMap* map = AS_MAP(args[0]);
+    bool numeric = true;
+    for (int i = 0; i < map->capacity; i++)
+    {
+        MapEntry* entry = &map->entries[i];
+        numeric &= MAP_CTRL(map)[i] == MAP_EMPTY ||
+                   IS_NUMERIC(keys ? entry->key : entry->value);
+    }
+
+    ObjArray* array = new_array(map->count, numeric);
+    map = AS_MAP(args[0]);
+    int count = 0;
+    for (int i = 0; i < map->capacity; i++)
+    {
+        if (MAP_CTRL(map)[i] == MAP_EMPTY)
+        {
+            continue;
+        }
+        Value value = keys ? map->entries[i].key : map->entries[i].value;
+        if (numeric)
+        {
+            ARRAY_NUMBERS(array)[count++] = TO_NUM(value);
+        }
+        else
+        {
+            array->values[count++] = value;
+            WRITE_BARRIER(&array->obj, value);
+        }
+    }
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+static bool keys_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    return map_part("keys", args, result, true);
+}
+
+static bool values_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    return map_part("values", args, result, false);
+}
+
+static bool has_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    if (!IS_MAP(args[0]))
+    {
+        runtime_err("First argument to 'has' must be a map.");
+        return false;
+    }
+
+    Value value;
+    *result = BOOL_VAL(map_get(AS_MAP(args[0]), args[1], &value));
+    return true;
+}
+
+// writes the trace so far (see trace.h), false if --trace wasn't passed
+static bool dump_trace_native(int argc, Value* args, Value* result)
+{
+    (void)argc;
+    (void)args;
+    *result = BOOL_VAL(vm.tracer.enabled && trace_dump(&vm.tracer));
+    return true;
+}
+
+// the index of a native is baked into the bytecode (OP_CALL_NATIVE), so only
+// ever append to this table
+const Native natives[] = {
+    {"sqrt", "math", sqrt_native, 1, 1},
+    {"exp", "math", exp_native, 1, 1},
+    {"log", "math", log_native, 1, 1},
+    {"sin", "math", sin_native, 1, 1},
+    {"floor", "math", floor_native, 1, 1},
+    {"min", "math", min_native, 1, -1},
+    {"max", "math", max_native, 1, -1},
+    {"abs", "math", abs_native, 1, 1},
+    {"dump_trace", "debug", dump_trace_native, 0, 0},
+    {"sum", "math", sum_native, 1, 1},
+    {"len", "array", len_native, 1, 1},
+    {"range", "array", range_native, 1, 2},
+    {"not", "array", not_native, 1, 1},
+    {"map", "map", map_native, 2, 2},
+    {"keys", "map", keys_native, 1, 1},
+    {"values", "map", values_native, 1, 1},
+    {"has", "map", has_native, 2, 2},
+};
+
+const int native_count = sizeof(natives) / sizeof(natives[0]);
+
+int find_native(const char* name, int length)
+{
+    for (int i = 0; i < native_count; i++)
+    {
+        if ((int)strlen(natives[i].name) == length &&
+            memcmp(natives[i].name, name, length) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool is_native_module(const char* name, int length)
+{
+    for (int i = 0; i < native_count; i++)
+    {
+        if ((int)strlen(natives[i].module) == length &&
+            memcmp(natives[i].module, name, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
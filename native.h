@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+// natives get a pointer straight into the vm stack (args[0] .. args[argc-1]),
+// nothing is copied. They write their answer to `result` and return false on a
+// runtime error (after reporting it with runtime_err).
+typedef bool (*NativeFn)(int argc, Value* args, Value* result);
+
+typedef struct Native
+{
+    const char* name;
+    // which `import` name the native belongs to
+    const char* module;
+    NativeFn function;
+
+    // checked by the compiler, the vm trusts it
+    int min_arity;
+    // -1 means any number of args
+    int max_arity;
+} Native;
+
+extern const Native natives[];
+extern const int native_count;
+
+// returns the index into `natives`, or -1 if there is no builtin called that
+// used by the compiler so calls are resolved before the program runs
+int find_native(const char* name, int length);
+
+// true if `import name;` refers to builtins (which are always available, so
+// the import does nothing)
+bool is_native_module(const char* name, int length);
+
+// `base ^ exp`, with fast paths for (small) integer exponents
+double fast_pow(double base, double exp);
@@ -0,0 +1,148 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#include <stdio.h>
+#include <string.h>
+
+#include "ngram.h"
+#include "serialize.h"
+
+// only profiling builds pay for the tables
+#ifdef PROFILE_OPCODES
+
+#define PLAIN_OPS FIRST_SUPERINSTR
+
+static uint64_t pairs[PLAIN_OPS][PLAIN_OPS];
+static uint64_t triples[PLAIN_OPS][PLAIN_OPS][PLAIN_OPS];
+
+// the last two instructions that ran, [0] is the most recent
+static Chunk* last_chunk = NULL;
+static int last_offset[2];
+static int last_op[2];
+static int history = 0;
+
+// the next instruction in the code isn't necessarily the next to run
+static bool ends_sequence(OpCode op)
+{
+    return is_jump(op) || op == OP_IMPORT || op == OP_RETURN;
+}
+
+// did `offset` run straight after the instruction `back` steps ago
+static bool follows(Chunk* chunk, int offset, int back)
+{
+    return history > back && chunk == last_chunk &&
+           !ends_sequence(last_op[back]) &&
+           last_offset[back] + instr_length(last_op[back]) == offset;
+}
+
+void count_opcode(Chunk* chunk, int offset)
+{
+    OpCode op = chunk->code[offset];
+    if (op >= PLAIN_OPS)
+    {
+        // already fused, which means this isn't a plain profiling run
+        history = 0;
+        return;
+    }
+
+    if (follows(chunk, offset, 0))
+    {
+        pairs[last_op[0]][op]++;
+        if (follows(chunk, last_offset[0], 1))
+        {
+            triples[last_op[1]][last_op[0]][op]++;
+        }
+    }
+    else
+    {
+        history = 0;
+    }
+
+    last_chunk = chunk;
+    last_offset[1] = last_offset[0];
+    last_op[1] = last_op[0];
+    last_offset[0] = offset;
+    last_op[0] = op;
+    if (history < 2)
+    {
+        history++;
+    }
+}
+
+// adds whatever is already in the file to the counts
+static void load_counts(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL)
+    {
+        return;
+    }
+
+    int version;
+    if (fscanf(file, "clox opcode profile %d", &version) != 1 ||
+        version != OPCODE_VERSION)
+    {
+        // the opcodes changed, so the old numbers are meaningless
+        fclose(file);
+        return;
+    }
+
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long count;
+        int a, b, c;
+        int fields = sscanf(line, "%llu %d %d %d", &count, &a, &b, &c);
+        if (fields < 3 || a < 0 || a >= PLAIN_OPS || b < 0 || b >= PLAIN_OPS)
+        {
+            continue;
+        }
+
+        if (fields == 3)
+        {
+            pairs[a][b] += count;
+        }
+        else if (c >= 0 && c < PLAIN_OPS)
+        {
+            triples[a][b][c] += count;
+        }
+    }
+    fclose(file);
+}
+
+bool save_opcode_profile(const char* path)
+{
+    load_counts(path);
+
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not write opcode profile \"%s\".\n", path);
+        return false;
+    }
+
+    // <count> <op> <op> [<op>], the ops are numbers from chunk.h
+    fprintf(file, "clox opcode profile %d\n", OPCODE_VERSION);
+    for (int a = 0; a < PLAIN_OPS; a++)
+    {
+        for (int b = 0; b < PLAIN_OPS; b++)
+        {
+            if (pairs[a][b] != 0)
+            {
+                fprintf(file, "%llu %d %d\n", (unsigned long long)pairs[a][b],
+                        a, b);
+            }
+            for (int c = 0; c < PLAIN_OPS; c++)
+            {
+                if (triples[a][b][c] != 0)
+                {
+                    fprintf(file, "%llu %d %d %d\n",
+                            (unsigned long long)triples[a][b][c], a, b, c);
+                }
+            }
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+#endif
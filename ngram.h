@@ -0,0 +1,16 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+
+// where a PROFILE_OPCODES build adds its counts when the vm is freed
+#define OPCODE_PROFILE_PATH "clox.ngrams"
+
+// called by run() before every instruction (only in PROFILE_OPCODES builds):
+// counts the pairs and triples of plain instructions that run one after the
+// other, without jumping in between
+void count_opcode(Chunk* chunk, int offset);
+
+// adds the counts to the profile at `path` (which is created if needed), so
+// several runs make up one profile. tools/superinstr.c reads it
+bool save_opcode_profile(const char* path);
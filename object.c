@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define ALLOCATE_OBJ(type, size, obj_type)                                     \
+    (type*)allocate_object(size, obj_type)
+
+// FNV-1a
+uint32_t hash_string(const char* chars, int length)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+ObjString* intern_string(const char* chars, int length)
+{
+    uint32_t hash = hash_string(chars, length);
+    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
+    if (interned != NULL)
+    {
+        return interned;
+    }
+
+    ObjString* string = allocate_string(length);
+    string->hash = hash;
+    memcpy(string->chars, chars, length);
+
+    table_set(&vm.strings, string, 0);
+    return string;
+}
+
+ObjString* allocate_string(int length)
+{
+    ObjString* string = ALLOCATE_OBJ(
+        ObjString, sizeof(ObjString) + length + 1, OBJ_STRING);
+    string->length = length;
+    string->chars[length] = '\0';
+    return string;
+}
+
+ObjString* finish_string(ObjString* string)
+{
+    uint32_t hash = hash_string(string->chars, string->length);
+    ObjString* interned =
+        table_find_string(&vm.strings, string->chars, string->length, hash);
+    if (interned != NULL)
+    {
+        // `string` is garbage now, which costs nothing in the nursery
+        return interned;
+    }
+
+    string->hash = hash;
+    table_set(&vm.strings, string, 0);
+    return string;
+}
+
+Value copy_string(const char* chars, int length)
+{
+    if (length <= SHORT_STR_MAX)
+    {
+        Value value = SHORT_STR_VAL;
+        memcpy(value.as.short_str, chars, length);
+        value.as.short_str[SHORT_STR_MAX] = (char)length;
+        return value;
+    }
+
+    return OBJ_VAL(intern_string(chars, length));
+}
+
+ObjArray* new_array(int count, bool numeric)
+{
+    size_t element = numeric ? sizeof(double) : sizeof(Value);
+    ObjArray* array = ALLOCATE_OBJ(
+        ObjArray, sizeof(ObjArray) + element * count, OBJ_ARRAY);
+    array->count = count;
+    array->numeric = numeric;
+    return array;
+}
+
+ObjMap* new_map(int capacity)
+{
+    ObjMap* map = ALLOCATE_OBJ(
+        ObjMap, sizeof(ObjMap) + (sizeof(MapEntry) + 1) * (size_t)capacity,
+        OBJ_MAP);
+    map->count = 0;
+    map->capacity = capacity;
+    memset(MAP_CTRL(map), MAP_EMPTY, capacity);
+    return map;
+}
+
+void print_object(Value value)
+{
+    switch (OBJ_TYPE(value))
+    {
+    case OBJ_STRING:
+        printf("%s", AS_STRING(value)->chars);
+        break;
+    case OBJ_ARRAY:
+    {
+        ObjArray* array = AS_ARRAY(value);
+        printf("[");
+        for (int i = 0; i < array->count; i++)
+        {
+            printf(i == 0 ? "" : ", ");
+            print_value(array_element(array, i));
+        }
+        printf("]");
+        break;
+    }
+    case OBJ_MAP:
+    {
+        ObjMap* map = AS_MAP(value);
+        bool first = true;
+        printf("{");
+        for (int i = 0; i < map->capacity; i++)
+        {
+            if (MAP_CTRL(map)[i] != MAP_EMPTY)
+            {
+                printf(first ? "" : ", ");
+                print_value(map->entries[i].key);
+                printf(": ");
+                print_value(map->entries[i].value);
+                first = false;
+            }
+        }
+        printf("}");
+        break;
+    }
+    }
+}
+
+// where the next piece goes, `length` characters in
+static char* format_at(char* out, size_t length)
+{
+    return out != NULL ? out + length : NULL;
+}
+
+size_t format_object(Value value, char* out)
+{
+    size_t length = 0;
+    switch (OBJ_TYPE(value))
+    {
+    case OBJ_STRING:
+        return format_chars(AS_STRING(value)->chars, AS_STRING(value)->length,
+                            out);
+    case OBJ_ARRAY:
+    {
+        ObjArray* array = AS_ARRAY(value);
+        length += format_chars("[", 1, out);
+        for (int i = 0; i < array->count; i++)
+        {
+            if (i > 0)
+            {
+                length += format_chars(", ", 2, format_at(out, length));
+            }
+            length += format_value(array_element(array, i),
+                                   format_at(out, length));
+        }
+        length += format_chars("]", 1, format_at(out, length));
+        break;
+    }
+    case OBJ_MAP:
+    {
+        ObjMap* map = AS_MAP(value);
+        bool first = true;
+        length += format_chars("{", 1, out);
+        for (int i = 0; i < map->capacity; i++)
+        {
+            if (MAP_CTRL(map)[i] != MAP_EMPTY)
+            {
+                if (!first)
+                {
+                    length += format_chars(", ", 2, format_at(out, length));
+                }
+                length += format_value(map->entries[i].key,
+                                       format_at(out, length));
+                length += format_chars(": ", 2, format_at(out, length));
+                length += format_value(map->entries[i].value,
+                                       format_at(out, length));
+                first = false;
+            }
+        }
+        length += format_chars("}", 1, format_at(out, length));
+        break;
+    }
+    }
+    return length;
+}
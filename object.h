@@ -0,0 +1,149 @@
+#pragma once
+
+#include "common.h"
+#include "value.h"
+
+#define OBJ_TYPE(value) (AS_OBJ(value)->type)
+
+#define IS_OBJ_STRING(value) is_obj_type(value, OBJ_STRING)
+// either kind of string, short (inline) or interned (heap)
+#define IS_STRING(value) (IS_SHORT_STR(value) || IS_OBJ_STRING(value))
+
+#define AS_STRING(value) ((ObjString*)AS_OBJ(value))
+
+#define IS_ARRAY(value) is_obj_type(value, OBJ_ARRAY)
+#define AS_ARRAY(value) ((ObjArray*)AS_OBJ(value))
+// the elements of a numeric array, see ObjArray
+#define ARRAY_NUMBERS(array) ((double*)(array)->values)
+
+#define IS_MAP(value) is_obj_type(value, OBJ_MAP)
+#define AS_MAP(value) ((ObjMap*)AS_OBJ(value))
+// one per slot, after the entries (see ObjMap)
+#define MAP_CTRL(map) ((uint8_t*)((map)->entries + (map)->capacity))
+// the control byte of a slot nothing is in
+#define MAP_EMPTY 0x80
+// slots are probed this many at a time, the capacity is a multiple of it
+#define MAP_GROUP 16
+
+// only valid for as long as `value` (must be an lvalue) is alive, since short
+// strings keep their characters inside the Value itself
+#define STRING_CHARS(value)                                                    \
+    (IS_SHORT_STR(value) ? (value).as.short_str : AS_STRING(value)->chars)
+#define STRING_LENGTH(value)                                                   \
+    (IS_SHORT_STR(value) ? SHORT_STR_LENGTH(value) : AS_STRING(value)->length)
+
+typedef enum ObjType
+{
+    OBJ_STRING,
+    OBJ_ARRAY,
+    OBJ_MAP,
+} ObjType;
+
+typedef enum Generation
+{
+    GEN_NURSERY,
+    GEN_OLD,
+    // a nursery object that has been copied out, `next` is the new address
+    GEN_FORWARDED,
+    // lives in a mapped image (image.h): never moved, marked or freed
+    GEN_IMAGE,
+} Generation;
+
+// every heap value starts with this, so an ObjString* can be cast to Obj*
+struct Obj
+{
+    ObjType type;
+    // Generation
+    uint8_t gen;
+    // reached by the current major collection
+    bool marked;
+    // already in heap.remembered
+    bool remembered;
+
+    // old objects: intrusive list of the old space (vm.objects)
+    // forwarded objects: where the object was moved to
+    struct Obj* next;
+};
+
+// always interned: two ObjStrings with the same characters are the same
+// pointer
+struct ObjString
+{
+    Obj obj;
+    int length;
+    // computed once, when the string is created
+    uint32_t hash;
+    // NUL terminated, allocated together with the header
+    char chars[];
+};
+
+// the most elements an array can have
+#define ARRAY_MAX (16 * 1024 * 1024)
+
+// never changed once it's filled in: the operators make new ones, so like
+// strings they can be shared freely
+struct ObjArray
+{
+    Obj obj;
+    int count;
+    // every element is a number, and they're kept as plain doubles (ints
+    // too), one after the other, for the element-wise ops. otherwise they're
+    // Values
+    bool numeric;
+    // allocated together with the header, as double[count] if numeric
+    Value values[];
+};
+
+typedef struct MapEntry
+{
+    Value key;
+    Value value;
+} MapEntry;
+
+// a swiss table (see map.h), and like arrays it's never changed once it's
+// filled in
+struct ObjMap
+{
+    Obj obj;
+    int count;
+    // a power of 2
+    int capacity;
+    // allocated together with the header: MapEntry[capacity], then a control
+    // byte for each slot, MAP_EMPTY or the top 7 bits of the key's hash
+    MapEntry entries[];
+};
+
+uint32_t hash_string(const char* chars, int length);
+
+// makes a string Value: short strings are stored inline, anything longer is
+// looked up in (or added to) vm.strings
+Value copy_string(const char* chars, int length);
+// always returns a heap string, even if it would fit inline
+ObjString* intern_string(const char* chars, int length);
+// for building a heap string in place: the characters are left for the caller
+// to fill in, then finish_string() interns it. nothing may allocate in between
+ObjString* allocate_string(int length);
+// the interned string with the same characters, which may be another one
+ObjString* finish_string(ObjString* string);
+
+// the elements are left for the caller to fill in, before anything else
+// can allocate. a boxed array that went straight to the old space needs
+// WRITE_BARRIER for them
+ObjArray* new_array(int count, bool numeric);
+// every slot starts out empty, map.h fills them in
+ObjMap* new_map(int capacity);
+
+void print_object(Value value);
+// format_value() for objects
+size_t format_object(Value value, char* out);
+
+static inline bool is_obj_type(Value value, ObjType type)
+{
+    return IS_OBJ(value) && AS_OBJ(value)->type == type;
+}
+
+static inline Value array_element(ObjArray* array, int index)
+{
+    return array->numeric ? NUM_VAL(ARRAY_NUMBERS(array)[index])
+                          : array->values[index];
+}
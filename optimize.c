@@ -0,0 +1,1183 @@
+#include <math.h>
+#include <string.h>
+
+#include "memory.h"
+#include "optimize.h"
+
+// jump chains are followed at most this far, in case of a cycle
+#define MAX_HOPS 16
+
+// marks every offset that some jump lands on
+static bool* find_jump_targets(Chunk* chunk)
+{
+    bool* targets = ALLOCATE(bool, chunk->count + 1);
+    memset(targets, 0, chunk->count + 1);
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        if (is_jump(chunk->code[offset]))
+        {
+            targets[jump_target(chunk, offset)] = true;
+        }
+    }
+    return targets;
+}
+
+// where the jump at `offset` ends up, skipping any jumps it lands on whose
+// outcome is already known
+static int final_target(Chunk* chunk, int offset)
+{
+    OpCode op = chunk->code[offset];
+    bool conditional = op != OP_JUMP && op != OP_LOOP;
+    int target = jump_target(chunk, offset);
+
+    for (int hops = 0; hops < MAX_HOPS; hops++)
+    {
+        OpCode next = chunk->code[target];
+        int next_target;
+
+        if (next == OP_JUMP || next == OP_LOOP)
+        {
+            next_target = jump_target(chunk, target);
+        }
+        // the condition is still on the stack and it hasn't changed, so
+        // we know which way the next jump goes
+        else if ((op == OP_JUMP_IF_FALSE && next == OP_JUMP_IF_FALSE) ||
+                 (op == OP_JUMP_IF_TRUE && next == OP_JUMP_IF_TRUE))
+        {
+            next_target = jump_target(chunk, target);
+        }
+        else if ((op == OP_JUMP_IF_FALSE && next == OP_JUMP_IF_TRUE) ||
+                 (op == OP_JUMP_IF_TRUE && next == OP_JUMP_IF_FALSE))
+        {
+            next_target = target + instr_length(next);
+        }
+        else
+        {
+            break;
+        }
+
+        // there are no backwards conditional jumps
+        if (next_target == target || (conditional && next_target <= offset))
+        {
+            break;
+        }
+        target = next_target;
+    }
+
+    return target;
+}
+
+// jump to a jump -> jump straight to where the second one goes
+static bool thread_jumps(Chunk* chunk)
+{
+    bool changed = false;
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        OpCode op = chunk->code[offset];
+        if (!is_jump(op))
+        {
+            continue;
+        }
+
+        // the two distances added up may not fit in a jump
+        int target = final_target(chunk, offset);
+        if (target == jump_target(chunk, offset) ||
+            !jump_fits(chunk, offset, target))
+        {
+            continue;
+        }
+
+        // a forward jump threaded into a loop becomes a loop and vice versa,
+        // they're the same size
+        if (op == OP_JUMP || op == OP_LOOP)
+        {
+            chunk->code[offset] = target > offset ? OP_JUMP : OP_LOOP;
+        }
+        set_jump_target(chunk, offset, target);
+        changed = true;
+    }
+    return changed;
+}
+
+// `OP_NOT, OP_POP_JUMP_IF_FALSE` -> `OP_POP_JUMP_IF_TRUE` (and the other way)
+// this comes from `if (!a)`, `while (a != b)`, `if (a >= b)` etc.
+static bool fuse_not_jumps(Chunk* chunk)
+{
+    int count = chunk->count;
+    bool* targets = find_jump_targets(chunk);
+    bool* deleted = ALLOCATE(bool, count);
+    memset(deleted, 0, count);
+    bool changed = false;
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        if (chunk->code[offset] != OP_NOT || offset + 1 >= chunk->count)
+        {
+            continue;
+        }
+
+        // if something jumps straight to the conditional jump, it skips
+        // the not, so the two can't be merged
+        uint8_t* next = &chunk->code[offset + 1];
+        if (targets[offset + 1])
+        {
+            continue;
+        }
+
+        if (*next == OP_POP_JUMP_IF_FALSE)
+        {
+            *next = OP_POP_JUMP_IF_TRUE;
+        }
+        else if (*next == OP_POP_JUMP_IF_TRUE)
+        {
+            *next = OP_POP_JUMP_IF_FALSE;
+        }
+        else
+        {
+            continue;
+        }
+
+        deleted[offset] = true;
+        changed = true;
+        // skip the jump, it's been handled
+        offset++;
+    }
+
+    if (changed)
+    {
+        remove_code(chunk, deleted);
+    }
+
+    FREE_ARRAY(bool, deleted, count);
+    FREE_ARRAY(bool, targets, count + 1);
+    return changed;
+}
+
+void remove_code(Chunk* chunk, bool* deleted)
+{
+    int count = chunk->count;
+
+    // where each old offset ends up
+    int* new_offset = ALLOCATE(int, count + 1);
+    int kept = 0;
+    for (int i = 0; i < count; i++)
+    {
+        new_offset[i] = kept;
+        if (!deleted[i])
+        {
+            kept++;
+        }
+    }
+    new_offset[count] = kept;
+
+    // the jumps have to be read before anything moves
+    int* jumps = ALLOCATE(int, count);
+    int* targets = ALLOCATE(int, count);
+    int jump_count = 0;
+    for (int offset = 0; offset < count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        if (!deleted[offset] && is_jump(chunk->code[offset]))
+        {
+            jumps[jump_count] = offset;
+            targets[jump_count] = jump_target(chunk, offset);
+            jump_count++;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!deleted[i])
+        {
+            chunk->code[new_offset[i]] = chunk->code[i];
+            chunk->lines[new_offset[i]] = chunk->lines[i];
+        }
+    }
+
+    for (int i = 0; i < jump_count; i++)
+    {
+        set_jump_target(chunk, new_offset[jumps[i]], new_offset[targets[i]]);
+    }
+
+    chunk->count = kept;
+    FREE_ARRAY(int, jumps, count);
+    FREE_ARRAY(int, targets, count);
+    FREE_ARRAY(int, new_offset, count + 1);
+}
+
+/*** common subexpressions ***/
+bool cse_enabled = true;
+
+// a value the code computes. nodes are hash-consed, so two pieces of code that
+// compute the same thing from the same inputs get the same node: the index of
+// the node is the "value number"
+typedef struct ExprNode
+{
+    uint8_t op;
+    // the operand: a constant, a local slot, a global...
+    int arg;
+    // reads of variables get a new number after any write
+    int epoch;
+    // the values it popped, deepest first, -1 for none
+    int inputs[3];
+} ExprNode;
+
+// a slot of the stack while going over a block
+typedef struct StackValue
+{
+    int value;
+    // where the code that computes it starts, -1 if it came from before the
+    // block
+    int start;
+    // that code has no effects besides pushing the value, so it can be dropped
+    bool pure;
+} StackValue;
+
+typedef struct ValueNumbering
+{
+    ExprNode* nodes;
+    int node_count;
+    int node_capacity;
+    // node indices, open addressing. nodes from before `block` count as empty
+    int* buckets;
+    int bucket_capacity;
+    int block;
+
+    StackValue* stack;
+    int depth;
+    int stack_capacity;
+    int epoch;
+} ValueNumbering;
+
+static uint32_t hash_node(ExprNode* node)
+{
+    uint32_t hash = 2166136261u;
+    int fields[6] = {node->op,        node->arg,       node->epoch,
+                     node->inputs[0], node->inputs[1], node->inputs[2]};
+    for (int i = 0; i < 6; i++)
+    {
+        hash ^= (uint32_t)fields[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static bool same_node(ExprNode* a, ExprNode* b)
+{
+    return a->op == b->op && a->arg == b->arg && a->epoch == b->epoch &&
+           a->inputs[0] == b->inputs[0] && a->inputs[1] == b->inputs[1] &&
+           a->inputs[2] == b->inputs[2];
+}
+
+static int add_node(ValueNumbering* numbering, ExprNode* node)
+{
+    if (numbering->node_capacity < numbering->node_count + 1)
+    {
+        int old_capacity = numbering->node_capacity;
+        numbering->node_capacity = GROW_CAPACITY(old_capacity);
+        numbering->nodes = GROW_ARRAY(ExprNode, numbering->nodes, old_capacity,
+                                      numbering->node_capacity);
+    }
+    numbering->nodes[numbering->node_count] = *node;
+    return numbering->node_count++;
+}
+
+// the existing node for the same value, or a new one
+static int value_number(ValueNumbering* numbering, ExprNode* node)
+{
+    int mask = numbering->bucket_capacity - 1;
+    for (int i = hash_node(node) & mask;; i = (i + 1) & mask)
+    {
+        int found = numbering->buckets[i];
+        if (found < numbering->block)
+        {
+            numbering->buckets[i] = add_node(numbering, node);
+            return numbering->buckets[i];
+        }
+        if (same_node(&numbering->nodes[found], node))
+        {
+            return found;
+        }
+    }
+}
+
+// a value nothing else can be equal to
+static int unique_value(ValueNumbering* numbering)
+{
+    ExprNode node = {0xff, numbering->node_count, 0, {-1, -1, -1}};
+    return add_node(numbering, &node);
+}
+
+static void begin_block(ValueNumbering* numbering)
+{
+    numbering->block = numbering->node_count;
+    numbering->depth = 0;
+}
+
+static StackValue pop_value(ValueNumbering* numbering)
+{
+    if (numbering->depth == 0)
+    {
+        // pushed before the block started, nothing is known about it
+        StackValue value = {unique_value(numbering), -1, false};
+        return value;
+    }
+    return numbering->stack[--numbering->depth];
+}
+
+// how many values `op` pops, and whether it computes its result from them and
+// its operand alone. -1 if the block ends here
+static int stack_inputs(OpCode op, bool* pure)
+{
+    *pure = true;
+    switch (op)
+    {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_PICK:
+        return 0;
+    case OP_NOT:
+    case OP_NEGATE:
+        return 1;
+    case OP_EQUAL:
+    case OP_GRTR:
+    case OP_LESS:
+    case OP_NOT_LESS:
+    case OP_NOT_GRTR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MULT:
+    case OP_DIV:
+    case OP_POW:
+        return 2;
+    case OP_SELECT:
+        return 3;
+
+    case OP_POP:
+    case OP_SET_LOCAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_PRINT:
+        *pure = false;
+        return 1;
+    default:
+        // jumps, imports (which run code), anything new
+        *pure = false;
+        return -1;
+    }
+}
+
+// replaces the code in [start, end) with `OP_PICK distance`
+static void pick_instead(Chunk* chunk, bool* deleted, int start, int end,
+                         int distance)
+{
+    chunk->code[start] = OP_PICK;
+    chunk->code[start + 1] = (uint8_t)distance;
+    deleted[start] = deleted[start + 1] = false;
+    for (int i = start + 2; i < end; i++)
+    {
+        // one byte instructions, so the code can still be walked until
+        // remove_code() takes them out
+        chunk->code[i] = OP_NIL;
+        deleted[i] = true;
+    }
+}
+
+// value numbering over each block (straight line code between jumps): when
+// code computes a value that is still on the stack from before, like the
+// second `x * x + 1` in `(x * x + 1) / (x * x + 1) ^ 2`, it's replaced with an
+// OP_PICK of that value
+static bool eliminate_common_exprs(Chunk* chunk)
+{
+    int instr_count = 0;
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        instr_count++;
+    }
+
+    ValueNumbering numbering;
+    numbering.nodes = NULL;
+    numbering.node_count = numbering.node_capacity = 0;
+    // at most one hashed node per instruction
+    numbering.bucket_capacity = 8;
+    while (numbering.bucket_capacity < instr_count * 2)
+    {
+        numbering.bucket_capacity *= 2;
+    }
+    numbering.buckets = ALLOCATE(int, numbering.bucket_capacity);
+    memset(numbering.buckets, 0xff, sizeof(int) * numbering.bucket_capacity);
+    numbering.stack_capacity = instr_count;
+    numbering.stack = ALLOCATE(StackValue, numbering.stack_capacity);
+    numbering.epoch = 0;
+    begin_block(&numbering);
+
+    int count = chunk->count;
+    bool* targets = find_jump_targets(chunk);
+    bool* deleted = ALLOCATE(bool, count);
+    memset(deleted, 0, count);
+    bool changed = false;
+
+    for (int offset = 0; offset < count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        if (targets[offset])
+        {
+            begin_block(&numbering);
+        }
+
+        OpCode op = chunk->code[offset];
+        bool pure;
+        int input_count = stack_inputs(op, &pure);
+        if (input_count < 0)
+        {
+            begin_block(&numbering);
+            continue;
+        }
+
+        ExprNode node = {(uint8_t)op, 0, 0, {-1, -1, -1}};
+        StackValue inputs[3];
+        for (int i = input_count - 1; i >= 0; i--)
+        {
+            inputs[i] = pop_value(&numbering);
+            node.inputs[i] = inputs[i].value;
+        }
+
+        StackValue result = {-1, offset, pure};
+        if (input_count > 0)
+        {
+            result.start = inputs[0].start;
+        }
+        for (int i = 0; i < input_count; i++)
+        {
+            result.pure &= inputs[i].pure && inputs[i].start != -1;
+        }
+
+        switch (op)
+        {
+        case OP_CONSTANT:
+            node.arg = chunk->code[offset + 1];
+            break;
+        case OP_GET_LOCAL:
+            node.arg = chunk->code[offset + 1];
+            node.epoch = numbering.epoch;
+            break;
+        case OP_GET_GLOBAL:
+            node.arg = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+            node.epoch = numbering.epoch;
+            break;
+        case OP_PICK:
+        {
+            // only from an earlier pass, it's the same value again
+            int distance = chunk->code[offset + 1];
+            if (distance >= numbering.depth)
+            {
+                result.value = unique_value(&numbering);
+                result.pure = false;
+                break;
+            }
+            result.value =
+                numbering.stack[numbering.depth - 1 - distance].value;
+            break;
+        }
+        case OP_SET_LOCAL:
+            // the local may be any of the slots we know about
+            for (int i = 0; i < numbering.depth; i++)
+            {
+                numbering.stack[i].value = unique_value(&numbering);
+            }
+            // fallthrough
+        case OP_SET_GLOBAL:
+            numbering.epoch++;
+            result.value = inputs[0].value;
+            break;
+        case OP_DEFINE_GLOBAL:
+            numbering.epoch++;
+            continue;
+        case OP_POP:
+        case OP_PRINT:
+            continue;
+        default:
+            break;
+        }
+
+        if (result.value == -1)
+        {
+            result.value = value_number(&numbering, &node);
+        }
+
+        // only worth it if there's more than one instruction to drop
+        int end = offset + instr_length(op);
+        if (result.pure && result.start != offset)
+        {
+            for (int i = numbering.depth - 1; i >= 0; i--)
+            {
+                int distance = numbering.depth - 1 - i;
+                if (distance > UINT8_MAX)
+                {
+                    break;
+                }
+                if (numbering.stack[i].value == result.value)
+                {
+                    pick_instead(chunk, deleted, result.start, end, distance);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+
+        numbering.stack[numbering.depth++] = result;
+    }
+
+    if (changed)
+    {
+        remove_code(chunk, deleted);
+    }
+
+    FREE_ARRAY(bool, deleted, count);
+    FREE_ARRAY(bool, targets, count + 1);
+    FREE_ARRAY(StackValue, numbering.stack, numbering.stack_capacity);
+    FREE_ARRAY(int, numbering.buckets, numbering.bucket_capacity);
+    FREE_ARRAY(ExprNode, numbering.nodes, numbering.node_capacity);
+    return changed;
+}
+
+/*** arithmetic ***/
+// what's known about a value on the stack, from the code that pushed it. an
+// array operand makes an array instead (of bools / doubles), but every rewrite
+// here gives the same elements for those too. `!` isn't element by element,
+// so a comparison is only a bool (for `!!x` -> x) when it compares numbers
+typedef enum ValueKind
+{
+    KIND_UNKNOWN,
+    KIND_BOOL,
+    KIND_INT,
+    // a double, and never an int
+    KIND_NUMBER,
+} ValueKind;
+
+// the code in [start, end) becomes `code`
+typedef struct Edit
+{
+    int start;
+    int end;
+    int length;
+    uint8_t code[6];
+} Edit;
+
+// the edits are in order and don't overlap, and none of them touches a jump
+// or has a jump landing inside it
+static void apply_edits(Chunk* chunk, Edit* edits, int edit_count)
+{
+    int count = chunk->count;
+    int* new_offset = ALLOCATE(int, count + 1);
+    int kept = 0;
+    for (int offset = 0, e = 0; offset <= count; offset++)
+    {
+        if (e < edit_count && offset == edits[e].start)
+        {
+            for (; offset < edits[e].end; offset++)
+            {
+                new_offset[offset] = kept;
+            }
+            kept += edits[e++].length;
+            offset--;
+            continue;
+        }
+        new_offset[offset] = kept;
+        kept++;
+    }
+    kept--;
+
+    uint8_t* code = ALLOCATE(uint8_t, kept);
+    int* lines = ALLOCATE(int, kept);
+    int* jumps = ALLOCATE(int, count);
+    int* jump_targets = ALLOCATE(int, count);
+    int jump_count = 0;
+
+    int e = 0;
+    for (int offset = 0; offset < count;)
+    {
+        if (e < edit_count && offset == edits[e].start)
+        {
+            Edit* edit = &edits[e++];
+            memcpy(&code[new_offset[offset]], edit->code, edit->length);
+            for (int i = 0; i < edit->length; i++)
+            {
+                lines[new_offset[offset] + i] = chunk->lines[edit->end - 1];
+            }
+            offset = edit->end;
+            continue;
+        }
+
+        OpCode op = chunk->code[offset];
+        if (is_jump(op))
+        {
+            jumps[jump_count] = new_offset[offset];
+            jump_targets[jump_count++] = jump_target(chunk, offset);
+        }
+        int length = instr_length(op);
+        memcpy(&code[new_offset[offset]], &chunk->code[offset], length);
+        memcpy(&lines[new_offset[offset]], &chunk->lines[offset],
+               length * sizeof(int));
+        offset += length;
+    }
+
+    if (chunk->capacity < kept)
+    {
+        int old_capacity = chunk->capacity;
+        chunk->capacity = kept;
+        chunk->code =
+            GROW_ARRAY(uint8_t, chunk->code, old_capacity, chunk->capacity);
+        chunk->lines = GROW_ARRAY(int, chunk->lines, old_capacity,
+                                  chunk->capacity);
+    }
+    memcpy(chunk->code, code, kept);
+    memcpy(chunk->lines, lines, kept * sizeof(int));
+    chunk->count = kept;
+    for (int i = 0; i < jump_count; i++)
+    {
+        set_jump_target(chunk, jumps[i], new_offset[jump_targets[i]]);
+    }
+
+    FREE_ARRAY(int, jump_targets, count);
+    FREE_ARRAY(int, jumps, count);
+    FREE_ARRAY(uint8_t, code, kept);
+    FREE_ARRAY(int, lines, kept);
+    FREE_ARRAY(int, new_offset, count + 1);
+}
+
+static ValueKind constant_kind(Value value)
+{
+    if (IS_INT(value))
+    {
+        return KIND_INT;
+    }
+    return IS_NUM(value) ? KIND_NUMBER : KIND_UNKNOWN;
+}
+
+// `x op c` is just x: only where the vm gives back exactly x, the same type
+// included. `x + 0` isn't x for a double, -0 + 0 is +0
+static bool is_identity(OpCode op, Value c, ValueKind x)
+{
+    double unit = op == OP_ADD || op == OP_SUB ? 0 : 1;
+    if (IS_INT(c) && AS_INT(c) == (int64_t)unit)
+    {
+        return x == KIND_INT || (x == KIND_NUMBER && op != OP_ADD);
+    }
+    if (IS_NUM(c) && AS_NUM(c) == unit && !signbit(AS_NUM(c)))
+    {
+        return x == KIND_NUMBER && op != OP_ADD;
+    }
+    return false;
+}
+
+// the constant's index, added if it isn't there yet. -1 if there's no room
+static int find_number(Chunk* chunk, double number)
+{
+    ValueArray* constants = &chunk->constants;
+    for (int i = 0; i < constants->count; i++)
+    {
+        if (IS_NUM(constants->values[i]) &&
+            memcmp(&constants->values[i].as.number, &number,
+                   sizeof(double)) == 0)
+        {
+            return i;
+        }
+    }
+
+    if (constants->count > UINT8_MAX)
+    {
+        return -1;
+    }
+    return add_constant(chunk, NUM_VAL(number));
+}
+
+// the multiplies fast_pow() and pow_overflows() do for these, in the same
+// order, so the result (int or double, overflow or not) comes out the same
+static const uint8_t pow_chains[][6] = {
+    // x * x
+    [2] = {OP_PICK, 0, OP_MULT},
+    // x * (x * x)
+    [3] = {OP_PICK, 0, OP_PICK, 0, OP_MULT, OP_MULT},
+    // (x * x) * (x * x)
+    [4] = {OP_PICK, 0, OP_MULT, OP_PICK, 0, OP_MULT},
+};
+static const int pow_chain_lengths[] = {[2] = 3, [3] = 6, [4] = 6};
+
+// `x op c`, where the code for `c, op` is replaced by something cheaper.
+// false if it can't be
+static bool simplify_constant_op(Chunk* chunk, OpCode op, Value c,
+                                 ValueKind x, Edit* edit)
+{
+    if (is_identity(op, c, x))
+    {
+        edit->length = 0;
+        return true;
+    }
+
+    // x ^ 2 -> x * x. a double exponent makes the result a double, so it
+    // has to be one already
+    if (op == OP_POW && (IS_INT(c) || x == KIND_NUMBER))
+    {
+        double exp = IS_INT(c) ? (double)AS_INT(c) : AS_NUM(c);
+        if (exp < 2 || exp > 4 || exp != (int)exp)
+        {
+            return false;
+        }
+        edit->length = pow_chain_lengths[(int)exp];
+        memcpy(edit->code, pow_chains[(int)exp], edit->length);
+        return true;
+    }
+
+    // x / 4 -> x * 0.25, exact for any power of two whose reciprocal is a
+    // double too. an int divisor keeps ints exact, so x has to be a double
+    if (op == OP_DIV && (IS_NUM(c) || (IS_INT(c) && x == KIND_NUMBER)))
+    {
+        double divisor = TO_NUM(c);
+        int exp;
+        if (divisor == 0 || !isfinite(divisor) ||
+            frexp(divisor, &exp) != 0.5 || !isfinite(1 / divisor))
+        {
+            return false;
+        }
+
+        int reciprocal = find_number(chunk, 1 / divisor);
+        if (reciprocal == -1)
+        {
+            return false;
+        }
+        edit->length = 3;
+        edit->code[0] = OP_CONSTANT;
+        edit->code[1] = (uint8_t)reciprocal;
+        edit->code[2] = OP_MULT;
+        return true;
+    }
+
+    return false;
+}
+
+// strength reduction and identities on arithmetic with a constant operand,
+// and `- - x` / `!!x` where that gives x back. each one is only done where
+// the vm would give exactly the same result, NaN and -0 included
+static void simplify_arith(Chunk* chunk)
+{
+    int count = chunk->count;
+    bool* targets = find_jump_targets(chunk);
+    ValueKind* stack = ALLOCATE(ValueKind, count);
+    Edit* edits = NULL;
+    int edit_count = 0;
+    int edit_capacity = 0;
+
+    int depth = 0;
+    // the previous instruction, -1 at the start of a block
+    int prev = -1;
+    // the last NOT or NEGATE, and the kind of its operand
+    int unary = -1;
+    ValueKind unary_input = KIND_UNKNOWN;
+
+    for (int offset = 0; offset < count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        if (targets[offset])
+        {
+            depth = 0;
+            prev = -1;
+        }
+
+        OpCode op = chunk->code[offset];
+        bool pure;
+        int input_count = stack_inputs(op, &pure);
+        if (input_count < 0)
+        {
+            depth = 0;
+            prev = -1;
+            continue;
+        }
+
+        ValueKind inputs[3] = {KIND_UNKNOWN, KIND_UNKNOWN, KIND_UNKNOWN};
+        for (int i = input_count - 1; i >= 0; i--)
+        {
+            inputs[i] = depth > 0 ? stack[--depth] : KIND_UNKNOWN;
+        }
+
+        ValueKind kind = KIND_UNKNOWN;
+        switch (op)
+        {
+        case OP_CONSTANT:
+            kind = constant_kind(
+                chunk->constants.values[chunk->code[offset + 1]]);
+            break;
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NOT:
+        case OP_EQUAL:
+            kind = KIND_BOOL;
+            break;
+        case OP_GRTR:
+        case OP_LESS:
+        case OP_NOT_LESS:
+        case OP_NOT_GRTR:
+            if (inputs[0] != KIND_UNKNOWN && inputs[0] != KIND_BOOL &&
+                inputs[1] != KIND_UNKNOWN && inputs[1] != KIND_BOOL)
+            {
+                kind = KIND_BOOL;
+            }
+            break;
+        case OP_NEGATE:
+            // -INT64_MIN is a double
+            kind = inputs[0] == KIND_NUMBER ? KIND_NUMBER : KIND_UNKNOWN;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MULT:
+        case OP_DIV:
+        case OP_POW:
+            // with a double on either side, it's a double or an error
+            if (inputs[0] == KIND_NUMBER || inputs[1] == KIND_NUMBER)
+            {
+                kind = KIND_NUMBER;
+            }
+            break;
+        case OP_SELECT:
+            kind = inputs[1] == inputs[2] ? inputs[1] : KIND_UNKNOWN;
+            break;
+        case OP_PICK:
+            if (chunk->code[offset + 1] < depth)
+            {
+                kind = stack[depth - 1 - chunk->code[offset + 1]];
+            }
+            break;
+        case OP_SET_LOCAL:
+        case OP_SET_GLOBAL:
+            kind = inputs[0];
+            break;
+        case OP_POP:
+        case OP_PRINT:
+        case OP_DEFINE_GLOBAL:
+            prev = offset;
+            continue;
+        default:
+            break;
+        }
+
+        Edit edit;
+        bool simplified = false;
+        bool follows = prev != -1 && !targets[offset];
+        if ((op == OP_NOT || op == OP_NEGATE) && follows &&
+            prev == unary && chunk->code[prev] == op &&
+            unary_input == (op == OP_NOT ? KIND_BOOL : KIND_NUMBER))
+        {
+            // both go, x is left as it was
+            edit.start = prev;
+            edit.length = 0;
+            simplified = true;
+            kind = unary_input;
+            unary = -1;
+        }
+        else if (op == OP_NOT || op == OP_NEGATE)
+        {
+            unary = offset;
+            unary_input = inputs[0];
+        }
+        else if (follows && chunk->code[prev] == OP_CONSTANT &&
+                 op >= OP_ADD && op <= OP_POW)
+        {
+            Value c = chunk->constants.values[chunk->code[prev + 1]];
+            simplified = simplify_constant_op(chunk, op, c, inputs[0], &edit);
+            edit.start = prev;
+            if (simplified && edit.length == 0)
+            {
+                kind = inputs[0];
+            }
+        }
+
+        if (simplified)
+        {
+            edit.end = offset + instr_length(op);
+            if (edit_capacity < edit_count + 1)
+            {
+                int old_capacity = edit_capacity;
+                edit_capacity = GROW_CAPACITY(old_capacity);
+                edits = GROW_ARRAY(Edit, edits, old_capacity, edit_capacity);
+            }
+            edits[edit_count++] = edit;
+        }
+
+        stack[depth++] = kind;
+        prev = offset;
+    }
+
+    if (edit_count > 0)
+    {
+        apply_edits(chunk, edits, edit_count);
+    }
+
+    FREE_ARRAY(Edit, edits, edit_capacity);
+    FREE_ARRAY(ValueKind, stack, count);
+    FREE_ARRAY(bool, targets, count + 1);
+}
+
+// where the `count` instructions at `offset` start (in `parts`) and the end
+// of the last, if they're `ops` and only the first is jumped to. 0 if not
+static int match_ops(Chunk* chunk, bool* targets, int offset,
+                     const uint8_t* ops, int count, int* parts)
+{
+    int at = offset;
+    for (int i = 0; i < count; i++)
+    {
+        if (at >= chunk->count || chunk->code[at] != ops[i] ||
+            (i > 0 && targets[at]))
+        {
+            return 0;
+        }
+        parts[i] = at;
+        at += instr_length(ops[i]);
+    }
+    return at;
+}
+
+// `a = a + k;`, `a += k;` and `a++;` as statements: the variable is read, k
+// added and the sum stored and popped. that's OP_INC_* (k is the int 1) or
+// OP_ADD_CONST_*, which do it without touching the stack. 0 if the code at
+// `offset` isn't that
+static int match_update(Chunk* chunk, bool* targets, int offset, Edit* edit)
+{
+    static const uint8_t locals[] = {OP_GET_LOCAL, OP_CONSTANT, OP_ADD,
+                                     OP_SET_LOCAL, OP_POP};
+    static const uint8_t globals[] = {OP_GET_GLOBAL, OP_CONSTANT, OP_ADD,
+                                      OP_SET_GLOBAL, OP_POP};
+    // `a++` keeps a copy of the old value under the sum, the statement pops
+    // that too
+    static const uint8_t postfix_locals[] = {
+        OP_GET_LOCAL, OP_PICK, OP_CONSTANT, OP_ADD, OP_SET_LOCAL, OP_POP,
+        OP_POP};
+    static const uint8_t postfix_globals[] = {
+        OP_GET_GLOBAL, OP_PICK, OP_CONSTANT, OP_ADD, OP_SET_GLOBAL, OP_POP,
+        OP_POP};
+    bool global = chunk->code[offset] == OP_GET_GLOBAL;
+    // the variable's operand: a slot, or a u16 index
+    int size = global ? 2 : 1;
+
+    int parts[7];
+    // which of the parts are the OP_CONSTANT and the set
+    int constant_part = 1;
+    int set_part = 3;
+    int at = match_ops(chunk, targets, offset, global ? globals : locals, 5,
+                       parts);
+    if (at == 0)
+    {
+        at = match_ops(chunk, targets, offset,
+                       global ? postfix_globals : postfix_locals, 7, parts);
+        if (at == 0 || chunk->code[parts[1] + 1] != 0)
+        {
+            return 0;
+        }
+        constant_part = 2;
+        set_part = 4;
+    }
+    if (memcmp(&chunk->code[parts[0] + 1], &chunk->code[parts[set_part] + 1],
+               size) != 0)
+    {
+        return 0;
+    }
+
+    uint8_t k = chunk->code[parts[constant_part] + 1];
+    Value constant = chunk->constants.values[k];
+    bool inc = IS_INT(constant) && AS_INT(constant) == 1;
+    edit->start = offset;
+    edit->end = at;
+    edit->code[0] = global ? (inc ? OP_INC_GLOBAL : OP_ADD_CONST_GLOBAL)
+                           : (inc ? OP_INC_LOCAL : OP_ADD_CONST_LOCAL);
+    memcpy(&edit->code[1], &chunk->code[offset + 1], size);
+    edit->length = 1 + size;
+    if (!inc)
+    {
+        edit->code[edit->length++] = k;
+    }
+    return at - offset;
+}
+
+static void fuse_updates(Chunk* chunk)
+{
+    int count = chunk->count;
+    bool* targets = find_jump_targets(chunk);
+    Edit* edits = NULL;
+    int edit_count = 0;
+    int edit_capacity = 0;
+
+    for (int offset = 0; offset < count;)
+    {
+        Edit edit;
+        int length = match_update(chunk, targets, offset, &edit);
+        if (length == 0)
+        {
+            offset += instr_length(chunk->code[offset]);
+            continue;
+        }
+
+        if (edit_capacity < edit_count + 1)
+        {
+            int old_capacity = edit_capacity;
+            edit_capacity = GROW_CAPACITY(old_capacity);
+            edits = GROW_ARRAY(Edit, edits, old_capacity, edit_capacity);
+        }
+        edits[edit_count++] = edit;
+        offset += length;
+    }
+
+    if (edit_count > 0)
+    {
+        apply_edits(chunk, edits, edit_count);
+    }
+
+    FREE_ARRAY(Edit, edits, edit_capacity);
+    FREE_ARRAY(bool, targets, count + 1);
+}
+
+#ifndef PROFILE_OPCODES
+// the longest superinstruction the code at `offset` can be replaced with
+static OpCode match_superinstr(Chunk* chunk, bool* targets, int offset)
+{
+    OpCode best = chunk->code[offset];
+    int best_count = 1;
+
+    for (int op = FIRST_SUPERINSTR; get_superinstr(op) != NULL; op++)
+    {
+        const Superinstr* super = get_superinstr(op);
+        if (super->op_count <= best_count)
+        {
+            continue;
+        }
+
+        int at = offset;
+        bool match = true;
+        for (int i = 0; match && i < super->op_count; i++)
+        {
+            // only the first part can be jumped to, and only the last part
+            // can jump
+            match = at < chunk->count && chunk->code[at] == super->ops[i] &&
+                    (i == 0 || !targets[at]) &&
+                    (i == super->op_count - 1 || !is_jump(super->ops[i]));
+            at += instr_length(super->ops[i]);
+        }
+
+        if (match)
+        {
+            best = (OpCode)op;
+            best_count = super->op_count;
+        }
+    }
+    return best;
+}
+
+// replaces sequences with superinstructions. this has to be the last pass,
+// the others only know about plain instructions
+static void fuse_superinstrs(Chunk* chunk)
+{
+    int count = chunk->count;
+    bool* targets = find_jump_targets(chunk);
+    uint8_t* code = ALLOCATE(uint8_t, count);
+    int* lines = ALLOCATE(int, count);
+    int* new_offset = ALLOCATE(int, count + 1);
+    // where the jumps end up and the (old) offsets they go to
+    int* jumps = ALLOCATE(int, count);
+    int* jump_targets = ALLOCATE(int, count);
+    int jump_count = 0;
+
+    int kept = 0;
+    for (int offset = 0; offset < count;)
+    {
+        OpCode op = match_superinstr(chunk, targets, offset);
+        const Superinstr* super = get_superinstr(op);
+        new_offset[offset] = kept;
+
+        if (super == NULL)
+        {
+            if (is_jump(op))
+            {
+                jumps[jump_count] = kept;
+                jump_targets[jump_count++] = jump_target(chunk, offset);
+            }
+
+            int length = instr_length(op);
+            memcpy(&code[kept], &chunk->code[offset], length);
+            for (int i = 0; i < length; i++)
+            {
+                lines[kept + i] = chunk->lines[offset + i];
+            }
+            kept += length;
+            offset += length;
+            continue;
+        }
+
+        // the opcode, then each part's operands (each keeps its line)
+        int start = kept;
+        code[kept] = (uint8_t)op;
+        lines[kept++] = chunk->lines[offset];
+        for (int i = 0; i < super->op_count; i++)
+        {
+            if (is_jump(super->ops[i]))
+            {
+                jumps[jump_count] = start;
+                jump_targets[jump_count++] = jump_target(chunk, offset);
+            }
+
+            int length = instr_length(super->ops[i]);
+            for (int j = 1; j < length; j++)
+            {
+                code[kept] = chunk->code[offset + j];
+                lines[kept++] = chunk->lines[offset + j];
+            }
+            offset += length;
+        }
+    }
+    new_offset[count] = kept;
+
+    memcpy(chunk->code, code, kept);
+    memcpy(chunk->lines, lines, kept * sizeof(int));
+    chunk->count = kept;
+    for (int i = 0; i < jump_count; i++)
+    {
+        set_jump_target(chunk, jumps[i], new_offset[jump_targets[i]]);
+    }
+
+    FREE_ARRAY(int, jump_targets, count);
+    FREE_ARRAY(int, jumps, count);
+    FREE_ARRAY(int, new_offset, count + 1);
+    FREE_ARRAY(int, lines, count);
+    FREE_ARRAY(uint8_t, code, count);
+    FREE_ARRAY(bool, targets, count + 1);
+}
+#endif
+
+void optimize_chunk(Chunk* chunk)
+{
+    bool changed = true;
+    for (int pass = 0; changed && pass < MAX_HOPS; pass++)
+    {
+        changed = fuse_not_jumps(chunk);
+        changed |= thread_jumps(chunk);
+    }
+
+    simplify_arith(chunk);
+    if (cse_enabled)
+    {
+        eliminate_common_exprs(chunk);
+    }
+    // after the passes above, which don't know about the fused instructions
+    fuse_updates(chunk);
+
+#ifndef PROFILE_OPCODES
+    // the profile has to see the plain instructions
+    fuse_superinstrs(chunk);
+#endif
+}
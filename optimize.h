@@ -0,0 +1,15 @@
+#pragma once
+
+#include "chunk.h"
+
+// common subexpressions are computed once (on unless --no-cse, which is there
+// to compare against the plain code)
+extern bool cse_enabled;
+
+// peephole passes over a finished chunk, before it gets run
+void optimize_chunk(Chunk* chunk);
+
+// deletes every byte marked in `deleted` (whole instructions only) and fixes
+// up the jumps around them. a jump to a deleted instruction ends up at the
+// next one that's left
+void remove_code(Chunk* chunk, bool* deleted);
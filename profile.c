@@ -0,0 +1,295 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "memory.h"
+#include "profile.h"
+#include "vm.h"
+
+Profiler profiler;
+
+// how many samples a line (or a stack) got
+typedef struct ProfileCount
+{
+    // the sample it was first seen in
+    int sample;
+    int count;
+} ProfileCount;
+
+#ifndef _WIN32
+static void on_sigprof(int number)
+{
+    (void)number;
+    profiler.pending = 1;
+}
+
+// 0 stops it
+static void set_timer(long interval_us)
+{
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = interval_us;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+#endif
+
+bool profile_enable(const char* path, const char* script)
+{
+#ifdef _WIN32
+    (void)path;
+    (void)script;
+    fprintf(stderr, "--profile needs setitimer, which Windows doesn't have.\n");
+    return false;
+#else
+    profiler.enabled = true;
+    profiler.path = path != NULL ? path : PROFILE_DEFAULT_PATH;
+    profiler.script = script;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_sigprof;
+    // reading a script (or a repl line) shouldn't fail halfway with EINTR
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    set_timer(1000000 / PROFILE_HZ);
+    return true;
+#endif
+}
+
+static int name_index(const char* name)
+{
+    for (int i = 0; i < profiler.name_count; i++)
+    {
+        if (strcmp(profiler.names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+
+    if (profiler.name_capacity < profiler.name_count + 1)
+    {
+        int old_capacity = profiler.name_capacity;
+        profiler.name_capacity = GROW_CAPACITY(old_capacity);
+        profiler.names = GROW_ARRAY(char*, profiler.names, old_capacity,
+                                    profiler.name_capacity);
+    }
+
+    size_t length = strlen(name);
+    char* copy = ALLOCATE(char, length + 1);
+    memcpy(copy, name, length + 1);
+    profiler.names[profiler.name_count] = copy;
+    return profiler.name_count++;
+}
+
+static const char* chunk_name(Chunk* chunk)
+{
+    if (chunk == &vm.script)
+    {
+        return profiler.script;
+    }
+    for (int i = 0; i < vm.module_count; i++)
+    {
+        if (&vm.modules[i]->chunk == chunk)
+        {
+            return vm.modules[i]->path->chars;
+        }
+    }
+    return "?";
+}
+
+static void add_frame(Chunk* chunk, int offset)
+{
+    if (profiler.frame_capacity < profiler.frame_count + 1)
+    {
+        int old_capacity = profiler.frame_capacity;
+        profiler.frame_capacity = GROW_CAPACITY(old_capacity);
+        profiler.frames = GROW_ARRAY(ProfileFrame, profiler.frames,
+                                     old_capacity, profiler.frame_capacity);
+    }
+
+    ProfileFrame* frame = &profiler.frames[profiler.frame_count++];
+    frame->name = name_index(chunk_name(chunk));
+    frame->line = chunk->lines[offset];
+}
+
+void profile_sample()
+{
+    int offset = (int)(vm.ip - vm.chunk->code);
+    profiler.pending = 0;
+
+    // each frame's ip is just past the OP_IMPORT it's waiting on
+    for (int i = 0; i < vm.frame_count; i++)
+    {
+        Frame* frame = &vm.frames[i];
+        add_frame(frame->chunk, (int)(frame->ip - frame->chunk->code) - 1);
+    }
+    add_frame(vm.chunk, offset);
+
+    if (profiler.sample_capacity < profiler.sample_count + 1)
+    {
+        int old_capacity = profiler.sample_capacity;
+        profiler.sample_capacity = GROW_CAPACITY(old_capacity);
+        profiler.depths = GROW_ARRAY(int, profiler.depths, old_capacity,
+                                     profiler.sample_capacity);
+    }
+    profiler.depths[profiler.sample_count++] = vm.frame_count + 1;
+}
+
+// qsort() has no way to pass these to the comparisons
+static int* sample_starts;
+static bool compare_leaves;
+
+// what the samples are grouped by: just the innermost frame, or all of them
+static int compare_samples(const void* a, const void* b)
+{
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    const ProfileFrame* x_frames = &profiler.frames[sample_starts[x]];
+    const ProfileFrame* y_frames = &profiler.frames[sample_starts[y]];
+    int x_depth = profiler.depths[x];
+    int y_depth = profiler.depths[y];
+    if (compare_leaves)
+    {
+        x_frames += x_depth - 1;
+        y_frames += y_depth - 1;
+        x_depth = y_depth = 1;
+    }
+
+    for (int i = 0; i < x_depth && i < y_depth; i++)
+    {
+        if (x_frames[i].name != y_frames[i].name)
+        {
+            return x_frames[i].name - y_frames[i].name;
+        }
+        if (x_frames[i].line != y_frames[i].line)
+        {
+            return x_frames[i].line - y_frames[i].line;
+        }
+    }
+    return x_depth - y_depth;
+}
+
+// the most samples first
+static int compare_counts(const void* a, const void* b)
+{
+    return ((const ProfileCount*)b)->count - ((const ProfileCount*)a)->count;
+}
+
+// sorts the samples so the ones that are the same (see compare_samples) are
+// next to each other, and counts them. returns how many different ones there
+// were
+static int count_samples(int* order, ProfileCount* counts, bool leaves)
+{
+    compare_leaves = leaves;
+    for (int i = 0; i < profiler.sample_count; i++)
+    {
+        order[i] = i;
+    }
+    qsort(order, profiler.sample_count, sizeof(int), compare_samples);
+
+    int count = 0;
+    for (int i = 0; i < profiler.sample_count; i++)
+    {
+        if (i == 0 || compare_samples(&order[i - 1], &order[i]) != 0)
+        {
+            counts[count].sample = order[i];
+            counts[count].count = 0;
+            count++;
+        }
+        counts[count - 1].count++;
+    }
+    return count;
+}
+
+static void print_frame(FILE* out, const ProfileFrame* frame)
+{
+    fprintf(out, "%s:%d", profiler.names[frame->name], frame->line);
+}
+
+void profile_dump()
+{
+    if (!profiler.enabled)
+    {
+        return;
+    }
+#ifndef _WIN32
+    set_timer(0);
+#endif
+
+    int samples = profiler.sample_count;
+    sample_starts = ALLOCATE(int, samples);
+    int* order = ALLOCATE(int, samples);
+    ProfileCount* counts = ALLOCATE(ProfileCount, samples);
+    int start = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        sample_starts[i] = start;
+        start += profiler.depths[i];
+    }
+
+    // the hottest lines, by the samples that were in them (not in something
+    // they imported)
+    int lines = count_samples(order, counts, true);
+    qsort(counts, lines, sizeof(ProfileCount), compare_counts);
+    fprintf(stderr, "== %d samples ==\n", samples);
+    fprintf(stderr, "%8s %6s  %s\n", "samples", "%", "line");
+    for (int i = 0; i < lines; i++)
+    {
+        int sample = counts[i].sample;
+        fprintf(stderr, "%8d %5.1f%%  ", counts[i].count,
+                100.0 * counts[i].count / samples);
+        print_frame(stderr, &profiler.frames[sample_starts[sample] +
+                                             profiler.depths[sample] - 1]);
+        fprintf(stderr, "\n");
+    }
+
+    FILE* file = fopen(profiler.path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not write profile to \"%s\".\n", profiler.path);
+    }
+    else
+    {
+        int stacks = count_samples(order, counts, false);
+        for (int i = 0; i < stacks; i++)
+        {
+            int sample = counts[i].sample;
+            for (int j = 0; j < profiler.depths[sample]; j++)
+            {
+                if (j > 0)
+                {
+                    fputc(';', file);
+                }
+                print_frame(file, &profiler.frames[sample_starts[sample] + j]);
+            }
+            fprintf(file, " %d\n", counts[i].count);
+        }
+        fclose(file);
+        fprintf(stderr, "Wrote %d stacks to \"%s\".\n", stacks, profiler.path);
+    }
+
+    FREE_ARRAY(ProfileCount, counts, samples);
+    FREE_ARRAY(int, order, samples);
+    FREE_ARRAY(int, sample_starts, samples);
+    sample_starts = NULL;
+    profiler.enabled = false;
+}
+
+void free_profiler()
+{
+    for (int i = 0; i < profiler.name_count; i++)
+    {
+        FREE_ARRAY(char, profiler.names[i], strlen(profiler.names[i]) + 1);
+    }
+    FREE_ARRAY(char*, profiler.names, profiler.name_capacity);
+    FREE_ARRAY(ProfileFrame, profiler.frames, profiler.frame_capacity);
+    FREE_ARRAY(int, profiler.depths, profiler.sample_capacity);
+    memset(&profiler, 0, sizeof(profiler));
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <signal.h>
+
+#include "common.h"
+
+// samples per second of cpu time
+#define PROFILE_HZ 1000
+#define PROFILE_DEFAULT_PATH "clox.folded"
+
+// where one frame of a sample was: a line of a script or module
+typedef struct ProfileFrame
+{
+    // index into Profiler.names
+    int name;
+    int line;
+} ProfileFrame;
+
+// a SIGPROF timer says when to sample, but run() keeps ip in a local, so the
+// handler can't see where the vm is. it only sets `pending`, and run() stores
+// its registers and takes the sample before its next instruction. so nothing
+// but run() touches the samples, they need no locks, and the handler does
+// nothing that isn't safe in one
+typedef struct Profiler
+{
+    bool enabled;
+    // the collapsed stacks go here
+    const char* path;
+    // what the top level script is called in the output
+    const char* script;
+    volatile sig_atomic_t pending;
+
+    // every sample's frames, outermost (the script) first
+    ProfileFrame* frames;
+    int frame_count;
+    int frame_capacity;
+    // how many frames each sample has
+    int* depths;
+    int sample_count;
+    int sample_capacity;
+
+    // copies: a module's path is a string the gc can move
+    char** names;
+    int name_count;
+    int name_capacity;
+} Profiler;
+
+// not part of the vm: the scheduler swaps vms, and a signal handler can only
+// get at a global anyway
+extern Profiler profiler;
+
+// starts the timer, false (after reporting it) where there's no setitimer
+bool profile_enable(const char* path, const char* script);
+// records where the vm is: vm.ip, in vm.chunk, is about to run
+void profile_sample();
+// stops the timer, prints the hottest lines to stderr and writes every stack
+// (flamegraph.pl's collapsed format, `a;b;c count`) to the path. nothing if
+// the profiler isn't on
+void profile_dump();
+void free_profiler();
@@ -1,7 +1,9 @@
+#define _CRT_SECURE_NO_DEPRECATE
 #include <stdio.h>
 #include <string.h>
 
 #include "common.h"
+#include "memory.h"
 #include "scanner.h"
 
 // like a private class
@@ -12,7 +14,26 @@ typedef struct Scanner
     // current - start = length of lexeme
     // note that current is not inclusive! it goes past the lexeme
     const char* current;
+    // the end of what's been read so far, there's always a '\0' here
+    const char* limit;
     int line;
+
+    // for each format string the scanner is inside of, how many parens are
+    // open in the expression of its current %(...). the string goes on when
+    // that gets back to 0
+    int parens[MAX_INTERPOLATION];
+    int interpolations;
+
+    // NULL when the whole source is in memory already
+    FILE* file;
+    // the file is read a block at a time into one of these, right after the
+    // part of the lexeme that was left over from the last block
+    char* buffers[2];
+    size_t capacities[2];
+    // the one `current` is in
+    int buffer;
+    // the one the last token returned is in, the parser still needs it
+    int token_buffer;
 } Scanner;
 
 Scanner scanner;
@@ -21,7 +42,75 @@ void init_scanner(const char* source)
 {
     scanner.start = source;
     scanner.current = source;
+    scanner.limit = source + strlen(source);
     scanner.line = 1;
+    scanner.interpolations = 0;
+    scanner.file = NULL;
+}
+
+void init_scanner_file(FILE* file)
+{
+    init_scanner("");
+    scanner.file = file;
+    scanner.buffer = 0;
+    scanner.token_buffer = -1;
+}
+
+void free_scanner()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        FREE_ARRAY(char, scanner.buffers[i], scanner.capacities[i]);
+        scanner.buffers[i] = NULL;
+        scanner.capacities[i] = 0;
+    }
+    init_scanner("");
+}
+
+// reads the next block of the file. the unfinished lexeme is copied in front of
+// it, so a token never spans two buffers. returns false at the end of the file
+static bool refill()
+{
+    if (scanner.file == NULL)
+    {
+        return false;
+    }
+
+    // the other buffer, unless the parser's token is in there
+    int target = scanner.buffer;
+    if (scanner.token_buffer == scanner.buffer)
+    {
+        target = 1 - scanner.buffer;
+    }
+
+    size_t kept = scanner.limit - scanner.start;
+    size_t lexeme = scanner.current - scanner.start;
+    size_t needed = kept + SCAN_BLOCK + 1;
+    if (scanner.capacities[target] < needed)
+    {
+        // the lexeme may be in this very buffer
+        bool moves = kept > 0 && target == scanner.buffer;
+        size_t offset = moves ? scanner.start - scanner.buffers[target] : 0;
+        scanner.buffers[target] =
+            GROW_ARRAY(char, scanner.buffers[target],
+                       scanner.capacities[target], needed);
+        scanner.capacities[target] = needed;
+        if (moves)
+        {
+            scanner.start = scanner.buffers[target] + offset;
+        }
+    }
+
+    char* buffer = scanner.buffers[target];
+    memmove(buffer, scanner.start, kept);
+    size_t read = fread(buffer + kept, 1, SCAN_BLOCK, scanner.file);
+    buffer[kept + read] = '\0';
+
+    scanner.buffer = target;
+    scanner.start = buffer;
+    scanner.current = buffer + lexeme;
+    scanner.limit = buffer + kept + read;
+    return read > 0;
 }
 
 static bool is_digit(char c)
@@ -36,7 +125,7 @@ static bool is_alpha(char c)
 
 static bool at_end()
 {
-    return *scanner.current == '\0';
+    return scanner.current == scanner.limit && !refill();
 }
 
 static bool match(char expected)
@@ -55,8 +144,13 @@ static bool match(char expected)
     return false;
 }
 
+// '\0' at the end
 static char peek()
 {
+    if (scanner.current == scanner.limit)
+    {
+        refill();
+    }
     return *scanner.current;
 }
 
@@ -64,6 +158,10 @@ static char peek_next()
 {
     if (at_end())
         return '\0';
+    if (scanner.current + 1 == scanner.limit)
+    {
+        refill();
+    }
     return scanner.current[1];
 }
 
@@ -75,6 +173,13 @@ static char advance()
     return scanner.current[-1];
 }
 
+// for whitespace and comments: nothing skipped is kept when refilling
+static void skip()
+{
+    scanner.current++;
+    scanner.start = scanner.current;
+}
+
 static void skip_whitespace()
 {
     while (true)
@@ -87,18 +192,18 @@ static void skip_whitespace()
         case ' ':
         case '\r':
         case '\t':
-            advance();
+            skip();
             break;
         case '\n':
             scanner.line++;
-            advance();
+            skip();
             break;
         case '/':
             if (peek_next() == '/')
             {
                 while (peek() != '\n' && !at_end())
                 {
-                    advance();
+                    skip();
                 }
             }
             else
@@ -120,6 +225,7 @@ static Token make_token(TType type)
     token.start = scanner.start;
     token.length = (int)(scanner.current - scanner.start);
     token.line = scanner.line;
+    scanner.token_buffer = scanner.buffer;
     return token;
 }
 
@@ -183,7 +289,17 @@ static TType identifier_type()
         }
         break;
     case 'i':
-        return check_keyword(1, 1, "f", TOKEN_IF);
+        if (scanner.current - scanner.start > 1)
+        {
+            switch (scanner.start[1])
+            {
+            case 'f':
+                return check_keyword(2, 0, "", TOKEN_IF);
+            case 'm':
+                return check_keyword(2, 4, "port", TOKEN_IMPORT);
+            }
+        }
+        break;
     case 'n':
         return check_keyword(1, 2, "il", TOKEN_NIL);
     case 'o':
@@ -240,11 +356,14 @@ static Token number()
         {
             advance();
         }
+        return make_token(TOKEN_NUMBER);
     }
 
-    return make_token(TOKEN_NUMBER);
+    return make_token(TOKEN_INT);
 }
 
+// the wren way: "a %(b) c" is TOKEN_INTERPOLATION `"a %(`, then the tokens of
+// b, then TOKEN_STRING `) c"`, which is scanned once b's closing ')' is found
 static Token string()
 {
     while (peek() != '"' && !at_end())
@@ -253,6 +372,17 @@ static Token string()
         {
             scanner.line++;
         }
+        else if (peek() == '%' && peek_next() == '(')
+        {
+            if (scanner.interpolations == MAX_INTERPOLATION)
+            {
+                return err_token("Format strings nest too deep.");
+            }
+            advance(); // %
+            advance(); // (
+            scanner.parens[scanner.interpolations++] = 1;
+            return make_token(TOKEN_INTERPOLATION);
+        }
         advance();
     }
 
@@ -269,6 +399,7 @@ static Token string()
 
 Token scan_token()
 {
+    scanner.start = scanner.current;
     skip_whitespace();
     scanner.start = scanner.current;
 
@@ -292,13 +423,28 @@ Token scan_token()
     switch (c)
     {
     case '(':
+        if (scanner.interpolations > 0)
+        {
+            scanner.parens[scanner.interpolations - 1]++;
+        }
         return make_token(TOKEN_LEFT_PAREN);
     case ')':
+        if (scanner.interpolations > 0 &&
+            --scanner.parens[scanner.interpolations - 1] == 0)
+        {
+            // the end of the %(...), back to the rest of the string
+            scanner.interpolations--;
+            return string();
+        }
         return make_token(TOKEN_RIGHT_PAREN);
     case '{':
         return make_token(TOKEN_LEFT_BRACE);
     case '}':
         return make_token(TOKEN_RIGHT_BRACE);
+    case '[':
+        return make_token(TOKEN_LEFT_BRACKET);
+    case ']':
+        return make_token(TOKEN_RIGHT_BRACKET);
     case ';':
         return make_token(TOKEN_SEMICOLON);
     case ',':
@@ -306,15 +452,23 @@ Token scan_token()
     case '.':
         return make_token(TOKEN_DOT);
     case '-':
-        return make_token(TOKEN_MINUS);
+        return make_token(match('=') ? TOKEN_MINUS_EQUAL : TOKEN_MINUS);
     case '+':
-        return make_token(TOKEN_PLUS);
+        if (match('+'))
+        {
+            return make_token(TOKEN_PLUS_PLUS);
+        }
+        return make_token(match('=') ? TOKEN_PLUS_EQUAL : TOKEN_PLUS);
     case '/':
-        return make_token(TOKEN_SLASH);
+        return make_token(match('=') ? TOKEN_SLASH_EQUAL : TOKEN_SLASH);
     case '*':
-        return make_token(TOKEN_STAR);
+        return make_token(match('=') ? TOKEN_STAR_EQUAL : TOKEN_STAR);
     case '^':
         return make_token(TOKEN_POW);
+    case '?':
+        return make_token(TOKEN_QUESTION);
+    case ':':
+        return make_token(TOKEN_COLON);
     case '!':
         return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
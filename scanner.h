@@ -1,5 +1,12 @@
 #pragma once
 
+#include <stdio.h>
+
+// a file is scanned this much at a time
+#define SCAN_BLOCK (64 * 1024)
+// how many format strings can be inside each other's %(...)
+#define MAX_INTERPOLATION 8
+
 typedef enum TType TType;
 
 typedef struct Token
@@ -8,6 +15,8 @@ typedef struct Token
 
     // a pointer to the source code file, NOT a real string
     // this way, memory management easy: just free source code file at the end!
+    // when scanning a FILE*, it's into the scanner's buffer instead, and only
+    // stays valid until the token after next is scanned
     const char* start;
     // lexeme string length
     int length;
@@ -16,6 +25,10 @@ typedef struct Token
 } Token;
 
 void init_scanner(const char* source);
+// reads the file as it goes, so only a block or so of it is in memory
+void init_scanner_file(FILE* file);
+// the buffers init_scanner_file() needed
+void free_scanner();
 Token scan_token();
 
 typedef enum TType
@@ -24,6 +37,8 @@ typedef enum TType
     TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE,
     TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET,
+    TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA,
     TOKEN_DOT,
     TOKEN_MINUS,
@@ -32,6 +47,8 @@ typedef enum TType
     TOKEN_SLASH,
     TOKEN_STAR,
     TOKEN_POW,
+    TOKEN_QUESTION,
+    TOKEN_COLON,
 
     // One or two character tokens.
     TOKEN_BANG,
@@ -42,11 +59,21 @@ typedef enum TType
     TOKEN_GREATER_EQUAL,
     TOKEN_LESS,
     TOKEN_LESS_EQUAL,
+    // `a++` and `a op= b`. there's no `--`, that's still `- -a`
+    TOKEN_PLUS_PLUS,
+    TOKEN_PLUS_EQUAL,
+    TOKEN_MINUS_EQUAL,
+    TOKEN_STAR_EQUAL,
+    TOKEN_SLASH_EQUAL,
 
     // Literals.
     TOKEN_IDENTIFIER,
     TOKEN_STRING,
+    // the part of a format string up to and including a "%(", see string()
+    TOKEN_INTERPOLATION,
     TOKEN_NUMBER,
+    // a number without a '.'
+    TOKEN_INT,
 
     // Keywords.
     TOKEN_AND,
@@ -56,6 +83,7 @@ typedef enum TType
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IMPORT,
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
@@ -0,0 +1,122 @@
+#include <stdio.h>
+
+#include "memory.h"
+#include "sched.h"
+#include "timer.h"
+
+void init_scheduler(Scheduler* sched, int64_t slice, uint64_t timeout_ns)
+{
+    sched->tasks = NULL;
+    sched->count = 0;
+    sched->capacity = 0;
+    sched->slice = slice;
+    sched->timeout_ns = timeout_ns;
+}
+
+void free_scheduler(Scheduler* sched)
+{
+    // whatever is running is saved here meanwhile
+    VM outer = vm;
+    for (int i = 0; i < sched->count; i++)
+    {
+        if (!sched->tasks[i].done)
+        {
+            vm = sched->tasks[i].vm;
+            free_vm();
+        }
+    }
+    vm = outer;
+
+    FREE_ARRAY(Task, sched->tasks, sched->capacity);
+    init_scheduler(sched, sched->slice, sched->timeout_ns);
+}
+
+// a vm's pointers into itself (`chunk`, at vm.script) all point into the
+// global `vm`: it only ever runs from there, so a task's copy can be moved
+// around freely. the stack is allocated, each task has its own
+bool spawn(Scheduler* sched, const char* name, const char* source)
+{
+    VM outer = vm;
+    init_vm();
+    if (load_script(source) != INTERPRET_OK)
+    {
+        free_vm();
+        vm = outer;
+        return false;
+    }
+
+    if (sched->capacity < sched->count + 1)
+    {
+        int old_capacity = sched->capacity;
+        sched->capacity = GROW_CAPACITY(old_capacity);
+        sched->tasks =
+            GROW_ARRAY(Task, sched->tasks, old_capacity, sched->capacity);
+    }
+
+    Task* task = &sched->tasks[sched->count++];
+    task->vm = vm;
+    task->name = name;
+    task->run_ns = 0;
+    task->done = false;
+
+    vm = outer;
+    return true;
+}
+
+// gives the task one turn, true once it's done
+static bool run_turn(Scheduler* sched, Task* task, int* failed)
+{
+    vm = task->vm;
+
+    uint64_t start = now_ns();
+    InterpretResult result = resume(sched->slice);
+    task->run_ns += now_ns() - start;
+
+    bool timed_out = result == INTERPRET_YIELD && sched->timeout_ns != 0 &&
+                     task->run_ns > sched->timeout_ns;
+    if (result == INTERPRET_YIELD && !timed_out)
+    {
+        task->vm = vm;
+        return false;
+    }
+
+    if (timed_out)
+    {
+        fprintf(stderr, "%s: stopped after %.1f ms.\n", task->name,
+                task->run_ns / 1e6);
+    }
+    if (result != INTERPRET_OK)
+    {
+        (*failed)++;
+    }
+
+    free_vm();
+    task->done = true;
+    return true;
+}
+
+int run_scheduler(Scheduler* sched)
+{
+    VM outer = vm;
+    int failed = 0;
+    int left = 0;
+    for (int i = 0; i < sched->count; i++)
+    {
+        left += !sched->tasks[i].done;
+    }
+
+    while (left > 0)
+    {
+        for (int i = 0; i < sched->count; i++)
+        {
+            Task* task = &sched->tasks[i];
+            if (!task->done && run_turn(sched, task, &failed))
+            {
+                left--;
+            }
+        }
+    }
+
+    vm = outer;
+    return failed;
+}
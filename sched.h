@@ -0,0 +1,42 @@
+#pragma once
+
+#include "common.h"
+#include "vm.h"
+
+// instructions each script gets before it's the next one's turn (see resume())
+#define DEFAULT_SLICE 10000
+
+// one script, with a whole vm of its own
+typedef struct Task
+{
+    // swapped into the global `vm` for its turn, and back out after
+    VM vm;
+    const char* name;
+    // how long it's been running, in total
+    uint64_t run_ns;
+    bool done;
+} Task;
+
+// runs many scripts on one thread, taking turns: a script that loops forever
+// only slows the others down, and can be stopped
+typedef struct Scheduler
+{
+    Task* tasks;
+    int count;
+    int capacity;
+
+    int64_t slice;
+    // a script that runs for longer than this is stopped, 0 means never
+    uint64_t timeout_ns;
+} Scheduler;
+
+void init_scheduler(Scheduler* sched, int64_t slice, uint64_t timeout_ns);
+void free_scheduler(Scheduler* sched);
+
+// compiles `source` in a new vm, false if it doesn't compile. `name` is
+// only used in messages
+bool spawn(Scheduler* sched, const char* name, const char* source);
+
+// round robin until every script has finished, failed or timed out.
+// returns how many of them didn't finish successfully
+int run_scheduler(Scheduler* sched);
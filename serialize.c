@@ -0,0 +1,328 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "serialize.h"
+#include "vm.h"
+
+static bool is_global_op(uint8_t op)
+{
+    return op == OP_GET_GLOBAL || op == OP_DEFINE_GLOBAL ||
+           op == OP_SET_GLOBAL || op == OP_INC_GLOBAL ||
+           op == OP_ADD_CONST_GLOBAL;
+}
+
+// offsets of the global operands of the instruction at `offset`, there can be
+// a few in a superinstruction
+static int global_operands(uint8_t* code, int offset, int* operands)
+{
+    const Superinstr* super = get_superinstr(code[offset]);
+    if (super == NULL)
+    {
+        operands[0] = offset + 1;
+        return is_global_op(code[offset]) ? 1 : 0;
+    }
+
+    int count = 0;
+    int at = offset + 1;
+    for (int i = 0; i < super->op_count; i++)
+    {
+        if (is_global_op(super->ops[i]))
+        {
+            operands[count++] = at;
+        }
+        at += instr_length(super->ops[i]) - 1;
+    }
+    return count;
+}
+
+static void write_int(FILE* file, int32_t value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+static bool read_int(FILE* file, int32_t* value)
+{
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+// a length read from the file can't be more than what's left of it, so a
+// broken one fails here instead of allocating gigabytes first
+static bool fits_in_file(FILE* file, int64_t bytes)
+{
+    long at = ftell(file);
+    if (at < 0 || fseek(file, 0L, SEEK_END) != 0)
+    {
+        return false;
+    }
+    long end = ftell(file);
+    fseek(file, at, SEEK_SET);
+    return bytes <= (int64_t)end - at;
+}
+
+static void write_string(FILE* file, const char* chars, int length)
+{
+    write_int(file, length);
+    fwrite(chars, 1, length, file);
+}
+
+// reads a string and interns it. `buf` is grown as needed
+static bool read_string(FILE* file, char** buf, int* buf_size, int* length)
+{
+    int32_t len;
+    if (!read_int(file, &len) || len < 0 || !fits_in_file(file, len))
+    {
+        return false;
+    }
+
+    if (len > *buf_size)
+    {
+        *buf = GROW_ARRAY(char, *buf, *buf_size, len);
+        *buf_size = len;
+    }
+
+    *length = len;
+    return fread(*buf, 1, len, file) == (size_t)len;
+}
+
+static void write_value(FILE* file, Value value)
+{
+    fputc(value.type, file);
+    switch (value.type)
+    {
+    case VAL_BOOL:
+        fputc(AS_BOOL(value), file);
+        break;
+    case VAL_NUMBER:
+        fwrite(&AS_NUM(value), sizeof(double), 1, file);
+        break;
+    case VAL_INT:
+        fwrite(&AS_INT(value), sizeof(int64_t), 1, file);
+        break;
+    case VAL_SHORT_STR:
+        fwrite(value.as.short_str, 1, SHORT_STR_MAX + 1, file);
+        break;
+    case VAL_OBJ:
+        // constants are only ever strings
+        write_string(file, AS_STRING(value)->chars, AS_STRING(value)->length);
+        break;
+    default:
+        break;
+    }
+}
+
+static bool read_value(FILE* file, Value* value, char** buf, int* buf_size)
+{
+    int type = fgetc(file);
+    switch (type)
+    {
+    case VAL_NIL:
+        *value = NIL_VAL;
+        return true;
+    case VAL_BOOL:
+        *value = BOOL_VAL(fgetc(file) == 1);
+        return true;
+    case VAL_NUMBER:
+    {
+        double number;
+        if (fread(&number, sizeof(double), 1, file) != 1)
+        {
+            return false;
+        }
+        *value = NUM_VAL(number);
+        return true;
+    }
+    case VAL_INT:
+    {
+        int64_t integer;
+        if (fread(&integer, sizeof(int64_t), 1, file) != 1)
+        {
+            return false;
+        }
+        *value = INT_VAL(integer);
+        return true;
+    }
+    // run() trusts a string's length, so it's checked here. copy_string()
+    // zeroes the padding that equality compares
+    case VAL_SHORT_STR:
+    {
+        char chars[SHORT_STR_MAX + 1];
+        if (fread(chars, 1, SHORT_STR_MAX + 1, file) != SHORT_STR_MAX + 1)
+        {
+            return false;
+        }
+        int length = (uint8_t)chars[SHORT_STR_MAX];
+        if (length > SHORT_STR_MAX)
+        {
+            return false;
+        }
+        *value = copy_string(chars, length);
+        return true;
+    }
+    // the shorter ones would have been short strings
+    case VAL_OBJ:
+    {
+        int length;
+        if (!read_string(file, buf, buf_size, &length) ||
+            length <= SHORT_STR_MAX)
+        {
+            return false;
+        }
+        *value = OBJ_VAL(intern_string(*buf, length));
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+bool save_chunk(FILE* file, Chunk* chunk)
+{
+    // global operands are rewritten to indices into a list of names that is
+    // saved after the code
+    uint8_t* code = ALLOCATE(uint8_t, chunk->count);
+    memcpy(code, chunk->code, chunk->count);
+
+    int* name_index = ALLOCATE(int, vm.globals.count + 1);
+    int* names = ALLOCATE(int, vm.globals.count + 1);
+    int name_count = 0;
+    for (int i = 0; i < vm.globals.count; i++)
+    {
+        name_index[i] = -1;
+    }
+
+    for (int offset = 0; offset < chunk->count;
+         offset += instr_length(code[offset]))
+    {
+        int operands[SUPERINSTR_MAX_OPS];
+        int operand_count = global_operands(code, offset, operands);
+        for (int i = 0; i < operand_count; i++)
+        {
+            uint8_t* operand = &code[operands[i]];
+            int slot = (operand[0] << 8) | operand[1];
+            if (name_index[slot] == -1)
+            {
+                name_index[slot] = name_count;
+                names[name_count++] = slot;
+            }
+            operand[0] = (uint8_t)(name_index[slot] >> 8);
+            operand[1] = (uint8_t)(name_index[slot] & 0xff);
+        }
+    }
+
+    write_int(file, chunk->count);
+    fwrite(code, 1, chunk->count, file);
+    fwrite(chunk->lines, sizeof(int), chunk->count, file);
+
+    write_int(file, chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++)
+    {
+        write_value(file, chunk->constants.values[i]);
+    }
+
+    write_int(file, name_count);
+    for (int i = 0; i < name_count; i++)
+    {
+        const char* name = global_name(names[i]);
+        write_string(file, name, (int)strlen(name));
+    }
+
+    FREE_ARRAY(int, names, vm.globals.count + 1);
+    FREE_ARRAY(int, name_index, vm.globals.count + 1);
+    FREE_ARRAY(uint8_t, code, chunk->count);
+    return !ferror(file);
+}
+
+bool load_chunk(FILE* file, Chunk* chunk)
+{
+    char* buf = NULL;
+    int buf_size = 0;
+    bool ok = false;
+    int32_t count;
+
+    if (!read_int(file, &count) || count < 0 ||
+        !fits_in_file(file, (int64_t)count * (int64_t)(1 + sizeof(int))))
+    {
+        return false;
+    }
+
+    uint8_t* code = ALLOCATE(uint8_t, count);
+    int* lines = ALLOCATE(int, count);
+    if (fread(code, 1, count, file) != (size_t)count ||
+        fread(lines, sizeof(int), count, file) != (size_t)count)
+    {
+        goto done;
+    }
+
+    int32_t constant_count;
+    // each one is at least its type
+    if (!read_int(file, &constant_count) || constant_count < 0 ||
+        !fits_in_file(file, constant_count))
+    {
+        goto done;
+    }
+    for (int i = 0; i < constant_count; i++)
+    {
+        Value value;
+        if (!read_value(file, &value, &buf, &buf_size))
+        {
+            goto done;
+        }
+        add_constant(chunk, value);
+    }
+
+    int32_t name_count;
+    if (!read_int(file, &name_count) || name_count < 0 ||
+        !fits_in_file(file, (int64_t)name_count * (int64_t)sizeof(int32_t)))
+    {
+        goto done;
+    }
+    int* slots = ALLOCATE(int, name_count);
+    for (int i = 0; i < name_count; i++)
+    {
+        int length;
+        if (!read_string(file, &buf, &buf_size, &length))
+        {
+            FREE_ARRAY(int, slots, name_count);
+            goto done;
+        }
+        slots[i] = global_slot(intern_string(buf, length));
+    }
+
+    // point the global operands at this vm's slots
+    ok = true;
+    for (int offset = 0; offset < count; offset += instr_length(code[offset]))
+    {
+        if (offset + instr_length(code[offset]) > count)
+        {
+            ok = false;
+            break;
+        }
+        int operands[SUPERINSTR_MAX_OPS];
+        int operand_count = global_operands(code, offset, operands);
+        for (int i = 0; i < operand_count; i++)
+        {
+            uint8_t* operand = &code[operands[i]];
+            int index = (operand[0] << 8) | operand[1];
+            if (index >= name_count)
+            {
+                ok = false;
+                break;
+            }
+            operand[0] = (uint8_t)(slots[index] >> 8);
+            operand[1] = (uint8_t)(slots[index] & 0xff);
+        }
+    }
+    FREE_ARRAY(int, slots, name_count);
+
+    for (int i = 0; ok && i < count; i++)
+    {
+        write_chunk(chunk, code[i], lines[i]);
+    }
+
+done:
+    FREE_ARRAY(char, buf, buf_size);
+    FREE_ARRAY(int, lines, count);
+    FREE_ARRAY(uint8_t, code, count);
+    return ok;
+}
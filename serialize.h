@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "chunk.h"
+
+// bump whenever the plain opcodes or their operands change (or what something
+// compiles to, like `a++`), so old caches are ignored
+#define OPCODE_VERSION 10
+// regenerating superinstr.h renumbers the superinstructions
+#define BYTECODE_VERSION (OPCODE_VERSION | (SUPERINSTR_VERSION << 8))
+
+// writes the chunk in a form that can be loaded into another vm: globals are
+// saved by name, since their indices depend on the vm
+bool save_chunk(FILE* file, Chunk* chunk);
+// the chunk has to be reachable by the gc (its strings are allocated as
+// they're read). returns false if the file is broken
+bool load_chunk(FILE* file, Chunk* chunk);
@@ -0,0 +1,23 @@
+#pragma once
+
+// generated by tools/superinstr.c from clox.ngrams, don't edit
+#define SUPERINSTR_VERSION 0x50b3
+
+// S2(name, a, b) and S3(name, a, b, c), each with roughly how often it ran
+#define SUPERINSTRS(S2, S3) \
+    S3(OP_CONSTANT__LESS__POP_JUMP_IF_FALSE, OP_CONSTANT, OP_LESS, OP_POP_JUMP_IF_FALSE) /* 5422004 */ \
+    S3(OP_CONSTANT__ADD__SET_LOCAL, OP_CONSTANT, OP_ADD, OP_SET_LOCAL) /* 3495500 */ \
+    S3(OP_CONSTANT__ADD__SET_GLOBAL, OP_CONSTANT, OP_ADD, OP_SET_GLOBAL) /* 2240000 */ \
+    S3(OP_CONSTANT__MULT__ADD, OP_CONSTANT, OP_MULT, OP_ADD) /* 2000000 */ \
+    S3(OP_POP__GET_LOCAL__SET_LOCAL, OP_POP, OP_GET_LOCAL, OP_SET_LOCAL) /* 2000000 */ \
+    S2(OP_POP__LOOP, OP_POP, OP_LOOP) /* 5221000 */ \
+    S2(OP_GET_LOCAL__CONSTANT, OP_GET_LOCAL, OP_CONSTANT) /* 8903001 */ \
+    S3(OP_GET_LOCAL__CONSTANT__LESS, OP_GET_LOCAL, OP_CONSTANT, OP_LESS) /* 4202001 */ \
+    S3(OP_GET_LOCAL__GET_LOCAL__ADD, OP_GET_LOCAL, OP_GET_LOCAL, OP_ADD) /* 2000000 */ \
+    S3(OP_GET_LOCAL__SET_LOCAL__POP, OP_GET_LOCAL, OP_SET_LOCAL, OP_POP) /* 4000000 */ \
+    S3(OP_SET_LOCAL__POP__POP, OP_SET_LOCAL, OP_POP, OP_POP) /* 2001000 */ \
+    S3(OP_SET_LOCAL__POP__GET_LOCAL, OP_SET_LOCAL, OP_POP, OP_GET_LOCAL) /* 4505500 */ \
+    S2(OP_GET_GLOBAL__CONSTANT, OP_GET_GLOBAL, OP_CONSTANT) /* 6460003 */ \
+    S3(OP_SET_GLOBAL__POP__GET_GLOBAL, OP_SET_GLOBAL, OP_POP, OP_GET_GLOBAL) /* 2020000 */ \
+    S3(OP_ADD__SET_LOCAL__POP, OP_ADD, OP_SET_LOCAL, OP_POP) /* 3495500 */ \
+    S3(OP_ADD__SET_GLOBAL__POP, OP_ADD, OP_SET_GLOBAL, OP_POP) /* 4440000 */
@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "memory.h"
+#include "table.h"
+
+// grow once 3/4 full
+#define TABLE_MAX_LOAD 0.75
+
+#define IS_TOMBSTONE(entry) ((entry)->key == NULL && (entry)->value == -1)
+
+void init_table(Table* table)
+{
+    table->count = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void free_table(Table* table)
+{
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+    init_table(table);
+}
+
+// returns the entry holding `key`, or the slot it should go in
+static Entry* find_entry(Entry* entries, int capacity, ObjString* key,
+                         uint32_t hash)
+{
+    // capacity is a power of 2, so `& mask` is `% capacity`
+    uint32_t mask = capacity - 1;
+    uint32_t index = hash & mask;
+    Entry* tombstone = NULL;
+
+    while (true)
+    {
+        Entry* entry = &entries[index];
+        if (entry->key == key)
+        {
+            return entry;
+        }
+
+        if (entry->key == NULL)
+        {
+            if (!IS_TOMBSTONE(entry))
+            {
+                // reuse a tombstone we passed if there was one
+                return tombstone != NULL ? tombstone : entry;
+            }
+            if (tombstone == NULL)
+            {
+                tombstone = entry;
+            }
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+static void adjust_capacity(Table* table, int capacity)
+{
+    Entry* entries = ALLOCATE(Entry, capacity);
+    memset(entries, 0, sizeof(Entry) * capacity);
+
+    // tombstones aren't copied over
+    table->count = 0;
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &table->entries[i];
+        if (entry->key == NULL)
+        {
+            continue;
+        }
+
+        Entry* dest = find_entry(entries, capacity, entry->key, entry->hash);
+        *dest = *entry;
+        table->count++;
+    }
+
+    FREE_ARRAY(Entry, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+bool table_get(Table* table, ObjString* key, int* value)
+{
+    if (table->count == 0)
+    {
+        return false;
+    }
+
+    Entry* entry = find_entry(table->entries, table->capacity, key, key->hash);
+    if (entry->key == NULL)
+    {
+        return false;
+    }
+
+    *value = entry->value;
+    return true;
+}
+
+bool table_set(Table* table, ObjString* key, int value)
+{
+    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    {
+        adjust_capacity(table, GROW_CAPACITY(table->capacity));
+    }
+
+    Entry* entry = find_entry(table->entries, table->capacity, key, key->hash);
+    bool is_new = entry->key == NULL;
+    // reusing a tombstone doesn't change the count, it was already counted
+    if (is_new && !IS_TOMBSTONE(entry))
+    {
+        table->count++;
+    }
+
+    entry->key = key;
+    entry->hash = key->hash;
+    entry->value = value;
+    return is_new;
+}
+
+bool table_delete(Table* table, ObjString* key)
+{
+    if (table->count == 0)
+    {
+        return false;
+    }
+
+    Entry* entry = find_entry(table->entries, table->capacity, key, key->hash);
+    if (entry->key == NULL)
+    {
+        return false;
+    }
+
+    entry->key = NULL;
+    entry->value = -1;
+    return true;
+}
+
+void mark_table(Table* table)
+{
+    for (int i = 0; i < table->capacity; i++)
+    {
+        gc_visit_obj((Obj**)&table->entries[i].key);
+    }
+}
+
+void table_remove_dead(Table* table)
+{
+    for (int i = 0; i < table->capacity; i++)
+    {
+        Entry* entry = &table->entries[i];
+        if (entry->key != NULL && !gc_is_alive((Obj**)&entry->key))
+        {
+            entry->key = NULL;
+            entry->value = -1;
+        }
+    }
+}
+
+ObjString* table_find_string(Table* table, const char* chars, int length,
+                             uint32_t hash)
+{
+    if (table->count == 0)
+    {
+        return NULL;
+    }
+
+    uint32_t mask = table->capacity - 1;
+    uint32_t index = hash & mask;
+    while (true)
+    {
+        Entry* entry = &table->entries[index];
+        if (entry->key == NULL)
+        {
+            if (!IS_TOMBSTONE(entry))
+            {
+                return NULL;
+            }
+        }
+        // the hash is checked first, it's right there in the entry
+        else if (entry->hash == hash && entry->key->length == length &&
+                 memcmp(entry->key->chars, chars, length) == 0)
+        {
+            return entry->key;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
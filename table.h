@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+
+// keys are interned strings, so comparing keys is comparing pointers
+typedef struct Entry
+{
+    ObjString* key;
+    // copy of key->hash, so probing never has to touch the string itself
+    uint32_t hash;
+    int value;
+} Entry;
+
+// open addressing with linear probing, capacity is always a power of 2
+typedef struct Table
+{
+    // includes tombstones
+    int count;
+    int capacity;
+    Entry* entries;
+} Table;
+
+void init_table(Table* table);
+void free_table(Table* table);
+
+bool table_get(Table* table, ObjString* key, int* value);
+// returns true if the key is new
+bool table_set(Table* table, ObjString* key, int value);
+bool table_delete(Table* table, ObjString* key);
+
+// for tables that keep their keys alive (vm.global_names)
+void mark_table(Table* table);
+// for weak tables (vm.strings): drops every key the collector found dead
+void table_remove_dead(Table* table);
+
+// used for interning, where we don't have an ObjString yet
+ObjString* table_find_string(Table* table, const char* chars, int length,
+                             uint32_t hash);
@@ -0,0 +1,30 @@
+#include "timer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+uint64_t now_ns()
+{
+    static LARGE_INTEGER freq;
+    if (freq.QuadPart == 0)
+    {
+        QueryPerformanceFrequency(&freq);
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // split up so the multiply doesn't overflow
+    uint64_t secs = now.QuadPart / freq.QuadPart;
+    uint64_t rest = now.QuadPart % freq.QuadPart;
+    return secs * 1000000000ull + rest * 1000000000ull / freq.QuadPart;
+}
+#else
+#include <time.h>
+
+uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
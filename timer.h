@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// monotonic clock in nanoseconds, only useful for differences
+uint64_t now_ns();
+
+// a cheap timestamp, the unit depends on the machine: time something with
+// now_ns() as well to find out what it is
+static inline uint64_t now_ticks()
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
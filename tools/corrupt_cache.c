@@ -0,0 +1,134 @@
+// checks that a broken .loxc can't crash clox: each byte of the cache is
+// overwritten in turn, with a few values, and the script that imports it is
+// run every time. build clox with -fsanitize=address to catch reads past the
+// end of something too, then:
+//   corrupt_cache ./clox main.lox lib.loxc
+// the cache gets put back the way it was. clox can only ever exit with one of
+// its own exit codes, anything else is reported (an asan report exits with 1)
+// this is its own program, it's not part of clox
+#define _CRT_SECURE_NO_DEPRECATE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#include <sys/wait.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#define MAX_COMMAND 4096
+
+static uint8_t* read_all(const char* path, long* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    fseek(file, 0L, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    uint8_t* bytes = malloc(*size > 0 ? *size : 1);
+    if (bytes == NULL || fread(bytes, 1, *size, file) != (size_t)*size)
+    {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(file);
+    return bytes;
+}
+
+static bool write_all(const char* path, const uint8_t* bytes, long size)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    bool ok = fwrite(bytes, 1, size, file) == (size_t)size;
+    fclose(file);
+    return ok;
+}
+
+// main.c's exit codes: ok, usage, compile error, runtime error, io error
+static bool clox_exit(int status)
+{
+#ifdef _WIN32
+    int code = status;
+#else
+    if (status == -1 || !WIFEXITED(status))
+    {
+        return false;
+    }
+    int code = WEXITSTATUS(status);
+#endif
+    return code == 0 || code == 64 || code == 65 || code == 70 || code == 74;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "Usage: corrupt_cache clox script.lox lib.loxc\n");
+        return 64;
+    }
+
+    long size;
+    uint8_t* good = read_all(argv[3], &size);
+    if (good == NULL)
+    {
+        fprintf(stderr, "Could not read \"%s\".\n", argv[3]);
+        return 74;
+    }
+
+    char command[MAX_COMMAND];
+    snprintf(command, sizeof(command), "\"%s\" \"%s\" > %s 2>&1", argv[1],
+             argv[2], NULL_DEVICE);
+
+    uint8_t* bad = malloc(size > 0 ? size : 1);
+    int runs = 0;
+    int failed = 0;
+    for (long offset = 0; offset < size; offset++)
+    {
+        // the edges of every range, and something that's probably in none
+        const uint8_t values[] = {0x00, 0x01, 0x7f, 0x80, 0xff,
+                                  (uint8_t)(good[offset] ^ 0x56)};
+        for (size_t i = 0; i < sizeof(values); i++)
+        {
+            if (values[i] == good[offset])
+            {
+                continue;
+            }
+
+            memcpy(bad, good, size);
+            bad[offset] = values[i];
+            if (!write_all(argv[3], bad, size))
+            {
+                fprintf(stderr, "Could not write \"%s\".\n", argv[3]);
+                free(bad);
+                free(good);
+                return 74;
+            }
+
+            int status = system(command);
+            runs++;
+            if (!clox_exit(status))
+            {
+                printf("byte %ld = 0x%02x: exit status %d\n", offset,
+                       values[i], status);
+                failed++;
+            }
+        }
+    }
+
+    write_all(argv[3], good, size);
+    printf("%d runs, %d failed\n", runs, failed);
+    free(bad);
+    free(good);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+// picks superinstructions from an opcode profile and writes superinstr.h
+//
+// build a vm with PROFILE_OPCODES (common.h), run it on whatever you want it
+// to be fast at (the counts add up in clox.ngrams), then:
+//   superinstr clox.ngrams chunk.h vm.c [max] > superinstr.h
+// this is its own program, it's not part of clox
+#define _CRT_SECURE_NO_DEPRECATE
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OPS 256
+#define MAX_NAME 64
+#define MAX_CANDIDATES 4096
+#define DEFAULT_MAX_SUPERINSTRS 16
+// anything saving less than this fraction of the dispatches isn't worth an
+// opcode
+#define MIN_SHARE 0.005
+
+typedef struct Candidate
+{
+    int ops[3];
+    int op_count;
+    uint64_t count;
+    // dispatches saved each time it runs, less once part of it is fused
+    int saved;
+    bool picked;
+} Candidate;
+
+static char op_names[MAX_OPS][MAX_NAME];
+static int op_count = 0;
+// ops with a BODY_ macro in vm.c, the others can't be fused
+static bool fusable[MAX_OPS];
+
+static Candidate candidates[MAX_CANDIDATES];
+static int candidate_count = 0;
+
+static FILE* open_file(const char* path, const char* mode)
+{
+    FILE* file = fopen(path, mode);
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        exit(74);
+    }
+    return file;
+}
+
+// copies the OP_ identifier at the start of `line` (after spaces) to `name`
+static bool read_op_name(const char* line, char* name)
+{
+    while (isspace((unsigned char)*line))
+    {
+        line++;
+    }
+    if (strncmp(line, "OP_", 3) != 0)
+    {
+        return false;
+    }
+
+    int length = 0;
+    while ((isalnum((unsigned char)line[length]) || line[length] == '_') &&
+           length < MAX_NAME - 1)
+    {
+        name[length] = line[length];
+        length++;
+    }
+    name[length] = '\0';
+    return true;
+}
+
+static int find_op(const char* name)
+{
+    for (int i = 0; i < op_count; i++)
+    {
+        if (strcmp(op_names[i], name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// the plain opcodes, in order, from the OpCode enum
+static void read_opcodes(const char* path)
+{
+    FILE* file = open_file(path, "r");
+    char line[256];
+    bool in_enum = false;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (!in_enum)
+        {
+            in_enum = strstr(line, "typedef enum OpCode") != NULL;
+            continue;
+        }
+
+        // the superinstructions start with a #define
+        if (line[0] == '#' || line[0] == '}')
+        {
+            break;
+        }
+        if (op_count < MAX_OPS && read_op_name(line, op_names[op_count]))
+        {
+            op_count++;
+        }
+    }
+    fclose(file);
+}
+
+static void read_fusable(const char* path)
+{
+    FILE* file = open_file(path, "r");
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char name[MAX_NAME];
+        if (strncmp(line, "#define BODY_", 13) == 0 &&
+            read_op_name(line + 13, name) && find_op(name) != -1)
+        {
+            fusable[find_op(name)] = true;
+        }
+    }
+    fclose(file);
+}
+
+static uint64_t read_profile(const char* path)
+{
+    FILE* file = open_file(path, "r");
+    uint64_t total = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long long count;
+        int ops[3];
+        int fields =
+            sscanf(line, "%llu %d %d %d", &count, &ops[0], &ops[1], &ops[2]);
+        if (fields < 3)
+        {
+            continue;
+        }
+
+        int n = fields - 1;
+        bool ok = true;
+        for (int i = 0; i < n; i++)
+        {
+            ok &= ops[i] >= 0 && ops[i] < op_count && fusable[ops[i]];
+        }
+        if (n == 2)
+        {
+            // every pair is one instruction that ran
+            total += count;
+        }
+        if (!ok || candidate_count == MAX_CANDIDATES)
+        {
+            continue;
+        }
+
+        Candidate* candidate = &candidates[candidate_count++];
+        memcpy(candidate->ops, ops, sizeof(ops));
+        candidate->op_count = n;
+        candidate->count = count;
+        candidate->saved = n - 1;
+        candidate->picked = false;
+    }
+    fclose(file);
+    return total;
+}
+
+// is `part` (a pair) the start or the end of `whole` (a triple)
+static bool overlaps(Candidate* part, Candidate* whole)
+{
+    return (part->ops[0] == whole->ops[0] && part->ops[1] == whole->ops[1]) ||
+           (part->ops[0] == whole->ops[1] && part->ops[1] == whole->ops[2]);
+}
+
+// greedy: take the one that saves the most dispatches, then account for the
+// ones that overlap with it
+static int pick(int max, uint64_t min_saved)
+{
+    int picked = 0;
+    while (picked < max)
+    {
+        Candidate* best = NULL;
+        for (int i = 0; i < candidate_count; i++)
+        {
+            Candidate* c = &candidates[i];
+            if (!c->picked && (best == NULL || c->count * c->saved >
+                                                   best->count * best->saved))
+            {
+                best = c;
+            }
+        }
+        if (best == NULL || best->count * best->saved < min_saved)
+        {
+            break;
+        }
+
+        best->picked = true;
+        picked++;
+
+        for (int i = 0; i < candidate_count; i++)
+        {
+            Candidate* c = &candidates[i];
+            if (c->picked)
+            {
+                continue;
+            }
+            // most of those runs are now the triple
+            if (best->op_count == 3 && c->op_count == 2 && overlaps(c, best))
+            {
+                c->count -= c->count < best->count ? c->count : best->count;
+            }
+            // the triple only saves one more dispatch than the pair
+            if (best->op_count == 2 && c->op_count == 3 && overlaps(best, c))
+            {
+                c->saved = 1;
+            }
+        }
+    }
+    return picked;
+}
+
+static void superinstr_name(Candidate* c, char* name)
+{
+    strcpy(name, "OP");
+    for (int i = 0; i < c->op_count; i++)
+    {
+        strcat(name, i == 0 ? "_" : "__");
+        strcat(name, op_names[c->ops[i]] + 3);
+    }
+}
+
+static void write_header(FILE* out, const char* profile)
+{
+    // changes whenever the set does, so caches of old bytecode are ignored
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        Candidate* c = &candidates[i];
+        for (int j = 0; c->picked && j < c->op_count; j++)
+        {
+            hash ^= (uint32_t)c->ops[j] + 1;
+            hash *= 16777619;
+        }
+    }
+
+    fprintf(out, "#pragma once\n\n");
+    fprintf(out, "// generated by tools/superinstr.c from %s, don't edit\n",
+            profile);
+    fprintf(out, "#define SUPERINSTR_VERSION 0x%04x\n\n",
+            (hash ^ (hash >> 16)) & 0xffff);
+    fprintf(out, "// S2(name, a, b) and S3(name, a, b, c), each with "
+                 "roughly how often it ran\n");
+    fprintf(out, "#define SUPERINSTRS(S2, S3)");
+
+    for (int i = 0; i < candidate_count; i++)
+    {
+        Candidate* c = &candidates[i];
+        if (!c->picked)
+        {
+            continue;
+        }
+
+        char name[MAX_NAME * 3 + 8];
+        superinstr_name(c, name);
+        fprintf(out, " \\\n    S%d(%s", c->op_count, name);
+        for (int j = 0; j < c->op_count; j++)
+        {
+            fprintf(out, ", %s", op_names[c->ops[j]]);
+        }
+        fprintf(out, ") /* %llu */", (unsigned long long)c->count);
+    }
+    fprintf(out, "\n");
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 4 || argc > 5)
+    {
+        fprintf(stderr, "Usage: superinstr profile chunk.h vm.c [max] > "
+                        "superinstr.h\n");
+        return 64;
+    }
+
+    read_opcodes(argv[2]);
+    read_fusable(argv[3]);
+    uint64_t total = read_profile(argv[1]);
+
+    int max = argc == 5 ? atoi(argv[4]) : DEFAULT_MAX_SUPERINSTRS;
+    if (max > MAX_OPS - op_count)
+    {
+        max = MAX_OPS - op_count;
+    }
+
+    int picked = pick(max, (uint64_t)(total * MIN_SHARE) + 1);
+    write_header(stdout, argv[1]);
+    fprintf(stderr, "%d superinstructions from %d candidates\n", picked,
+            candidate_count);
+    return 0;
+}
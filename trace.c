@@ -0,0 +1,252 @@
+#define _CRT_SECURE_NO_DEPRECATE
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "serialize.h"
+#include "trace.h"
+#include "vm.h"
+
+#define TRACE_MAGIC 0x52544c43 // "CLTR"
+
+typedef struct TraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t chunk_count;
+    // events in the file
+    uint64_t event_count;
+    // events recorded in total, the older ones were overwritten
+    uint64_t total_events;
+    double ns_per_tick;
+} TraceHeader;
+
+void init_tracer(Tracer* tracer)
+{
+    tracer->enabled = false;
+    tracer->path = TRACE_DEFAULT_PATH;
+    tracer->events = NULL;
+    tracer->count = 0;
+    tracer->last_tick = 0;
+    tracer->start_tick = 0;
+    tracer->start_ns = 0;
+    tracer->chunks = NULL;
+    tracer->chunk_count = 0;
+    tracer->chunk_capacity = 0;
+    tracer->chunk = 0;
+}
+
+void free_tracer(Tracer* tracer)
+{
+    if (tracer->events != NULL)
+    {
+        FREE_ARRAY(TraceEvent, tracer->events, TRACE_CAPACITY);
+    }
+    FREE_ARRAY(Chunk*, tracer->chunks, tracer->chunk_capacity);
+    init_tracer(tracer);
+}
+
+void trace_enable(Tracer* tracer, const char* path)
+{
+    if (tracer->events == NULL)
+    {
+        tracer->events = ALLOCATE(TraceEvent, TRACE_CAPACITY);
+    }
+    if (path != NULL)
+    {
+        tracer->path = path;
+    }
+
+    tracer->enabled = true;
+    tracer->start_tick = tracer->last_tick = now_ticks();
+    tracer->start_ns = now_ns();
+}
+
+void trace_set_chunk(Tracer* tracer, Chunk* chunk)
+{
+    if (!tracer->enabled)
+    {
+        return;
+    }
+
+    for (int i = 0; i < tracer->chunk_count; i++)
+    {
+        if (tracer->chunks[i] == chunk)
+        {
+            tracer->chunk = (uint16_t)i;
+            return;
+        }
+    }
+
+    if (tracer->chunk_count == TRACE_MAX_CHUNKS)
+    {
+        // the events will be attributed to the wrong chunk, but that's all
+        return;
+    }
+
+    if (tracer->chunk_capacity < tracer->chunk_count + 1)
+    {
+        int old_capacity = tracer->chunk_capacity;
+        tracer->chunk_capacity = GROW_CAPACITY(old_capacity);
+        tracer->chunks = GROW_ARRAY(Chunk*, tracer->chunks, old_capacity,
+                                    tracer->chunk_capacity);
+    }
+
+    tracer->chunk = (uint16_t)tracer->chunk_count;
+    tracer->chunks[tracer->chunk_count++] = chunk;
+}
+
+void trace_forget_chunk(Tracer* tracer, Chunk* chunk)
+{
+    for (int i = 0; i < tracer->chunk_count; i++)
+    {
+        if (tracer->chunks[i] == chunk)
+        {
+            tracer->chunks[i] = NULL;
+        }
+    }
+}
+
+bool trace_dump(Tracer* tracer)
+{
+    if (tracer->events == NULL)
+    {
+        return false;
+    }
+
+    FILE* file = fopen(tracer->path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not write trace to \"%s\".\n", tracer->path);
+        return false;
+    }
+
+    uint64_t elapsed_ticks = now_ticks() - tracer->start_tick;
+    uint64_t elapsed_ns = now_ns() - tracer->start_ns;
+
+    TraceHeader header;
+    header.magic = TRACE_MAGIC;
+    header.version = BYTECODE_VERSION;
+    header.event_size = sizeof(TraceEvent);
+    header.chunk_count = tracer->chunk_count;
+    header.total_events = tracer->count;
+    header.event_count =
+        tracer->count < TRACE_CAPACITY ? tracer->count : TRACE_CAPACITY;
+    header.ns_per_tick =
+        elapsed_ticks == 0 ? 1.0 : (double)elapsed_ns / (double)elapsed_ticks;
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (int i = 0; i < tracer->chunk_count; i++)
+    {
+        Chunk* chunk = tracer->chunks[i];
+        fputc(chunk != NULL, file);
+        if (chunk != NULL)
+        {
+            save_chunk(file, chunk);
+        }
+    }
+
+    // oldest first: if the buffer wrapped, that's the slot after the newest
+    uint64_t first = tracer->count - header.event_count;
+    for (uint64_t i = first; i < tracer->count; i++)
+    {
+        fwrite(&tracer->events[i & (TRACE_CAPACITY - 1)], sizeof(TraceEvent),
+               1, file);
+    }
+
+    fclose(file);
+    fprintf(stderr, "Wrote %llu trace events to \"%s\".\n",
+            (unsigned long long)header.event_count, tracer->path);
+    return true;
+}
+
+bool trace_decode(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open trace \"%s\".\n", path);
+        return false;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != TRACE_MAGIC || header.version != BYTECODE_VERSION ||
+        header.event_size != sizeof(TraceEvent))
+    {
+        fprintf(stderr, "\"%s\" is not a trace from this version.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // the chunks' strings aren't reachable from any root while decoding
+    vm.heap.paused = true;
+
+    Chunk* chunks = ALLOCATE(Chunk, header.chunk_count);
+    bool* present = ALLOCATE(bool, header.chunk_count);
+    bool ok = true;
+    for (uint32_t i = 0; i < header.chunk_count; i++)
+    {
+        init_chunk(&chunks[i]);
+        present[i] = false;
+    }
+    for (uint32_t i = 0; i < header.chunk_count; i++)
+    {
+        present[i] = fgetc(file) == 1;
+        if (present[i] && !load_chunk(file, &chunks[i]))
+        {
+            ok = false;
+            break;
+        }
+    }
+
+    if (ok)
+    {
+        printf("== %llu of %llu events ==\n",
+               (unsigned long long)header.event_count,
+               (unsigned long long)header.total_events);
+        printf("%10s %10s %5s %5s\n", "event", "+ns", "depth", "chunk");
+
+        uint64_t first = header.total_events - header.event_count;
+        TraceEvent event;
+        for (uint64_t i = 0; i < header.event_count; i++)
+        {
+            if (fread(&event, sizeof(event), 1, file) != 1)
+            {
+                ok = false;
+                break;
+            }
+
+            printf("%10llu %10.0f %5d %5d ", (unsigned long long)(first + i),
+                   event.delta * header.ns_per_tick, event.depth, event.chunk);
+
+            if (event.chunk < header.chunk_count && present[event.chunk] &&
+                event.offset < (uint32_t)chunks[event.chunk].count)
+            {
+                disassemble_instr(&chunks[event.chunk], event.offset);
+            }
+            else
+            {
+                // the chunk was gone by the time the trace was written
+                printf("%04u      opcode %d\n", event.offset, event.op);
+            }
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "Trace \"%s\" is truncated.\n", path);
+    }
+
+    for (uint32_t i = 0; i < header.chunk_count; i++)
+    {
+        free_chunk(&chunks[i]);
+    }
+    FREE_ARRAY(bool, present, header.chunk_count);
+    FREE_ARRAY(Chunk, chunks, header.chunk_count);
+    vm.heap.paused = false;
+    fclose(file);
+    return ok;
+}
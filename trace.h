@@ -0,0 +1,78 @@
+#pragma once
+
+#include "chunk.h"
+#include "common.h"
+#include "timer.h"
+
+// events kept, must be a power of 2
+#define TRACE_CAPACITY (64 * 1024)
+#define TRACE_DEFAULT_PATH "clox.trace"
+// most chunks a trace can refer to
+#define TRACE_MAX_CHUNKS UINT16_MAX
+
+// one executed instruction
+typedef struct TraceEvent
+{
+    // of the instruction, into its chunk's code
+    uint32_t offset;
+    // ticks since the previous event (saturated)
+    uint32_t delta;
+    uint8_t op;
+    // stack depth before the instruction ran (saturated)
+    uint8_t depth;
+    // index into Tracer.chunks
+    uint16_t chunk;
+} TraceEvent;
+
+typedef struct Tracer
+{
+    bool enabled;
+    const char* path;
+
+    // ring buffer, `count` keeps going past the capacity
+    TraceEvent* events;
+    uint64_t count;
+    uint64_t last_tick;
+
+    // to turn ticks into nanoseconds when dumping
+    uint64_t start_tick;
+    uint64_t start_ns;
+
+    // every chunk that ran while tracing, NULL once it's been freed
+    Chunk** chunks;
+    int chunk_count;
+    int chunk_capacity;
+    // the running one
+    uint16_t chunk;
+} Tracer;
+
+void init_tracer(Tracer* tracer);
+void free_tracer(Tracer* tracer);
+
+void trace_enable(Tracer* tracer, const char* path);
+// called whenever the vm switches to running another chunk
+void trace_set_chunk(Tracer* tracer, Chunk* chunk);
+// the chunk is about to be freed, events that refer to it can't be decoded
+void trace_forget_chunk(Tracer* tracer, Chunk* chunk);
+
+// writes the events (oldest first) and every chunk they refer to
+bool trace_dump(Tracer* tracer);
+// prints a dump written by trace_dump, disassembling each instruction
+bool trace_decode(const char* path);
+
+// the hot path, called for every instruction while tracing
+static inline void trace_record(Tracer* tracer, uint32_t offset, uint8_t op,
+                                int depth)
+{
+    uint64_t now = now_ticks();
+    uint64_t delta = now - tracer->last_tick;
+    tracer->last_tick = now;
+
+    TraceEvent* event = &tracer->events[tracer->count & (TRACE_CAPACITY - 1)];
+    event->offset = offset;
+    event->delta = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+    event->op = op;
+    event->depth = depth > UINT8_MAX ? UINT8_MAX : (uint8_t)depth;
+    event->chunk = tracer->chunk;
+    tracer->count++;
+}
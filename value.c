@@ -1,6 +1,11 @@
-#include "value.h"
-#include "memory.h"
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
 
 void init_value_array(ValueArray* array)
 {
@@ -46,13 +51,124 @@ void print_value(Value value)
         // %g chooses between %f (lower precision) or %e (high precision)
         printf("%g", AS_NUM(value));
         break;
+    case VAL_INT:
+        printf("%" PRId64, AS_INT(value));
+        break;
+    case VAL_SHORT_STR:
+        printf("%.*s", SHORT_STR_LENGTH(value), value.as.short_str);
+        break;
+    case VAL_OBJ:
+        print_object(value);
+        break;
+    case VAL_UNDEFINED:
+        printf("<undefined>");
+        break;
+    }
+}
+
+size_t format_chars(const char* chars, size_t length, char* out)
+{
+    if (out != NULL)
+    {
+        memcpy(out, chars, length);
+    }
+    return length;
+}
+
+size_t format_value(Value value, char* out)
+{
+    // the longest is an int: 19 digits and a '-'
+    char number[32];
+    switch (value.type)
+    {
+    case VAL_BOOL:
+        return AS_BOOL(value) ? format_chars("true", 4, out)
+                              : format_chars("false", 5, out);
+    case VAL_NIL:
+        return format_chars("nil", 3, out);
+    case VAL_NUMBER:
+    {
+        int length = snprintf(number, sizeof(number), "%g", AS_NUM(value));
+        return format_chars(number, (size_t)length, out);
+    }
+    case VAL_INT:
+    {
+        int length =
+            snprintf(number, sizeof(number), "%" PRId64, AS_INT(value));
+        return format_chars(number, (size_t)length, out);
+    }
+    case VAL_SHORT_STR:
+        return format_chars(value.as.short_str, SHORT_STR_LENGTH(value), out);
+    case VAL_OBJ:
+        return format_object(value, out);
+    case VAL_UNDEFINED:
+        return format_chars("<undefined>", 11, out);
+    }
+    return 0; // unreachable
+}
+
+// exact: an int that doesn't fit in a double isn't equal to its rounding
+static bool int_equals_num(int64_t a, double b)
+{
+    // 2^63 itself doesn't fit in an int64_t
+    if (b != b || b < -9223372036854775808.0 || b >= 9223372036854775808.0)
+    {
+        return false;
+    }
+    return (double)(int64_t)b == b && (int64_t)b == a;
+}
+
+// arrays and maps never change, so two with the same elements are as good as
+// the same one
+static bool arrays_equal(ObjArray* a, ObjArray* b)
+{
+    if (a->count != b->count)
+    {
+        return false;
+    }
+    for (int i = 0; i < a->count; i++)
+    {
+        if (!values_equal(array_element(a, i), array_element(b, i)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the same keys, each with an equal value
+static bool maps_equal(ObjMap* a, ObjMap* b)
+{
+    if (a->count != b->count)
+    {
+        return false;
+    }
+    for (int i = 0; i < a->capacity; i++)
+    {
+        Value value;
+        if (MAP_CTRL(a)[i] != MAP_EMPTY &&
+            (!map_get(b, a->entries[i].key, &value) ||
+             !values_equal(a->entries[i].value, value)))
+        {
+            return false;
+        }
     }
+    return true;
 }
 
 bool values_equal(Value a, Value b)
 {
     if (a.type != b.type)
     {
+        // 1 == 1.0
+        if (IS_INT(a) && IS_NUM(b))
+        {
+            return int_equals_num(AS_INT(a), AS_NUM(b));
+        }
+        if (IS_NUM(a) && IS_INT(b))
+        {
+            return int_equals_num(AS_INT(b), AS_NUM(a));
+        }
         return false;
     }
 
@@ -64,6 +180,23 @@ bool values_equal(Value a, Value b)
         return true;
     case VAL_NUMBER:
         return AS_NUM(a) == AS_NUM(b);
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
+    case VAL_SHORT_STR:
+        // length byte included, so this is one 8 byte compare
+        return memcmp(a.as.short_str, b.as.short_str, SHORT_STR_MAX + 1) == 0;
+    case VAL_OBJ:
+        if (IS_ARRAY(a) && IS_ARRAY(b))
+        {
+            return AS_OBJ(a) == AS_OBJ(b) ||
+                   arrays_equal(AS_ARRAY(a), AS_ARRAY(b));
+        }
+        if (IS_MAP(a) && IS_MAP(b))
+        {
+            return AS_OBJ(a) == AS_OBJ(b) || maps_equal(AS_MAP(a), AS_MAP(b));
+        }
+        // strings are interned, so equal strings are the same object
+        return AS_OBJ(a) == AS_OBJ(b);
     default:
         return false; // unreachable
     }
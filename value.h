@@ -2,11 +2,25 @@
 
 #include "common.h"
 
+typedef struct Obj Obj;
+typedef struct ObjString ObjString;
+typedef struct ObjArray ObjArray;
+typedef struct ObjMap ObjMap;
+
+// strings up to this many chars live inside the Value, no allocation
+#define SHORT_STR_MAX 7
+
 typedef enum ValueType
 {
     VAL_BOOL,
     VAL_NIL,
-    VAL_NUMBER
+    VAL_NUMBER,
+    // 64 bit, exact. arithmetic that overflows gives a VAL_NUMBER instead
+    VAL_INT,
+    VAL_SHORT_STR,
+    VAL_OBJ,
+    // never seen by scripts: a global that was declared but not defined yet
+    VAL_UNDEFINED
 } ValueType;
 
 typedef struct Value
@@ -19,6 +33,10 @@ typedef struct Value
     {
         bool boolean;
         double number;
+        int64_t integer;
+        // the chars, NUL padded, and the last byte is the length
+        char short_str[SHORT_STR_MAX + 1];
+        Obj* obj;
     } as;
 
 } Value;
@@ -26,15 +44,32 @@ typedef struct Value
 // create a Value struct for bool
 #define BOOL_VAL(value) ((Value){VAL_BOOL, {.boolean = value}})
 #define NUM_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}})
 // todo: why need initialize number?
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
+#define UNDEFINED_VAL ((Value){VAL_UNDEFINED, {.number = 0}})
+// an empty short string, see copy_string
+#define SHORT_STR_VAL ((Value){VAL_SHORT_STR, {.short_str = {0}}})
+#define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
 #define AS_BOOL(value) (value).as.boolean
 #define AS_NUM(value) (value).as.number
+#define AS_INT(value) (value).as.integer
+// either kind of number, as a double
+#define TO_NUM(value)                                                          \
+    (IS_INT(value) ? (double)AS_INT(value) : AS_NUM(value))
+#define AS_OBJ(value) (value).as.obj
+#define SHORT_STR_LENGTH(value) ((int)(value).as.short_str[SHORT_STR_MAX])
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NUM(value) ((value).type == VAL_NUMBER)
+#define IS_INT(value) ((value).type == VAL_INT)
+// an int or a double
+#define IS_NUMERIC(value) (IS_NUM(value) || IS_INT(value))
 #define IS_NIL(value) ((value).type == VAL_NIL)
+#define IS_SHORT_STR(value) ((value).type == VAL_SHORT_STR)
+#define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 // constant pool?
 typedef struct ValueArray
@@ -53,4 +88,10 @@ void free_value_array(ValueArray* array);
 // Used to print values, not for debugging (but can also use to debug)!
 // don't forget to print "\n" after!
 void print_value(Value value);
+// the characters print_value() would print, written to `out` unless it's NULL.
+// returns how many there are, so it can be called with NULL first to size the
+// buffer. nothing is NUL terminated
+size_t format_value(Value value, char* out);
+// a piece of what format_value() makes: copies `chars` unless `out` is NULL
+size_t format_chars(const char* chars, size_t length, char* out);
 bool values_equal(Value a, Value b);
\ No newline at end of file
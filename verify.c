@@ -0,0 +1,257 @@
+#include <string.h>
+
+#include "memory.h"
+#include "native.h"
+#include "verify.h"
+#include "vm.h"
+
+static bool is_constant(Chunk* chunk, int index)
+{
+    return index < chunk->constants.count;
+}
+
+static bool is_global(Chunk* chunk, int operands)
+{
+    int slot = (chunk->code[operands] << 8) | chunk->code[operands + 1];
+    return slot < vm.globals.count;
+}
+
+// the constants, globals and natives the part refers to. the operands are
+// known to be there
+static const char* check_operands(Chunk* chunk, Part* part)
+{
+    const uint8_t* operands = &chunk->code[part->operands];
+    switch (part->op)
+    {
+    case OP_CONSTANT:
+        return is_constant(chunk, operands[0]) ? NULL : "Unknown constant.";
+    case OP_IMPORT:
+        if (!is_constant(chunk, operands[0]) ||
+            !IS_STRING(chunk->constants.values[operands[0]]))
+        {
+            return "Import path isn't a string.";
+        }
+        return NULL;
+    case OP_ADD_CONST_LOCAL:
+        return is_constant(chunk, operands[1]) ? NULL : "Unknown constant.";
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_INC_GLOBAL:
+        return is_global(chunk, part->operands) ? NULL : "Unknown global.";
+    case OP_ADD_CONST_GLOBAL:
+        if (!is_global(chunk, part->operands))
+        {
+            return "Unknown global.";
+        }
+        return is_constant(chunk, operands[2]) ? NULL : "Unknown constant.";
+    case OP_CALL_NATIVE:
+    {
+        if (operands[0] >= native_count)
+        {
+            return "Unknown native.";
+        }
+        const Native* native = &natives[operands[0]];
+        int argc = operands[1];
+        if (argc < native->min_arity ||
+            (native->max_arity != -1 && argc > native->max_arity))
+        {
+            return "Wrong number of arguments to a native.";
+        }
+        return NULL;
+    }
+    default:
+        return NULL;
+    }
+}
+
+// how far down the stack the part reaches: the values it takes off or looks
+// at, and the locals it reads or writes
+static int stack_reach(Chunk* chunk, Part* part)
+{
+    const uint8_t* operands = &chunk->code[part->operands];
+    switch (part->op)
+    {
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_INC_LOCAL:
+    case OP_ADD_CONST_LOCAL:
+    case OP_PICK:
+        return operands[0] + 1;
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_PRINT:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_POP_JUMP_IF_FALSE:
+    case OP_POP_JUMP_IF_TRUE:
+        return 1;
+    case OP_EQUAL:
+    case OP_GRTR:
+    case OP_LESS:
+    case OP_NOT_LESS:
+    case OP_NOT_GRTR:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MULT:
+    case OP_DIV:
+    case OP_POW:
+    case OP_INDEX:
+        return 2;
+    case OP_SELECT:
+        return 3;
+    case OP_ARRAY:
+    case OP_FORMAT:
+        return operands[0];
+    case OP_MAP:
+        return 2 * operands[0];
+    case OP_CALL_NATIVE:
+        return operands[1];
+    default:
+        return 0;
+    }
+}
+
+typedef struct Verifier
+{
+    Chunk* chunk;
+    // the first byte of each instruction
+    bool* starts;
+    // the stack depth before each instruction, -1 until it's reached
+    int* depths;
+    // reached, but not looked at yet
+    int* work;
+    int work_count;
+    // the deepest the stack got anywhere
+    int max_depth;
+} Verifier;
+
+// the code at `offset` is reached with `depth` values on the stack
+static const char* flow_to(Verifier* verifier, int offset, int depth)
+{
+    if (offset < 0 || offset >= verifier->chunk->count ||
+        !verifier->starts[offset])
+    {
+        return "Jump to the middle of nowhere.";
+    }
+
+    if (verifier->depths[offset] == -1)
+    {
+        verifier->depths[offset] = depth;
+        verifier->work[verifier->work_count++] = offset;
+        return NULL;
+    }
+    return verifier->depths[offset] == depth
+               ? NULL
+               : "Stack depth differs between paths.";
+}
+
+// everything the instruction at `offset` does, and where it goes next
+static const char* verify_instr(Verifier* verifier, int offset)
+{
+    Chunk* chunk = verifier->chunk;
+    int depth = verifier->depths[offset];
+
+    Part parts[SUPERINSTR_MAX_OPS];
+    int count = split_instr(chunk, offset, parts);
+    for (int i = 0; i < count; i++)
+    {
+        const char* error = check_operands(chunk, &parts[i]);
+        if (error != NULL)
+        {
+            return error;
+        }
+        if (depth < stack_reach(chunk, &parts[i]))
+        {
+            return "Stack underflow.";
+        }
+        depth += stack_effect(chunk, &parts[i]);
+        // the fused updates push their operands when they take the slow path
+        int peak = depth + (is_update(parts[i].op) ? 2 : 0);
+        if (peak > verifier->max_depth)
+        {
+            verifier->max_depth = peak;
+        }
+    }
+
+    OpCode last = parts[count - 1].op;
+    if (last == OP_RETURN)
+    {
+        return depth == 0 ? NULL : "Values left on the stack at the return.";
+    }
+    if (is_jump(chunk->code[offset]))
+    {
+        const char* error =
+            flow_to(verifier, jump_target(chunk, offset), depth);
+        if (error != NULL || last == OP_JUMP || last == OP_LOOP)
+        {
+            return error;
+        }
+    }
+
+    int next = offset + instr_length(chunk->code[offset]);
+    if (next == chunk->count)
+    {
+        return "Code runs off the end.";
+    }
+    return flow_to(verifier, next, depth);
+}
+
+const char* verify_chunk(Chunk* chunk, int* at)
+{
+    int count = chunk->count;
+    Verifier verifier;
+    verifier.chunk = chunk;
+    verifier.starts = ALLOCATE(bool, count + 1);
+    verifier.depths = ALLOCATE(int, count + 1);
+    verifier.work = ALLOCATE(int, count + 1);
+    verifier.work_count = 0;
+    verifier.max_depth = 0;
+    memset(verifier.starts, 0, count + 1);
+    for (int i = 0; i < count; i++)
+    {
+        verifier.depths[i] = -1;
+    }
+
+    const char* error = NULL;
+    *at = 0;
+    for (int offset = 0; error == NULL && offset < count;
+         offset += instr_length(chunk->code[offset]))
+    {
+        OpCode op = chunk->code[offset];
+        *at = offset;
+        if (op > OP_RETURN && get_superinstr(op) == NULL)
+        {
+            error = "Unknown opcode.";
+        }
+        else if (instr_length(op) > count - offset)
+        {
+            error = "Operands run past the end.";
+        }
+        verifier.starts[offset] = true;
+    }
+
+    if (error == NULL)
+    {
+        *at = 0;
+        error = count == 0 ? "Code runs off the end."
+                           : flow_to(&verifier, 0, 0);
+    }
+    while (error == NULL && verifier.work_count > 0)
+    {
+        *at = verifier.work[--verifier.work_count];
+        error = verify_instr(&verifier, *at);
+    }
+    if (error == NULL)
+    {
+        chunk->max_depth = verifier.max_depth;
+    }
+
+    FREE_ARRAY(int, verifier.work, count + 1);
+    FREE_ARRAY(int, verifier.depths, count + 1);
+    FREE_ARRAY(bool, verifier.starts, count + 1);
+    return error;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "chunk.h"
+
+// run() trusts its bytecode completely: operands aren't bounds checked, and an
+// opcode it doesn't know is undefined behaviour. so bytecode that didn't come
+// straight from the compiler (a .loxc cache, a saved trace) is checked once,
+// when it's loaded:
+// * every opcode exists, and all of its operands are there
+// * the constants, globals and natives it names exist, each native gets an
+//   argc it takes and an import's path is a string
+// * jumps land on the start of an instruction
+// * however an instruction is reached, the stack is as deep, which is deep
+//   enough for what it reads (the locals too)
+// * nothing runs off the end, and OP_RETURN leaves the stack empty
+//
+// NULL if all of that holds (and chunk->max_depth is filled in), otherwise
+// what's wrong and the offset (in `at`) of the instruction it's wrong at
+const char* verify_chunk(Chunk* chunk, int* at);
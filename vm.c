@@ -1,31 +1,86 @@
+#include <limits.h>
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "arith.h"
+#include "array.h"
 #include "common.h"
 #include "compiler.h"
-#include "debug.h"
+#include "image.h"
+#include "map.h"
+#include "memory.h"
+#include "native.h"
+#include "ngram.h"
+#include "object.h"
+#include "profile.h"
+#include "timer.h"
+#include "trace.h"
 #include "vm.h"
 
 VM vm; // global variable :(
 
 static void reset_stack()
 {
-    // pointer decay, vm.stack (Value[STACK_MAX]) -> vm.stack_top (Value*)
     vm.stack_top = vm.stack;
+    vm.slots = vm.stack;
+    vm.frame_count = 0;
 }
 
 void init_vm()
 {
+    vm.stack_capacity = STACK_INITIAL;
+    vm.stack_slots = ALLOCATE(Value, vm.stack_capacity + 1);
+    vm.stack = vm.stack_slots + 1;
     reset_stack();
+    vm.chunk = NULL;
+    init_chunk(&vm.script);
+    vm.budget = BUDGET_UNLIMITED;
+    vm.objects = NULL;
+    init_heap(&vm.heap);
+    vm.modules = NULL;
+    vm.module_count = 0;
+    vm.module_capacity = 0;
+    init_table(&vm.module_names);
+    init_value_array(&vm.globals);
+    init_table(&vm.global_names);
+    init_table(&vm.strings);
+    init_tracer(&vm.tracer);
+    vm.image = NULL;
+    vm.image_size = 0;
 }
 
 void free_vm()
 {
-    // for now, the stack you just let C clean up
+    // a script that yielded and never finished
+    free_chunk(&vm.script);
+    for (int i = 0; i < vm.module_count; i++)
+    {
+        // those belong to the image, which is unmapped in one go
+        if (!vm.modules[i]->in_image)
+        {
+            free_chunk(&vm.modules[i]->chunk);
+            FREE(Module, vm.modules[i]);
+        }
+    }
+    FREE_ARRAY(Module*, vm.modules, vm.module_capacity);
+    free_table(&vm.module_names);
+    free_value_array(&vm.globals);
+    free_table(&vm.global_names);
+    free_table(&vm.strings);
+    free_objects();
+    free_heap(&vm.heap);
+    free_tracer(&vm.tracer);
+    unmap_image();
+    FREE_ARRAY(Value, vm.stack_slots, vm.stack_capacity + 1);
+
+#ifdef PROFILE_OPCODES
+    save_opcode_profile(OPCODE_PROFILE_PATH);
+#endif
 }
 
-static void runtime_err(const char* format, ...)
+void runtime_err(const char* format, ...)
 {
     va_list args;
     va_start(args, format);
@@ -38,9 +93,43 @@ static void runtime_err(const char* format, ...)
     size_t instr_idx = vm.ip - 1 - vm.chunk->code;
     int line = vm.chunk->lines[instr_idx];
     fprintf(stderr, "[line %d] in script\n", line);
+
+    // the last instructions before the error are what you'd want to see
+    if (vm.tracer.enabled)
+    {
+        trace_dump(&vm.tracer);
+    }
     reset_stack();
 }
 
+int global_slot(ObjString* name)
+{
+    int slot;
+    if (table_get(&vm.global_names, name, &slot))
+    {
+        return slot;
+    }
+
+    slot = vm.globals.count;
+    write_value_array(&vm.globals, UNDEFINED_VAL);
+    table_set(&vm.global_names, name, slot);
+    return slot;
+}
+
+// only used for error messages, so a linear search is fine
+const char* global_name(int slot)
+{
+    for (int i = 0; i < vm.global_names.capacity; i++)
+    {
+        Entry* entry = &vm.global_names.entries[i];
+        if (entry->key != NULL && entry->value == slot)
+        {
+            return entry->key->chars;
+        }
+    }
+    return "?";
+}
+
 static Value peek(int dist)
 {
     return vm.stack_top[-1 - dist];
@@ -51,149 +140,883 @@ static bool is_falsey(Value val)
     return IS_NIL(val) || (IS_BOOL(val) && !AS_BOOL(val));
 }
 
+static InterpretResult run();
+
+void add_module(Module* module)
+{
+    if (vm.module_capacity < vm.module_count + 1)
+    {
+        int old_capacity = vm.module_capacity;
+        vm.module_capacity = GROW_CAPACITY(old_capacity);
+        vm.modules = GROW_ARRAY(Module*, vm.modules, old_capacity,
+                                vm.module_capacity);
+    }
+
+    table_set(&vm.module_names, module->path, vm.module_count);
+    vm.modules[vm.module_count++] = module;
+}
+
+static Module* new_module(ObjString* path)
+{
+    // allocated one by one so a Chunk* into a module stays valid
+    Module* module = ALLOCATE(Module, 1);
+    module->path = path;
+    module->in_image = false;
+    init_chunk(&module->chunk);
+
+    add_module(module);
+    return module;
+}
+
+// runs `chunk` on top of whatever is running now, OP_RETURN picks up where it
+// was. it's the same run() loop, so a module can yield halfway too
+static bool enter_chunk(Chunk* chunk)
+{
+    if (vm.frame_count == FRAMES_MAX)
+    {
+        runtime_err("Imports nested too deeply.");
+        return false;
+    }
+    // its locals go on top of everyone else's
+    reserve_stack(chunk->max_depth);
+
+    Frame* frame = &vm.frames[vm.frame_count++];
+    frame->chunk = vm.chunk;
+    frame->ip = vm.ip;
+    frame->slots = vm.slots;
+
+    vm.chunk = chunk;
+    vm.ip = chunk->code;
+    vm.slots = vm.stack_top;
+    trace_set_chunk(&vm.tracer, chunk);
+    return true;
+}
+
+// false once the top level script returns
+static bool leave_chunk()
+{
+    if (vm.frame_count == 0)
+    {
+        return false;
+    }
+
+    Frame* frame = &vm.frames[--vm.frame_count];
+    vm.chunk = frame->chunk;
+    vm.ip = frame->ip;
+    vm.slots = frame->slots;
+    trace_set_chunk(&vm.tracer, vm.chunk);
+    return true;
+}
+
+// modules are keyed by path, the second import of a path does nothing.
+// otherwise the module starts running, false on an error
+static bool import_module(Value path_value)
+{
+    ObjString* path =
+        intern_string(STRING_CHARS(path_value), STRING_LENGTH(path_value));
+
+    int index;
+    if (table_get(&vm.module_names, path, &index))
+    {
+        return true;
+    }
+
+    // registered before it's loaded, so a cycle doesn't import it again
+    Module* module = new_module(path);
+    if (!load_module(module))
+    {
+        runtime_err("Could not import \"%s\".", path->chars);
+        return false;
+    }
+
+    return enter_chunk(&module->chunk);
+}
+
+// a and b are left on the stack until the result exists
+void concatenate()
+{
+    Value b = peek(0);
+    Value a = peek(1);
+    int a_len = STRING_LENGTH(a);
+    int b_len = STRING_LENGTH(b);
+    int length = a_len + b_len;
+
+    // the chars have to be in one piece to be looked up in vm.strings
+    char buf[256];
+    char* chars = length <= (int)sizeof(buf) ? buf : ALLOCATE(char, length);
+    memcpy(chars, STRING_CHARS(a), a_len);
+    memcpy(chars + a_len, STRING_CHARS(b), b_len);
+
+    Value result = copy_string(chars, length);
+    if (chars != buf)
+    {
+        FREE_ARRAY(char, chars, length);
+    }
+
+    vm.stack_top[-2] = result;
+    vm.stack_top--;
+}
+
+// the parts one after another, each formatted like print_value() would
+static void write_parts(Value* parts, int count, char* out)
+{
+    for (int i = 0; i < count; i++)
+    {
+        out += format_value(parts[i], out);
+    }
+}
+
+bool format_parts(int count)
+{
+    Value* parts = vm.stack_top - count;
+    if (count == 1 && IS_STRING(parts[0]))
+    {
+        return true;
+    }
+
+    // sized first, so the characters are written once, straight into the
+    // string that's returned
+    size_t length = 0;
+    for (int i = 0; i < count; i++)
+    {
+        length += format_value(parts[i], NULL);
+    }
+    if (length > INT_MAX)
+    {
+        runtime_err("Formatted string is too long.");
+        return false;
+    }
+
+    Value result;
+    if (length <= SHORT_STR_MAX)
+    {
+        char chars[SHORT_STR_MAX];
+        write_parts(parts, count, chars);
+        result = copy_string(chars, (int)length);
+    }
+    else
+    {
+        // the gc may move the parts, but they stay in the same stack slots
+        ObjString* string = allocate_string((int)length);
+        write_parts(parts, count, string->chars);
+        result = OBJ_VAL(finish_string(string));
+    }
+
+    vm.stack_top = parts;
+    *vm.stack_top++ = result;
+    return true;
+}
+
 // static makes this function private
 // goes through the bytecode (vm.chunk), and interprets it.
 static InterpretResult run()
 {
-// vm.ip++; return *(vm.ip)
+    // the vm's registers, kept in locals so they can live in real ones: vm.ip
+    // and vm.stack_top are only written back when something else needs to see
+    // them (an error, a native, the gc, an import, a return or a yield). The
+    // top of the stack is cached in `top`, what's in memory at sp[-1] is stale
+    uint8_t* ip = vm.ip;
+    Value* sp = vm.stack_top;
+    Value* slots = vm.slots;
+    Value* constants = vm.chunk->constants.values;
+    Value top = sp[-1];
+    // instructions dispatched since the last SAVE_STATE, for vm.stats
+    uint64_t executed = 0;
+    // the count (vm.stats.instructions + executed) OP_LOOP yields at
+    uint64_t yield_at =
+        vm.stats.instructions + (uint64_t)(vm.budget > 0 ? vm.budget : 0);
+
+#define SAVE_STATE()                                                           \
+    (vm.ip = ip, vm.stack_top = sp, sp[-1] = top,                              \
+     vm.stats.instructions += executed, executed = 0)
+#define LOAD_STATE()                                                           \
+    (ip = vm.ip, sp = vm.stack_top, slots = vm.slots,                          \
+     constants = vm.chunk->constants.values, top = sp[-1])
+// the old top goes to memory first, so `value` can be read from anywhere
+#define PUSH(value) (sp[-1] = top, sp++, top = (value))
+#define POP() (sp--, top = sp[-1])
+#define RUNTIME_ERROR(...)                                                     \
+    do                                                                         \
+    {                                                                          \
+        SAVE_STATE();                                                          \
+        runtime_err(__VA_ARGS__);                                              \
+        return INTERPRET_RUNTIME_ERR;                                          \
+    } while (false)
+// ip++; return *ip
 // reads an op code
-#define READ_BYTE() (*vm.ip++)
-#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-// using a do while loop lets you add semicolon at the end of it.
-// b comes first, because last in *first* out!
-#define BINARY_OP(value_type, op)                                              \
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_BYTE()])
+// not two numbers, so an array (see array.h) or an error. the result ends up
+// where `a` was, the sp-- that follows makes it the top
+#define ARRAY_BINARY(op)                                                       \
     do                                                                         \
     {                                                                          \
-        if (!IS_NUM(peek(0)) || !IS_NUM(peek(1)))                              \
+        SAVE_STATE();                                                          \
+        if (!array_binary(op))                                                 \
         {                                                                      \
-            runtime_err("Operands must be numbers");                           \
             return INTERPRET_RUNTIME_ERR;                                      \
         }                                                                      \
-        double b = AS_NUM(vm.stack_top[-1]);                                   \
-        double a = AS_NUM(vm.stack_top[-2]);                                   \
-        vm.stack_top[-2] = value_type(a op b);                                 \
-        vm.stack_top--;                                                        \
+        top = sp[-2];                                                          \
     } while (false)
+// b is the top, a is just under it: the answer replaces both.
+// ints stay ints, unless `int_op` says the answer doesn't fit (then, and for
+// mixed operands, it's done in doubles)
+#define ARITH_OP(opcode, int_op, double_op)                                    \
+    do                                                                         \
+    {                                                                          \
+        Value a = sp[-2];                                                      \
+        int64_t result;                                                        \
+        if (IS_INT(a) && IS_INT(top) &&                                        \
+            !int_op(AS_INT(a), AS_INT(top), &result))                          \
+        {                                                                      \
+            top = INT_VAL(result);                                             \
+        }                                                                      \
+        else if (IS_NUM(a) && IS_NUM(top))                                     \
+        {                                                                      \
+            top = NUM_VAL(double_op(AS_NUM(a), AS_NUM(top)));                  \
+        }                                                                      \
+        else if (IS_NUMERIC(a) && IS_NUMERIC(top))                             \
+        {                                                                      \
+            top = NUM_VAL(double_op(TO_NUM(a), TO_NUM(top)));                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            ARRAY_BINARY(opcode);                                              \
+        }                                                                      \
+        sp--;                                                                  \
+    } while (false)
+// mixed int/double comparisons are done in doubles
+#define COMPARE_OP(opcode, compare)                                            \
+    do                                                                         \
+    {                                                                          \
+        Value a = sp[-2];                                                      \
+        if (IS_INT(a) && IS_INT(top))                                          \
+        {                                                                      \
+            top = BOOL_VAL(compare(AS_INT(a), AS_INT(top)));                   \
+        }                                                                      \
+        else if (IS_NUMERIC(a) && IS_NUMERIC(top))                             \
+        {                                                                      \
+            top = BOOL_VAL(compare(TO_NUM(a), TO_NUM(top)));                   \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            ARRAY_BINARY(opcode);                                              \
+        }                                                                      \
+        sp--;                                                                  \
+    } while (false)
+#define ADD(a, b) ((a) + (b))
+#define SUB(a, b) ((a) - (b))
+#define MULT(a, b) ((a) * (b))
+#define DIV(a, b) ((a) / (b))
+#define GRTR(a, b) ((a) > (b))
+#define LESS(a, b) ((a) < (b))
+// not `>=`: a NaN makes it true, see OP_NOT_LESS
+#define NOT_LESS(a, b) (!((a) < (b)))
+#define NOT_GRTR(a, b) (!((a) > (b)))
+
+// the handlers are macros so the generated superinstructions (superinstr.h)
+// can paste several into one case. they fall through to whatever comes next,
+// so no `break`
+#define BODY_OP_CONSTANT                                                       \
+    {                                                                          \
+        Value constant = READ_CONSTANT();                                      \
+        PUSH(constant);                                                        \
+    }
+#define BODY_OP_NIL PUSH(NIL_VAL);
+#define BODY_OP_TRUE PUSH(BOOL_VAL(true));
+#define BODY_OP_FALSE PUSH(BOOL_VAL(false));
+#define BODY_OP_POP POP();
+// the local may be the top itself, PUSH stores that before reading it
+#define BODY_OP_GET_LOCAL                                                      \
+    {                                                                          \
+        uint8_t slot = READ_BYTE();                                            \
+        PUSH(slots[slot]);                                                     \
+    }
+// assignment is an expression, the value stays on the stack
+#define BODY_OP_SET_LOCAL slots[READ_BYTE()] = top;
+#define BODY_OP_GET_GLOBAL                                                     \
+    {                                                                          \
+        uint16_t slot = READ_SHORT();                                          \
+        Value value = vm.globals.values[slot];                                 \
+        if (IS_UNDEFINED(value))                                               \
+        {                                                                      \
+            RUNTIME_ERROR("Undefined variable '%s'.", global_name(slot));      \
+        }                                                                      \
+        PUSH(value);                                                           \
+    }
+#define BODY_OP_DEFINE_GLOBAL                                                  \
+    vm.globals.values[READ_SHORT()] = top;                                     \
+    POP();
+#define BODY_OP_SET_GLOBAL                                                     \
+    {                                                                          \
+        uint16_t slot = READ_SHORT();                                          \
+        if (IS_UNDEFINED(vm.globals.values[slot]))                             \
+        {                                                                      \
+            RUNTIME_ERROR("Undefined variable '%s'.", global_name(slot));      \
+        }                                                                      \
+        vm.globals.values[slot] = top;                                         \
+    }
+// an array is never falsey, so `!a` is false: not(a) is the element-wise one
+#define BODY_OP_NOT top = BOOL_VAL(is_falsey(top));
+#define BODY_OP_EQUAL                                                          \
+    top = BOOL_VAL(values_equal(sp[-2], top));                                 \
+    sp--;
+#define BODY_OP_GRTR COMPARE_OP(OP_GRTR, GRTR);
+#define BODY_OP_LESS COMPARE_OP(OP_LESS, LESS);
+#define BODY_OP_NOT_LESS COMPARE_OP(OP_NOT_LESS, NOT_LESS);
+#define BODY_OP_NOT_GRTR COMPARE_OP(OP_NOT_GRTR, NOT_GRTR);
+// concatenate() allocates, so the gc has to see the whole stack
+#define BODY_OP_ADD                                                            \
+    if (IS_NUMERIC(top) && IS_NUMERIC(sp[-2]))                                 \
+    {                                                                          \
+        ARITH_OP(OP_ADD, add_overflows, ADD);                                  \
+    }                                                                          \
+    else if (IS_STRING(top) && IS_STRING(sp[-2]))                              \
+    {                                                                          \
+        SAVE_STATE();                                                          \
+        concatenate();                                                         \
+        sp--;                                                                  \
+        top = sp[-1];                                                          \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+        ARRAY_BINARY(OP_ADD);                                                  \
+        sp--;                                                                  \
+    }
+// `variable = variable + k`, for the OP_INC_* and OP_ADD_CONST_* an `a += k`
+// turns into. two ints (that don't overflow) or two doubles are added right
+// there, anything else goes through OP_ADD on the stack
+#define ADD_IN_PLACE(variable, k)                                              \
+    do                                                                         \
+    {                                                                          \
+        Value b = (k);                                                         \
+        int64_t result;                                                        \
+        if (IS_INT(variable) && IS_INT(b) &&                                   \
+            !add_overflows(AS_INT(variable), AS_INT(b), &result))              \
+        {                                                                      \
+            variable = INT_VAL(result);                                        \
+        }                                                                      \
+        else if (IS_NUM(variable) && IS_NUM(b))                                \
+        {                                                                      \
+            variable = NUM_VAL(AS_NUM(variable) + AS_NUM(b));                  \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            PUSH(variable);                                                    \
+            PUSH(b);                                                           \
+            BODY_OP_ADD                                                        \
+            variable = top;                                                    \
+            POP();                                                             \
+        }                                                                      \
+    } while (false)
+// the local may be the top, so that goes to memory first and comes back after
+#define BODY_OP_INC_LOCAL                                                      \
+    {                                                                          \
+        uint8_t slot = READ_BYTE();                                            \
+        sp[-1] = top;                                                          \
+        ADD_IN_PLACE(slots[slot], INT_VAL(1));                                 \
+        top = sp[-1];                                                          \
+    }
+#define BODY_OP_ADD_CONST_LOCAL                                                \
+    {                                                                          \
+        uint8_t slot = READ_BYTE();                                            \
+        Value constant = READ_CONSTANT();                                      \
+        sp[-1] = top;                                                          \
+        ADD_IN_PLACE(slots[slot], constant);                                   \
+        top = sp[-1];                                                          \
+    }
+#define BODY_OP_INC_GLOBAL                                                     \
+    {                                                                          \
+        uint16_t slot = READ_SHORT();                                          \
+        if (IS_UNDEFINED(vm.globals.values[slot]))                             \
+        {                                                                      \
+            RUNTIME_ERROR("Undefined variable '%s'.", global_name(slot));      \
+        }                                                                      \
+        ADD_IN_PLACE(vm.globals.values[slot], INT_VAL(1));                     \
+    }
+#define BODY_OP_ADD_CONST_GLOBAL                                               \
+    {                                                                          \
+        uint16_t slot = READ_SHORT();                                          \
+        Value constant = READ_CONSTANT();                                      \
+        if (IS_UNDEFINED(vm.globals.values[slot]))                             \
+        {                                                                      \
+            RUNTIME_ERROR("Undefined variable '%s'.", global_name(slot));      \
+        }                                                                      \
+        ADD_IN_PLACE(vm.globals.values[slot], constant);                       \
+    }
+#define BODY_OP_SUB ARITH_OP(OP_SUB, sub_overflows, SUB);
+#define BODY_OP_MULT ARITH_OP(OP_MULT, mul_overflows, MULT);
+#define BODY_OP_DIV ARITH_OP(OP_DIV, div_inexact, DIV);
+#define BODY_OP_POW ARITH_OP(OP_POW, pow_overflows, fast_pow);
+#define BODY_OP_NEGATE                                                         \
+    if (IS_INT(top) && AS_INT(top) != INT64_MIN)                               \
+    {                                                                          \
+        top = INT_VAL(-AS_INT(top));                                           \
+    }                                                                          \
+    else if (IS_NUMERIC(top))                                                  \
+    {                                                                          \
+        top = NUM_VAL(-TO_NUM(top));                                           \
+    }                                                                          \
+    else                                                                       \
+    {                                                                          \
+        SAVE_STATE();                                                          \
+        if (!array_negate())                                                   \
+        {                                                                      \
+            return INTERPRET_RUNTIME_ERR;                                      \
+        }                                                                      \
+        top = sp[-1];                                                          \
+    }
+// the args are already sitting on the stack (once the top is stored), so just
+// point at them. natives report their own errors, from vm.ip
+#define BODY_OP_CALL_NATIVE                                                    \
+    {                                                                          \
+        const Native* native = &natives[READ_BYTE()];                          \
+        int argc = READ_BYTE();                                                \
+        SAVE_STATE();                                                          \
+        Value* args = sp - argc;                                               \
+        if (!native->function(argc, args, &args[0]))                           \
+        {                                                                      \
+            return INTERPRET_RUNTIME_ERR;                                      \
+        }                                                                      \
+        sp = args + 1;                                                         \
+        top = args[0];                                                         \
+    }
+#define BODY_OP_PRINT                                                          \
+    print_value(top);                                                          \
+    printf("\n");                                                              \
+    POP();
+// jumps can only be the last part of a superinstruction
+#define BODY_OP_JUMP                                                           \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        ip += offset;                                                          \
+    }
+#define BODY_OP_JUMP_IF_FALSE                                                  \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        if (is_falsey(top))                                                    \
+        {                                                                      \
+            ip += offset;                                                      \
+        }                                                                      \
+    }
+#define BODY_OP_JUMP_IF_TRUE                                                   \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        if (!is_falsey(top))                                                   \
+        {                                                                      \
+            ip += offset;                                                      \
+        }                                                                      \
+    }
+#define BODY_OP_POP_JUMP_IF_FALSE                                              \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        bool falsey = is_falsey(top);                                          \
+        POP();                                                                 \
+        if (falsey)                                                            \
+        {                                                                      \
+            ip += offset;                                                      \
+        }                                                                      \
+    }
+#define BODY_OP_POP_JUMP_IF_TRUE                                               \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        bool falsey = is_falsey(top);                                          \
+        POP();                                                                 \
+        if (!falsey)                                                           \
+        {                                                                      \
+            ip += offset;                                                      \
+        }                                                                      \
+    }
+// loops are the only way to run for long, so that's where the budget is
+// checked, against the instructions dispatched since resume()
+#define BODY_OP_LOOP                                                           \
+    {                                                                          \
+        uint16_t offset = READ_SHORT();                                        \
+        ip -= offset;                                                          \
+        if (vm.stats.instructions + executed >= yield_at)                      \
+        {                                                                      \
+            SAVE_STATE();                                                      \
+            return INTERPRET_YIELD;                                            \
+        }                                                                      \
+    }
+// cond, a, b are the top 3: b is `top`
+#define BODY_OP_SELECT                                                         \
+    {                                                                          \
+        Value cond = sp[-3];                                                   \
+        int falsey = IS_NIL(cond) | (IS_BOOL(cond) & !AS_BOOL(cond));          \
+        top = falsey ? top : sp[-2];                                           \
+        sp -= 2;                                                               \
+    }
+// the top is stored first, n can be 0
+#define BODY_OP_PICK                                                           \
+    {                                                                          \
+        uint8_t distance = READ_BYTE();                                        \
+        sp[-1] = top;                                                          \
+        top = sp[-1 - distance];                                               \
+        sp++;                                                                  \
+    }
+// arrays are made from values on the stack, like concatenate() does strings
+#define BODY_OP_ARRAY                                                          \
+    {                                                                          \
+        uint8_t count = READ_BYTE();                                           \
+        SAVE_STATE();                                                          \
+        make_array(count);                                                     \
+        sp = vm.stack_top;                                                     \
+        top = sp[-1];                                                          \
+    }
+#define BODY_OP_MAP                                                            \
+    {                                                                          \
+        uint8_t count = READ_BYTE();                                           \
+        SAVE_STATE();                                                          \
+        if (!make_map(count))                                                  \
+        {                                                                      \
+            return INTERPRET_RUNTIME_ERR;                                      \
+        }                                                                      \
+        sp = vm.stack_top;                                                     \
+        top = sp[-1];                                                          \
+    }
+#define BODY_OP_FORMAT                                                         \
+    {                                                                          \
+        uint8_t count = READ_BYTE();                                           \
+        SAVE_STATE();                                                          \
+        if (!format_parts(count))                                              \
+        {                                                                      \
+            return INTERPRET_RUNTIME_ERR;                                      \
+        }                                                                      \
+        sp = vm.stack_top;                                                     \
+        top = sp[-1];                                                          \
+    }
+// a key that isn't in the map gives nil
+#define BODY_OP_INDEX                                                          \
+    {                                                                          \
+        Value container = sp[-2];                                              \
+        Value value;                                                           \
+        if (IS_MAP(container))                                                 \
+        {                                                                      \
+            top = map_get(AS_MAP(container), top, &value) ? value : NIL_VAL;   \
+        }                                                                      \
+        else if (!IS_ARRAY(container))                                         \
+        {                                                                      \
+            RUNTIME_ERROR("Only arrays and maps can be indexed.");             \
+        }                                                                      \
+        else if (!IS_INT(top))                                                 \
+        {                                                                      \
+            RUNTIME_ERROR("Array index must be an integer.");                  \
+        }                                                                      \
+        else if (AS_INT(top) < 0 || AS_INT(top) >= AS_ARRAY(container)->count) \
+        {                                                                      \
+            RUNTIME_ERROR("Array index out of range.");                        \
+        }                                                                      \
+        else                                                                   \
+        {                                                                      \
+            top = array_element(AS_ARRAY(container), (int)AS_INT(top));        \
+        }                                                                      \
+        sp--;                                                                  \
+    }
+
+#define SUPERINSTR2_CASE(name, a, b)                                           \
+    case name:                                                                 \
+        BODY_##a BODY_##b break;
+#define SUPERINSTR3_CASE(name, a, b, c)                                        \
+    case name:                                                                 \
+        BODY_##a BODY_##b BODY_##c break;
 
     while (true)
     {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("% 10s", "");
-        for (Value* slot = vm.stack; slot < vm.stack_top; slot++)
+        // one predictable branch when not tracing, see trace.h
+        if (vm.tracer.enabled)
         {
-            printf("[ ");
-            print_value(*slot);
-            printf(" ]");
+            trace_record(&vm.tracer, (uint32_t)(ip - vm.chunk->code), *ip,
+                         (int)(sp - vm.stack));
         }
-        printf("\n");
-
-        disassemble_instr(vm.chunk, (int)(vm.ip - vm.chunk->code));
+        // the same for the profiler, which reads vm.ip
+        if (profiler.pending)
+        {
+            SAVE_STATE();
+            profile_sample();
+        }
+#ifdef PROFILE_OPCODES
+        count_opcode(vm.chunk, (int)(ip - vm.chunk->code));
 #endif
+
+        executed++;
         uint8_t instr;
         switch (instr = READ_BYTE())
         {
         case OP_CONSTANT:
-        {
-            Value constant = READ_CONSTANT();
-            push(constant);
-        }
-        break;
+            BODY_OP_CONSTANT
+            break;
         case OP_NIL:
-            push(NIL_VAL);
+            BODY_OP_NIL
             break;
         case OP_TRUE:
-            push(BOOL_VAL(true));
+            BODY_OP_TRUE
             break;
         case OP_FALSE:
-            push(BOOL_VAL(false));
+            BODY_OP_FALSE
+            break;
+        case OP_POP:
+            BODY_OP_POP
+            break;
+        case OP_GET_LOCAL:
+            BODY_OP_GET_LOCAL
+            break;
+        case OP_SET_LOCAL:
+            BODY_OP_SET_LOCAL
+            break;
+        case OP_GET_GLOBAL:
+            BODY_OP_GET_GLOBAL
+            break;
+        case OP_DEFINE_GLOBAL:
+            BODY_OP_DEFINE_GLOBAL
+            break;
+        case OP_SET_GLOBAL:
+            BODY_OP_SET_GLOBAL
+            break;
+        case OP_INC_LOCAL:
+            BODY_OP_INC_LOCAL
+            break;
+        case OP_ADD_CONST_LOCAL:
+            BODY_OP_ADD_CONST_LOCAL
+            break;
+        case OP_INC_GLOBAL:
+            BODY_OP_INC_GLOBAL
+            break;
+        case OP_ADD_CONST_GLOBAL:
+            BODY_OP_ADD_CONST_GLOBAL
             break;
         case OP_NOT:
-            vm.stack_top[-1] = BOOL_VAL(is_falsey(vm.stack_top[-1]));
+            BODY_OP_NOT
             break;
         case OP_EQUAL:
-            Value b = vm.stack_top[-1];
-            Value a = vm.stack_top[-2];
-            vm.stack_top[-2] = BOOL_VAL(values_equal(a, b));
-            vm.stack_top--;
+            BODY_OP_EQUAL
             break;
         case OP_GRTR:
-            BINARY_OP(BOOL_VAL, >);
+            BODY_OP_GRTR
             break;
         case OP_LESS:
-            BINARY_OP(BOOL_VAL, <);
+            BODY_OP_LESS
+            break;
+        case OP_NOT_LESS:
+            BODY_OP_NOT_LESS
+            break;
+        case OP_NOT_GRTR:
+            BODY_OP_NOT_GRTR
             break;
         case OP_ADD:
-            BINARY_OP(NUM_VAL, +);
+            BODY_OP_ADD
             break;
         case OP_SUB:
-            BINARY_OP(NUM_VAL, -);
+            BODY_OP_SUB
             break;
         case OP_MULT:
-            BINARY_OP(NUM_VAL, *);
+            BODY_OP_MULT
             break;
         case OP_DIV:
-            BINARY_OP(NUM_VAL, /);
+            BODY_OP_DIV
             break;
         case OP_POW:
-        {
-            if (!IS_NUM(peek(0)) || !IS_NUM(peek(1)))
-            {
-                runtime_err("Operands must be numbers");
-                return INTERPRET_RUNTIME_ERR;
-            }
-            double b = AS_NUM(vm.stack_top[-1]);
-            double a = AS_NUM(vm.stack_top[-2]);
-            vm.stack_top[-2] = NUM_VAL(pow(a, b));
-            vm.stack_top--;
-        }
-        break;
+            BODY_OP_POW
+            break;
         case OP_NEGATE:
+            BODY_OP_NEGATE
+            break;
+        case OP_CALL_NATIVE:
+            BODY_OP_CALL_NATIVE
+            break;
+        case OP_PRINT:
+            BODY_OP_PRINT
+            break;
+        // the module runs on a chunk of its own, so everything is reloaded
+        case OP_IMPORT:
         {
-            if (!IS_NUM(peek(0)))
+            Value path = READ_CONSTANT();
+            SAVE_STATE();
+            if (!import_module(path))
             {
-                runtime_err("'-' can only be used on numbers.");
                 return INTERPRET_RUNTIME_ERR;
             }
-            // a[b] is same as *(vm.stack_top - 1)
-            vm.stack_top[-1] = NUM_VAL(-AS_NUM(vm.stack_top[-1]));
+            LOAD_STATE();
+            break;
         }
-        break;
+        case OP_JUMP:
+            BODY_OP_JUMP
+            break;
+        case OP_JUMP_IF_FALSE:
+            BODY_OP_JUMP_IF_FALSE
+            break;
+        case OP_JUMP_IF_TRUE:
+            BODY_OP_JUMP_IF_TRUE
+            break;
+        case OP_POP_JUMP_IF_FALSE:
+            BODY_OP_POP_JUMP_IF_FALSE
+            break;
+        case OP_POP_JUMP_IF_TRUE:
+            BODY_OP_POP_JUMP_IF_TRUE
+            break;
+        case OP_LOOP:
+            BODY_OP_LOOP
+            break;
+        case OP_SELECT:
+            BODY_OP_SELECT
+            break;
+        case OP_PICK:
+            BODY_OP_PICK
+            break;
+        case OP_ARRAY:
+            BODY_OP_ARRAY
+            break;
+        case OP_MAP:
+            BODY_OP_MAP
+            break;
+        case OP_FORMAT:
+            BODY_OP_FORMAT
+            break;
+        case OP_INDEX:
+            BODY_OP_INDEX
+            break;
         case OP_RETURN:
-        {
-            print_value(pop());
-            printf("\n");
-            return INTERPRET_OK;
-        }
-        break;
+            SAVE_STATE();
+            if (!leave_chunk())
+            {
+                return INTERPRET_OK;
+            }
+            LOAD_STATE();
+            break;
+
+        // generated, see superinstr.h
+        SUPERINSTRS(SUPERINSTR2_CASE, SUPERINSTR3_CASE)
+
+        default:
+            // see verify.h
+            UNREACHABLE();
         }
     }
+#undef SAVE_STATE
+#undef LOAD_STATE
+#undef PUSH
+#undef POP
+#undef RUNTIME_ERROR
 #undef READ_BYTE
+#undef READ_SHORT
 #undef READ_CONSTANT
-#undef BINARY_OP
+#undef ARRAY_BINARY
+#undef ARITH_OP
+#undef COMPARE_OP
+#undef ADD_IN_PLACE
+#undef ADD
+#undef SUB
+#undef MULT
+#undef DIV
+#undef GRTR
+#undef LESS
+#undef NOT_LESS
+#undef NOT_GRTR
+#undef SUPERINSTR2_CASE
+#undef SUPERINSTR3_CASE
+}
+
+// vm.script has just been compiled
+static InterpretResult start_script(bool compiled)
+{
+    if (!compiled)
+    {
+        free_chunk(&vm.script);
+        return INTERPRET_COMPILE_ERR;
+    }
+
+    reset_stack();
+    reserve_stack(vm.script.max_depth);
+    vm.chunk = &vm.script;
+    vm.ip = vm.chunk->code;
+    trace_set_chunk(&vm.tracer, &vm.script);
+    return INTERPRET_OK;
 }
 
 // the main function where everything is done:
 // compiling, and running
 InterpretResult interpret(const char* source)
 {
-    Chunk chunk;
-    init_chunk(&chunk);
+    InterpretResult result = load_script(source);
+    if (result != INTERPRET_OK)
+    {
+        return result;
+    }
+    return resume(BUDGET_UNLIMITED);
+}
 
-    if (!compile(source, &chunk))
+InterpretResult interpret_file(FILE* file)
+{
+    memset(&vm.stats, 0, sizeof(vm.stats));
+    init_chunk(&vm.script);
+    InterpretResult result = start_script(compile_file(file, &vm.script));
+    if (result != INTERPRET_OK)
     {
-        free_chunk(&chunk);
-        return INTERPRET_COMPILE_ERR;
+        return result;
     }
+    return resume(BUDGET_UNLIMITED);
+}
 
-    vm.chunk = &chunk;
-    vm.ip = vm.chunk->code;
+InterpretResult load_script(const char* source)
+{
+    memset(&vm.stats, 0, sizeof(vm.stats));
+    init_chunk(&vm.script);
+    return start_script(compile(source, &vm.script));
+}
 
+InterpretResult resume(int64_t budget)
+{
+    vm.budget = budget;
+    uint64_t start = now_ns();
     InterpretResult result = run();
+    vm.stats.run_ns += now_ns() - start;
+    if (result == INTERPRET_YIELD)
+    {
+        return result;
+    }
 
-    free_chunk(&chunk);
+    vm.chunk = NULL;
+    // the next script's chunk is at the same address
+    trace_forget_chunk(&vm.tracer, &vm.script);
+    free_chunk(&vm.script);
     return result;
 }
 
+InterpretStats interpret_stats()
+{
+    return vm.stats;
+}
+
+void reserve_stack(int depth)
+{
+    int used = (int)(vm.stack_top - vm.stack);
+    if (used + depth <= vm.stack_capacity)
+    {
+        return;
+    }
+
+    int old_capacity = vm.stack_capacity;
+    while (vm.stack_capacity < used + depth)
+    {
+        vm.stack_capacity = GROW_CAPACITY(vm.stack_capacity);
+    }
+    // not GROW_ARRAY: the old pointers are still needed to re-base them
+    Value* old_slots = vm.stack_slots;
+    Value* old_stack = vm.stack;
+    vm.stack_slots = ALLOCATE(Value, vm.stack_capacity + 1);
+    memcpy(vm.stack_slots, old_slots, sizeof(Value) * (used + 1));
+    vm.stack = vm.stack_slots + 1;
+
+    vm.stack_top = vm.stack + used;
+    vm.slots = vm.stack + (vm.slots - old_stack);
+    for (int i = 0; i < vm.frame_count; i++)
+    {
+        vm.frames[i].slots = vm.stack + (vm.frames[i].slots - old_stack);
+    }
+    FREE_ARRAY(Value, old_slots, old_capacity + 1);
+}
+
 void push(Value value)
 {
     *vm.stack_top = value;
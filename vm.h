@@ -1,23 +1,104 @@
 #pragma once
 
+#include <stdio.h>
+
 #include "chunk.h"
+#include "memory.h"
+#include "module.h"
+#include "table.h"
+#include "trace.h"
 #include "value.h"
 
-#define STACK_MAX 256
+// the room the stack starts with, it grows when a chunk needs more (see
+// reserve_stack())
+#define STACK_INITIAL 256
+// how deep imports can nest
+#define FRAMES_MAX 64
+
+// what the importing code was doing, while an imported module runs
+typedef struct Frame
+{
+    Chunk* chunk;
+    uint8_t* ip;
+    Value* slots;
+} Frame;
+
+// what one interpret() did (see interpret_stats()). the times are wall time:
+// the scanner only runs inside compile(), but isn't counted in compile_ns. an
+// import is compiled while the script runs, so it counts in run_ns too
+typedef struct InterpretStats
+{
+    uint64_t scan_ns;
+    uint64_t compile_ns;
+    uint64_t run_ns;
+
+    uint64_t tokens;
+    // by the compiler, before the optimizer had a go at them
+    uint64_t bytes_emitted;
+    // new ones, not literals that reused one
+    uint64_t constants_added;
+    // a superinstruction counts once
+    uint64_t instructions;
+} InterpretStats;
 
 typedef struct VM
 {
     // why a reference and not just own it?
     Chunk* chunk;
+    // the top level one, kept here so it can be resumed (see resume())
+    Chunk script;
     // loc of current running instruction (instruction pointer)
     // not an int because then you'd have to do `chunk->code[ip]` which is
     // slower
     // always points to the *next* instruction (not executed yet)
     uint8_t* ip;
 
-    Value stack[STACK_MAX];
+    // run() keeps the top of the stack in a local, and stores it to
+    // stack_top[-1] when something is pushed over it. on an empty stack that's
+    // stack_slots[0], which is never a real value
+    Value* stack_slots;
+    // how many values fit from stack on, stack_slots[0] not counted
+    int stack_capacity;
+    // &stack_slots[1], the bottom of the stack
+    Value* stack;
     // stack_top points past the stack, stack_top == len
     Value* stack_top;
+    // where the running chunk's locals start: local 0 is slots[0]
+    Value* slots;
+
+    Frame frames[FRAMES_MAX];
+    int frame_count;
+
+    // instructions run() gets before it yields, see OP_LOOP
+    int64_t budget;
+
+    // every module imported so far, each one is only ever run once
+    Module** modules;
+    int module_count;
+    int module_capacity;
+    // path -> index into modules
+    Table module_names;
+
+    // globals are resolved to an index when compiling, so at runtime they're
+    // just an array access. Undefined ones hold UNDEFINED_VAL
+    ValueArray globals;
+    // name -> index into globals, only used by the compiler (and errors)
+    Table global_names;
+
+    // every interned string (see intern_string)
+    Table strings;
+    // linked list of the old space, see memory.h
+    Obj* objects;
+    Heap heap;
+
+    // off unless --trace was passed
+    Tracer tracer;
+    // always on, cheap enough not to notice
+    InterpretStats stats;
+
+    // mapped by load_image(), the strings and modules in it point inside
+    void* image;
+    size_t image_size;
 } VM;
 
 typedef enum InterpretResult
@@ -25,13 +106,54 @@ typedef enum InterpretResult
     INTERPRET_OK,
     INTERPRET_COMPILE_ERR,
     INTERPRET_RUNTIME_ERR,
+    // out of budget: the vm is left as it was, resume() carries on
+    INTERPRET_YIELD,
 } InterpretResult;
 
+#define BUDGET_UNLIMITED INT64_MAX
+
+extern VM vm;
+
 void init_vm();
 void free_vm();
 
 // takes ownership of source
 InterpretResult interpret(const char* source);
+// reads the script as it compiles it, instead of all at once
+InterpretResult interpret_file(FILE* file);
+
+// interpret() in two steps, so a script can be run a bit at a time: compiles
+// it, without running anything
+InterpretResult load_script(const char* source);
+// runs the loaded script for about `budget` dispatched instructions (a
+// superinstruction is one): it yields at the first loop back after they've
+// run out. INTERPRET_YIELD means it isn't done yet
+InterpretResult resume(int64_t budget);
+
+// the last script's, from load_script() (or interpret()) on, every resume()
+// included
+InterpretStats interpret_stats();
+
+// report an error at the current instruction (natives use this too)
+void runtime_err(const char* format, ...);
+
+// registers a module, so it's never imported again
+void add_module(Module* module);
+
+// index of the global called `name`, which is added if it doesn't exist yet
+int global_slot(ObjString* name);
+const char* global_name(int slot);
+
+// replaces the two strings on top of the stack with them joined together
+void concatenate();
+// replaces the `count` values on top of the stack with one string of them all,
+// each as print_value() would print it (OP_FORMAT). false (after reporting it)
+// if that's too long
+bool format_parts(int count);
+
+// makes room for `depth` more values above stack_top. the stack may move, so
+// every pointer into it (run()'s included) has to be loaded again after
+void reserve_stack(int depth);
 
 void push(Value value);
 Value pop();
\ No newline at end of file